@@ -0,0 +1,58 @@
+#pragma once
+
+#include "telemetry.h"
+
+/* Optional recorder of the entry point calls made by the host tool
+ * (STM32CubeProgrammer, J-Link, ...). Every outermost call is appended to
+ * a table in the DIAG region; back-to-back calls of the same kind over a
+ * contiguous range with the same size are merged into one record with a
+ * repeat count, so a whole 2 MB session fits in a few records. Replay a
+ * dump against the simulated flash with tools/call_replay.py.
+ * The calls are captured through telemetry_begin()/telemetry_end(), so
+ * the recorder needs LOADER_TELEMETRY. */
+#ifndef LOADER_CALL_TRACE
+#define LOADER_CALL_TRACE 0
+#endif
+
+#if LOADER_CALL_TRACE && !LOADER_TELEMETRY
+#error "LOADER_CALL_TRACE requires LOADER_TELEMETRY"
+#endif
+
+#ifndef CALL_TRACE_DEPTH
+#define CALL_TRACE_DEPTH 128
+#endif
+
+#define CALL_TRACE_MAGIC 0x4C4C4143 /* "CALL" */
+#define CALL_TRACE_VERSION 1
+
+typedef struct
+{
+    uint8_t op;        /*!< telemetry_op_t */
+    uint8_t status;    /*!< 0 on success, error code otherwise */
+    uint16_t reserved;
+    uint32_t address;  /*!< First argument, usually the flash address */
+    uint32_t size;     /*!< Byte count (sector count for SEGGER_FL_Erase) */
+    uint32_t arg;      /*!< Entry point specific: InitVal, polynomial, blank value... */
+    uint32_t repeat;   /*!< Number of merged calls, each advancing address by size */
+    uint32_t cycles;   /*!< DWT cycles spent in all merged calls */
+} call_trace_record_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t depth;
+    uint32_t count;    /*!< Records in use */
+    uint32_t dropped;  /*!< Calls lost because the table was full */
+    uint32_t core_clock_hz;
+    uint32_t reserved[2];
+    call_trace_record_t records[CALL_TRACE_DEPTH];
+} call_trace_t;
+
+#if LOADER_CALL_TRACE
+void call_trace_begin(uint32_t op, uint32_t address, uint32_t size, uint32_t arg);
+void call_trace_end(uint32_t status, uint32_t cycles);
+#else
+static inline void call_trace_begin(uint32_t op, uint32_t address, uint32_t size, uint32_t arg) { (void)op; (void)address; (void)size; (void)arg; }
+static inline void call_trace_end(uint32_t status, uint32_t cycles) { (void)status; (void)cycles; }
+#endif
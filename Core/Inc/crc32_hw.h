@@ -0,0 +1,8 @@
+#pragma once
+
+#include "main.h"
+
+/* CRC-32 (IEEE 802.3, same as zlib crc32()) on the CRC peripheral */
+
+void crc32_hw_init(void);
+uint32_t crc32_hw_compute(const uint8_t *data, uint32_t size);
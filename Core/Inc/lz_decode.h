@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Streaming decoder for the WLZ1 format written by tools/lz_pack.py.
+ *
+ * Stream: u32 magic, u32 decoded size, then tokens
+ *   0x00-0x7F  literal run, (token + 1) bytes follow
+ *   0x80-0xFF  match of (token & 0x7F) + 3 bytes, followed by a little
+ *              endian u16 holding distance - 1 (distance 1..LZ_WINDOW)
+ *
+ * Output goes through a LZ_WINDOW ring indexed by the destination address,
+ * so every flushed chunk is contiguous and never crosses a LZ_FLUSH
+ * (flash page) boundary. Plain C without HAL dependencies so the packer
+ * can build it for the host. */
+
+#define LZ_MAGIC 0x315A4C57 /* "WLZ1" */
+#define LZ_HEADER_SIZE 8
+#define LZ_WINDOW 4096
+#define LZ_FLUSH 256
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (0x7F + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+
+#define LZ_ERR_FORMAT (-1)
+#define LZ_ERR_SINK (-2)
+
+/* Receives decoded data at byte offset 'offset' of the output, returns 0 to
+ * continue */
+typedef int (*lz_sink_t)(void *ctx, uint32_t offset, const uint8_t *data, uint32_t size);
+
+int32_t lz_decoded_size(const uint8_t *src, uint32_t size);
+int32_t lz_decode(const uint8_t *src, uint32_t size, uint32_t base, lz_sink_t sink, void *ctx);
@@ -53,6 +53,8 @@ extern "C" {
 void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
+void SystemClock_Config(void);
+uint8_t SystemClock_IsConfigured(void);
 
 /* USER CODE END EFP */
 
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "main.h"
+#include "w25qxx.h"
+
+/* Optional fingerprint manifest in the last sector of the flash. It holds
+ * the CRC-32 (as zlib crc32()) of every data sector and a generation
+ * number, so the host can decide what to reflash from a single sector
+ * read instead of reading back the whole chip (tools/flash_plan.py
+ * --manifest). The session state is dropped by Init(); a Verify() that
+ * finds the table stale or missing without it rehashes the whole flash. With the manifest enabled StorageInfo / FlashDevice only
+ * advertise the range below it. */
+#ifndef LOADER_MANIFEST
+#define LOADER_MANIFEST 0
+#endif
+
+#if LOADER_MANIFEST
+#define MEMORY_MANIFEST_SIZE MEMORY_SECTOR_SIZE
+#else
+#define MEMORY_MANIFEST_SIZE 0
+#endif
+
+#define MEMORY_USABLE_SIZE (MEMORY_FLASH_SIZE - MEMORY_MANIFEST_SIZE)
+#define MEMORY_MANIFEST_ADDR (MEMORY_BASE_ADDR + MEMORY_USABLE_SIZE)
+
+#define MANIFEST_MAGIC 0x544E464D /* "MFNT" */
+#define MANIFEST_VERSION 1
+#define MANIFEST_SECTORS (MEMORY_USABLE_SIZE / MEMORY_SECTOR_SIZE)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t generation;   /*!< Incremented on every update */
+    uint32_t sector_size;
+    uint32_t sector_count;
+    uint32_t table_crc;    /*!< CRC-32 of crc[] */
+    uint32_t stale;        /*!< 0xFFFFFFFF while crc[] is current, programmed
+                                to 0 before the first data sector changes */
+    uint32_t reserved;
+} manifest_header_t;
+
+typedef struct
+{
+    manifest_header_t header;
+    uint32_t crc[MANIFEST_SECTORS];
+} manifest_t;
+
+#if LOADER_MANIFEST
+void manifest_reset(void);
+HAL_StatusTypeDef manifest_mark(uint32_t address, uint32_t size);
+HAL_StatusTypeDef manifest_verified(uint32_t address, uint32_t size);
+HAL_StatusTypeDef manifest_commit(void);
+#else
+static inline void manifest_reset(void) {}
+static inline HAL_StatusTypeDef manifest_mark(uint32_t address, uint32_t size) { (void)address; (void)size; return HAL_OK; }
+static inline HAL_StatusTypeDef manifest_verified(uint32_t address, uint32_t size) { (void)address; (void)size; return HAL_OK; }
+static inline HAL_StatusTypeDef manifest_commit(void) { return HAL_OK; }
+#endif
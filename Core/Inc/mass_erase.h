@@ -0,0 +1,21 @@
+#pragma once
+
+#include "main.h"
+#include "w25qxx.h"
+
+/* Chip erase that only erases what is in use. The 64K blocks are first
+ * scanned for non-blank words through the memory-mapped window (a few
+ * hundred ms for a blank chip, much less for used blocks, which stop at
+ * the first programmed word). The blocks in use are then erased one by
+ * one when that is cheaper than a chip erase at both the typical and the
+ * maximum W25Q16JV timings in w25qxx.h, otherwise the whole chip is erased.
+ * With LOADER_SMART_MASS_ERASE=0 mass_erase() is a plain chip erase. */
+#ifndef LOADER_SMART_MASS_ERASE
+#define LOADER_SMART_MASS_ERASE 1
+#endif
+
+#if LOADER_SMART_MASS_ERASE
+HAL_StatusTypeDef mass_erase(void);
+#else
+static inline HAL_StatusTypeDef mass_erase(void) { return w25qxx_erase_chip(); }
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "main.h"
+
+/* Optional trace of every QSPI transaction issued by the flash driver. The
+ * records go into a RAM ring buffer in the DIAG region which the debugger
+ * can dump; tools/trace_export.py turns a dump into a Chrome/Perfetto
+ * trace. */
+#ifndef LOADER_TRACE
+#define LOADER_TRACE 0
+#endif
+
+/* Number of records kept, must be a power of two */
+#ifndef QSPI_TRACE_DEPTH
+#define QSPI_TRACE_DEPTH 128
+#endif
+
+#define QSPI_TRACE_MAGIC 0x43525451 /* "QTRC" */
+#define QSPI_TRACE_VERSION 1
+
+typedef enum
+{
+    QSPI_TRACE_COMMAND,
+    QSPI_TRACE_POLL,
+    QSPI_TRACE_MEMORY_MAPPED,
+    QSPI_TRACE_ABORT
+} qspi_trace_kind_t;
+
+typedef struct
+{
+    uint32_t start;   /*!< DWT cycle count when the command was issued */
+    uint32_t end;     /*!< DWT cycle count when the transaction completed */
+    uint32_t address;
+    uint32_t length;  /*!< Data phase length in bytes */
+    uint8_t opcode;
+    uint8_t kind;     /*!< qspi_trace_kind_t */
+    uint8_t lines;    /*!< Line count codes (0 none, 1, 2, 3 quad): instruction [1:0], address [3:2], data [5:4], DDR [6] */
+    uint8_t dummy;    /*!< Dummy cycles */
+} qspi_trace_record_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t core_clock_hz;
+    uint32_t depth;
+    volatile uint32_t head; /*!< Records written so far, the latest one is records[(head - 1) % depth] */
+    uint32_t reserved[3];
+    qspi_trace_record_t records[QSPI_TRACE_DEPTH];
+} qspi_trace_t;
+
+#if LOADER_TRACE
+void qspi_trace_begin(const QSPI_CommandTypeDef *cmd, qspi_trace_kind_t kind);
+void qspi_trace_end(void);
+#else
+static inline void qspi_trace_begin(const QSPI_CommandTypeDef *cmd, qspi_trace_kind_t kind) { (void)cmd; (void)kind; }
+static inline void qspi_trace_end(void) {}
+#endif
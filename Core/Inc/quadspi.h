@@ -41,6 +41,7 @@ extern QSPI_HandleTypeDef hqspi;
 void MX_QUADSPI_Init(void);
 
 /* USER CODE BEGIN Prototypes */
+HAL_StatusTypeDef MX_QUADSPI_Attach(void);
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
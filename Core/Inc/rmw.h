@@ -0,0 +1,22 @@
+#pragma once
+
+#include "main.h"
+#include "w25qxx.h"
+#include "write_cache.h"
+
+/* Optional read-modify-write for Write(). Normally Write() expects an
+ * erased target and NOR programming can only clear bits. With
+ * LOADER_WRITE_RMW each affected sector is read back first; when the new
+ * bytes need a 0 -> 1 transition the sector is merged in RAM, erased and
+ * only its non-blank pages are reprogrammed, so the host can send just
+ * the bytes it changes. Pages whose content already matches are skipped.
+ * Bypasses the write cache (write_cache.h), which is flushed first. */
+#ifndef LOADER_WRITE_RMW
+#define LOADER_WRITE_RMW 0
+#endif
+
+#if LOADER_WRITE_RMW
+HAL_StatusTypeDef rmw_write(uint8_t *buffer, uint32_t offset, uint32_t size);
+#else
+static inline HAL_StatusTypeDef rmw_write(uint8_t *buffer, uint32_t offset, uint32_t size) { return write_cache_write(buffer, offset, size); }
+#endif
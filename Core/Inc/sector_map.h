@@ -0,0 +1,47 @@
+#pragma once
+
+#include "main.h"
+#include "w25qxx.h"
+#include "rmw.h"
+
+/* Optional erase-on-first-touch. Each 4K sector has a session state in
+ * RAM: unknown, erased (blank checked or erased by the loader) or
+ * programmed (written this session after being erased). With
+ * LOADER_LAZY_ERASE Write() erases a sector the first time it touches it,
+ * unless a blank check shows it is already erased, so the host can skip
+ * the up-front erase of the image range. Erases of known-erased sectors
+ * and blank checks of known-erased ranges return at once. Sectors the
+ * session never writes are left as they are.
+ * The state is dropped by every Init(), and STM32CubeProgrammer calls
+ * Init() between operations, so a sector with data may hold an earlier
+ * session's part of the image. It is never erased as a whole unless the
+ * Write() covers it: when the written part is blank it is programmed in
+ * place, otherwise the data around it is merged back after the erase
+ * (one sector read, erase and reprogram per such Write()). Hosts that
+ * send whole sectors, as with the 8K MEMORY_TRANSFER_PAGE_SIZE, only pay
+ * the blank check. Keeping the state across sessions is not safe, the
+ * flash may have been changed in between by another loader or the
+ * application. */
+#ifndef LOADER_LAZY_ERASE
+#define LOADER_LAZY_ERASE 0
+#endif
+
+#if LOADER_LAZY_ERASE && LOADER_WRITE_RMW
+#error "LOADER_LAZY_ERASE erases sectors that LOADER_WRITE_RMW would merge, enable only one"
+#endif
+
+#if LOADER_LAZY_ERASE
+void sector_map_reset(void);
+HAL_StatusTypeDef sector_map_prepare(uint32_t address, uint32_t size);
+HAL_StatusTypeDef sector_map_erase(uint32_t offset);
+void sector_map_erased_all(void);
+void sector_map_programmed(uint32_t address, uint32_t size);
+uint32_t sector_map_blank(uint32_t address, uint32_t size);
+#else
+static inline void sector_map_reset(void) {}
+static inline HAL_StatusTypeDef sector_map_prepare(uint32_t address, uint32_t size) { (void)address; (void)size; return HAL_OK; }
+static inline HAL_StatusTypeDef sector_map_erase(uint32_t offset) { return w25qxx_erase_sector(offset); }
+static inline void sector_map_erased_all(void) {}
+static inline void sector_map_programmed(uint32_t address, uint32_t size) { (void)address; (void)size; }
+static inline uint32_t sector_map_blank(uint32_t address, uint32_t size) { (void)address; (void)size; return 0; }
+#endif
@@ -8,3 +8,11 @@ int SEGGER_FL_Program(unsigned long DestAddr, unsigned long NumBytes, unsigned c
 int SEGGER_FL_Erase(unsigned long SectorAddr, unsigned long SectorIndex, unsigned long NumSectors);
 int SEGGER_FL_EraseChip(void);
 int SEGGER_FL_Read(unsigned long Addr, unsigned long NumBytes, unsigned char *pDestBuff);
+int SEGGER_FL_Fill(unsigned long Addr, unsigned long NumBytes, unsigned char *pPattern, unsigned long PatternLen);
+/* Any size and alignment through SEGGER_FL_Program(), not the turbo mode */
+int SEGGER_OPEN_Program(unsigned long DestAddr, unsigned long NumBytes, unsigned char *pSrcBuff);
+
+/* Loader-specific, not part of the SEGGER API: the streaming mode on the
+ * stream_mailbox block (stream.h), started from a J-Link script or
+ * tools/stream_harness.py */
+int StreamStart(unsigned long StartPara0, unsigned long StartPara1, unsigned long StartPara2);
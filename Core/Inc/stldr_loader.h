@@ -4,10 +4,43 @@
 
 #define SECTION(x) __attribute__((section(x)))
 
+/* Batch() operations, see batch_op_t */
+typedef enum
+{
+    BATCH_ERASE,            /*!< Erase the sectors overlapping address/size */
+    BATCH_PROGRAM,          /*!< Program size bytes from Data + offset */
+    BATCH_PROGRAM_COMPRESSED, /*!< WLZ1 stream of size bytes at Data + offset */
+    BATCH_VERIFY,           /*!< Compare size bytes with Data + offset */
+    BATCH_CRC,              /*!< CRC-32 of the range, stored at Data + offset */
+    BATCH_FILL,             /*!< Pattern of length bytes at Data + offset */
+    BATCH_MASS_ERASE,       /*!< Erase the whole chip, other fields unused */
+} batch_op_code_t;
+
+typedef enum
+{
+    BATCH_STATUS_OK,
+    BATCH_STATUS_FAIL,
+    BATCH_STATUS_SKIPPED,   /*!< Not run, an earlier operation failed */
+    BATCH_STATUS_BAD_OP,
+} batch_status_t;
+
+typedef struct
+{
+    uint32_t op;            /*!< batch_op_code_t */
+    uint32_t address;
+    uint32_t size;
+    uint32_t offset;        /*!< Into the Data buffer */
+    uint32_t length;        /*!< BATCH_FILL pattern length, unused otherwise */
+} batch_op_t;
+
 int Init(void) SECTION(".loader");
 int Read(uint32_t Address, uint32_t Size, uint8_t *Buffer) SECTION(".loader");
 int Write(uint32_t Address, uint32_t Size, uint8_t *buffer) SECTION(".loader");
 int SectorErase(uint32_t EraseStartAddress, uint32_t EraseEndAddress) SECTION(".loader");
 int MassErase(void) SECTION(".loader");
 uint32_t CheckSum(uint32_t StartAddress, uint32_t Size, uint32_t InitVal) SECTION(".loader");
-uint64_t Verify(uint32_t MemoryAddr, uint32_t RAMBufferAddr, uint32_t Size, uint32_t missalignement) SECTION(".loader");
\ No newline at end of file
+uint64_t Verify(uint32_t MemoryAddr, uint32_t RAMBufferAddr, uint32_t Size, uint32_t missalignement) SECTION(".loader");
+int SectorCrc(uint32_t StartAddress, uint32_t Size, uint32_t *Table) SECTION(".loader");
+int WriteCompressed(uint32_t Address, uint32_t Size, uint8_t *buffer) SECTION(".loader");
+int Fill(uint32_t Address, uint32_t Size, uint8_t *Pattern, uint32_t PatternLen) SECTION(".loader");
+int Batch(uint32_t Count, const batch_op_t *Ops, uint8_t *Data, uint32_t *Status) SECTION(".loader");
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+
+/* RAM mailbox for streaming programming (StreamStart).
+ *
+ * The host waits for magic before the first block. It owns head, the
+ * loader owns tail. To send a block the host fills
+ * slots[head % STREAM_SLOTS] and then increments head; the loader programs
+ * the slot while the host downloads into the next one, and increments tail
+ * when the slot may be reused. A block with size 0, or command set to
+ * STREAM_CMD_STOP, ends the session once all blocks before it are done.
+ *
+ * This is the loader's own protocol, driven from a J-Link script or
+ * tools/stream_harness.py; it is portable C so the harness can build it
+ * for the host. */
+
+#ifndef STREAM_SLOT_SIZE
+#define STREAM_SLOT_SIZE 4096
+#endif
+
+#ifndef STREAM_SLOTS
+#define STREAM_SLOTS 2
+#endif
+
+/* A session ends with STREAM_ERR_TIMEOUT when neither a block nor the
+ * stop command arrives for this long, e.g. after the host script died */
+#ifndef STREAM_TIMEOUT_MS
+#define STREAM_TIMEOUT_MS 5000
+#endif
+
+#ifndef STREAM_BARRIER
+#define STREAM_BARRIER() __sync_synchronize()
+#endif
+
+#define STREAM_MAGIC 0x4D525453 /* "STRM" */
+
+#define STREAM_CMD_RUN 0
+#define STREAM_CMD_STOP 1
+
+#define STREAM_OK 0
+#define STREAM_ERR_PROGRAM 1
+#define STREAM_ERR_SIZE 2
+#define STREAM_ERR_TIMEOUT 3
+
+typedef struct
+{
+    uint32_t address;
+    uint32_t size;
+    uint8_t data[STREAM_SLOT_SIZE];
+} stream_slot_t;
+
+typedef struct
+{
+    volatile uint32_t magic;       /*!< Set by the loader once it is polling */
+    volatile uint32_t command;     /*!< Host: STREAM_CMD_* */
+    volatile uint32_t head;        /*!< Host: blocks written */
+    volatile uint32_t tail;        /*!< Loader: blocks consumed */
+    volatile uint32_t status;      /*!< Loader: STREAM_OK or STREAM_ERR_* */
+    volatile uint32_t bytes;       /*!< Loader: bytes programmed */
+    uint32_t slot_size;
+    uint32_t slot_count;
+    stream_slot_t slots[STREAM_SLOTS];
+} stream_mailbox_t;
+
+/* Programs one block, returns 0 on success */
+typedef int (*stream_program_t)(uint32_t address, const uint8_t *data, uint32_t size);
+
+/* Millisecond clock for the idle timeout, may wrap */
+typedef uint32_t (*stream_clock_t)(void);
+
+uint32_t stream_run(stream_mailbox_t *mailbox, stream_program_t program, stream_clock_t now_ms);
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "main.h"
+
+/* Per entry point statistics kept in a fixed RAM location (see the DIAG
+ * region in the linker scripts) so a debugger can read them back after a
+ * session. Decode a dump with tools/telemetry_decode.py.
+ * telemetry_begin() takes the entry point arguments (address, size and one
+ * extra argument) for the host-call recorder, see call_trace.h. */
+#ifndef LOADER_TELEMETRY
+#define LOADER_TELEMETRY 1
+#endif
+
+/* Bump TELEMETRY_VERSION with every change to telemetry_t or the op
+ * table, tools/telemetry_decode.py checks it */
+#define TELEMETRY_MAGIC 0x4D4C4554 /* "TELM" */
+#define TELEMETRY_VERSION 2
+
+/* Error codes besides the HAL_StatusTypeDef values */
+#define TELEMETRY_ERR_VERIFY 0x10
+#define TELEMETRY_ERR_BLANK 0x11
+
+typedef enum
+{
+    TELEMETRY_INIT,
+    TELEMETRY_WRITE,
+    TELEMETRY_READ,
+    TELEMETRY_SECTOR_ERASE,
+    TELEMETRY_MASS_ERASE,
+    TELEMETRY_CHECKSUM,
+    TELEMETRY_VERIFY,
+    TELEMETRY_FL_ERASE,
+    TELEMETRY_FL_VERIFY,
+    TELEMETRY_FL_CHECK_BLANK,
+    TELEMETRY_FL_CALC_CRC,
+    TELEMETRY_SECTOR_CRC,
+    TELEMETRY_WRITE_COMPRESSED,
+    TELEMETRY_FILL,
+    TELEMETRY_BATCH,
+    TELEMETRY_STREAM,
+    TELEMETRY_OP_NUM
+} telemetry_op_t;
+
+typedef struct
+{
+    uint64_t cycles_total;    /*!< DWT cycles, average = cycles_total / calls */
+    uint32_t calls;
+    uint32_t bytes;
+    uint32_t commands;        /*!< QSPI commands issued */
+    uint32_t polls;           /*!< Status register polls */
+    uint32_t skipped_pages;   /*!< Pages not programmed (blank/unchanged) */
+    uint32_t skipped_sectors; /*!< Sectors not erased (already blank) */
+    uint32_t errors;
+    uint32_t last_error;
+    uint32_t cycles_min;
+    uint32_t cycles_max;
+} telemetry_op_stats_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t core_clock_hz;   /*!< To convert cycles into time */
+    uint32_t op_num;
+    uint32_t init_attached;   /*!< Init() calls served by the fast attach path */
+    uint32_t reserved[3];
+    telemetry_op_stats_t ops[TELEMETRY_OP_NUM];
+} telemetry_t;
+
+#if LOADER_TELEMETRY
+void telemetry_begin(telemetry_op_t op, uint32_t address, uint32_t size, uint32_t arg);
+void telemetry_end(uint32_t bytes, uint32_t error);
+void telemetry_count_command(void);
+void telemetry_count_poll(void);
+void telemetry_count_skipped_pages(uint32_t pages);
+void telemetry_count_skipped_sectors(uint32_t sectors);
+void telemetry_count_init_attached(void);
+#else
+static inline void telemetry_begin(telemetry_op_t op, uint32_t address, uint32_t size, uint32_t arg) { (void)op; (void)address; (void)size; (void)arg; }
+static inline void telemetry_end(uint32_t bytes, uint32_t error) { (void)bytes; (void)error; }
+static inline void telemetry_count_command(void) {}
+static inline void telemetry_count_poll(void) {}
+static inline void telemetry_count_skipped_pages(uint32_t pages) { (void)pages; }
+static inline void telemetry_count_skipped_sectors(uint32_t sectors) { (void)sectors; }
+static inline void telemetry_count_init_attached(void) {}
+#endif
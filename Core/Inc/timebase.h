@@ -0,0 +1,10 @@
+#pragma once
+
+#include "main.h"
+
+void timebase_init(void);
+uint32_t timebase_get_cycles(void);
+uint32_t timebase_get_ms(void);
+uint32_t timebase_cycles_to_us(uint32_t cycles);
+void timebase_delay_us(uint32_t us);
+void timebase_delay_ms(uint32_t ms);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "main.h"
+#include "w25qxx.h"
+
+/* Optional verify policies for Verify() / SEGGER_FL_Verify().
+ *
+ *   VERIFY_POLICY_FULL     byte-wise compare with the host buffer (default)
+ *   VERIFY_POLICY_CRC      CRC-32 of every chunk, computed on the CRC
+ *                          peripheral and compared with the host table
+ *                          verify_config.crc[], the host buffer is not read
+ *   VERIFY_POLICY_SAMPLED  compare one page in verify_config.every, picked
+ *                          by a hash of the page index and seed, plus the
+ *                          CRC-32 of the whole image once the Verify() call
+ *                          reaching its end comes in
+ *
+ * The host writes the verify_config block (magic last) to supply the
+ * expected CRCs; its policy field selects the policy, or the build default
+ * LOADER_VERIFY_POLICY when left at VERIFY_POLICY_DEFAULT. Without a valid
+ * block there is nothing to check a CRC against and Verify() compares in
+ * full. Bytes outside [base, base + size) are always compared in full, as
+ * are CRC chunks past the end of crc[]. With VERIFY_POLICY_CRC and
+ * VERIFY_POLICY_SAMPLED the host only needs to download the buffer for
+ * those bytes and for the sampled pages.
+ *
+ * verify_config is a .bss object of the loader (look up the symbol in the
+ * loader ELF, as tools/loader_host.py does); as there is no startup code
+ * it is not cleared by a download and keeps its contents across calls. A
+ * full Init() after a reset drops it, an Init() that reattaches to the
+ * configured target keeps it when its fields are in range, so the host
+ * writes it after the first Init() of the session. The Verify() call that
+ * reaches the end of the image uses it up. */
+#define VERIFY_POLICY_DEFAULT 0
+#define VERIFY_POLICY_FULL 1
+#define VERIFY_POLICY_CRC 2
+#define VERIFY_POLICY_SAMPLED 3
+
+#ifndef LOADER_VERIFY_POLICY
+#define LOADER_VERIFY_POLICY VERIFY_POLICY_FULL
+#endif
+
+/* The verify_config block, on by default when the build selects a policy
+ * other than the full compare */
+#ifndef LOADER_VERIFY_POLICIES
+#define LOADER_VERIFY_POLICIES (LOADER_VERIFY_POLICY != VERIFY_POLICY_FULL)
+#endif
+
+#if !LOADER_VERIFY_POLICIES && LOADER_VERIFY_POLICY != VERIFY_POLICY_FULL
+#error "LOADER_VERIFY_POLICY needs LOADER_VERIFY_POLICIES for the expected CRCs"
+#endif
+
+#define VERIFY_CONFIG_MAGIC 0x50465256 /* "VRFP" */
+#define VERIFY_CRC_CHUNKS 64
+
+typedef struct
+{
+    uint32_t magic;       /*!< Host: VERIFY_CONFIG_MAGIC once the block is complete */
+    uint32_t policy;      /*!< Host: VERIFY_POLICY_* */
+    uint32_t base;        /*!< Host: memory-mapped address of the image */
+    uint32_t size;        /*!< Host: image length in bytes */
+    uint32_t chunk;       /*!< Host: bytes per crc[] entry, the last one may be shorter */
+    uint32_t every;       /*!< Host: sampled, compare one page in this many */
+    uint32_t seed;        /*!< Host: sampled, page selection */
+    uint32_t image_crc;   /*!< Host: sampled, CRC-32 of the whole image */
+    uint32_t crc[VERIFY_CRC_CHUNKS]; /*!< Host: CRC-32 (as zlib crc32()) per chunk */
+} verify_config_t;
+
+#if LOADER_VERIFY_POLICIES
+extern verify_config_t verify_config;
+
+void verify_policy_reset(void);
+void verify_policy_attach(void);
+uint32_t verify_policy_get(void);
+uint32_t verify_policy_check(uint32_t address, const uint8_t *buffer, uint32_t size);
+#else
+static inline void verify_policy_reset(void) {}
+static inline void verify_policy_attach(void) {}
+static inline uint32_t verify_policy_get(void) { return VERIFY_POLICY_FULL; }
+static inline uint32_t verify_policy_check(uint32_t address, const uint8_t *buffer, uint32_t size) { (void)address; (void)buffer; (void)size; return 0; }
+#endif
@@ -5,8 +5,42 @@
 #define MEMORY_FLASH_SIZE 0x200000
 #define MEMORY_PAGE_SIZE  0x100
 #define MEMORY_SECTOR_SIZE 0x1000
+#define MEMORY_BLOCK_SIZE 0x10000
+
+/* Program granularity advertised to the host (StorageInfo.PageSize,
+ * FlashDevice.szPage). The host then sends this many bytes per Write() /
+ * SEGGER_FL_Program() call and w25qxx_write() splits them into
+ * MEMORY_PAGE_SIZE page programs. The host keeps the buffer in RAM behind
+ * the loader, stldr_linker.ld / segger_linker.ld check that it fits. */
+#ifndef MEMORY_TRANSFER_PAGE_SIZE
+#define MEMORY_TRANSFER_PAGE_SIZE 0x2000
+#endif
+
+#if (MEMORY_TRANSFER_PAGE_SIZE % MEMORY_PAGE_SIZE) || (MEMORY_TRANSFER_PAGE_SIZE > 0x10000)
+#error "MEMORY_TRANSFER_PAGE_SIZE must be a multiple of MEMORY_PAGE_SIZE and at most 64K"
+#endif
+
+/* W25Q16JV reset recovery, typical and worst case busy times, in us / ms.
+ * Also used by mass_erase.c and read by tools/w25q_model.py. */
+#define W25X_tRST_US 30U
+#define W25X_tPP_TYP_US 400U
+#define W25X_tSE_TYP_US 45000U
+#define W25X_tBE_TYP_US 150000U
+#define W25X_tCE_TYP_US 5000000U
+#define W25X_tPP_MAX_MS 3U
+#define W25X_tSE_MAX_MS 400U
+#define W25X_tBE_MAX_MS 2000U
+#define W25X_tCE_MAX_MS 25000U
+
+/* Set QE through the volatile status register (0x50) instead of the
+ * non-volatile one. QE then has to be restored after every power cycle,
+ * which Init() does anyway. */
+#ifndef W25QXX_QE_VOLATILE
+#define W25QXX_QE_VOLATILE 0
+#endif
 
 void w25qxx_init(void);
+HAL_StatusTypeDef w25qxx_attach(void);
 HAL_StatusTypeDef w25qxx_erase_sector(uint32_t SectorAddress);
 HAL_StatusTypeDef w25qxx_erase_block(uint32_t BlockAddress);
 HAL_StatusTypeDef w25qxx_erase_chip(void);
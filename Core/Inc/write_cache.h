@@ -0,0 +1,27 @@
+#pragma once
+
+#include "main.h"
+#include "w25qxx.h"
+
+/* Optional write-combining cache for Write(). Hosts that split a HEX image
+ * into records send chunks that start and end inside flash pages, and
+ * every fragment would cost its own page program. With the cache a
+ * partial page is held in RAM until it is complete, the next Write() is
+ * not contiguous with it, or another entry point needs the flash
+ * contents (write_cache_flush()). Off by default: a session that ends
+ * with a Write() and nothing else leaves the last partial page unwritten,
+ * which STM32CubeProgrammer does when verification is disabled. A full
+ * Init() discards a page still pending from before a target reset. */
+#ifndef LOADER_WRITE_CACHE
+#define LOADER_WRITE_CACHE 0
+#endif
+
+#if LOADER_WRITE_CACHE
+void write_cache_reset(void);
+HAL_StatusTypeDef write_cache_write(uint8_t *buffer, uint32_t offset, uint32_t size);
+HAL_StatusTypeDef write_cache_flush(void);
+#else
+static inline void write_cache_reset(void) {}
+static inline HAL_StatusTypeDef write_cache_write(uint8_t *buffer, uint32_t offset, uint32_t size) { return w25qxx_write(buffer, offset, size); }
+static inline HAL_StatusTypeDef write_cache_flush(void) { return HAL_OK; }
+#endif
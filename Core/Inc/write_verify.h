@@ -0,0 +1,59 @@
+#pragma once
+
+#include "main.h"
+#include "w25qxx.h"
+#include "rmw.h"
+
+/* Optional fused program and verify for Write(). Each page is read back
+ * and compared right after it is programmed, while the host buffer is
+ * still at hand, and Write() fails at the first page that does not match
+ * (its address is left in write_verify.fail_address). The ranges that
+ * passed are kept in write_verify.range[], a RAM block the host can read
+ * through the write_verify symbol; Verify() / SEGGER_FL_Verify() skip the
+ * compare for a range they cover. Anything that changes the flash
+ * afterwards drops the ranges it overlaps. STM32CubeProgrammer calls
+ * Init() between the writes and Verify(), so an Init() that reattaches
+ * to the still configured QUADSPI keeps the ranges when the block checks
+ * out (magic, count and a check word over the ranges); a full Init()
+ * after a reset drops them all. The assumption is that nothing but the
+ * loader changes the flash while the target stays configured: a host
+ * that runs other code in between must reset the target first. */
+#ifndef LOADER_WRITE_VERIFY
+#define LOADER_WRITE_VERIFY 0
+#endif
+
+#if LOADER_WRITE_VERIFY && LOADER_WRITE_CACHE
+#error "LOADER_WRITE_VERIFY needs the data programmed before Write() returns, disable LOADER_WRITE_CACHE"
+#endif
+
+#define WRITE_VERIFY_MAGIC 0x46525657 /* "WVRF" */
+#define WRITE_VERIFY_RANGES 8
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t fail_address;  /*!< First page that did not read back, 0 if none */
+    uint32_t count;         /*!< Valid entries in range[] */
+    struct
+    {
+        uint32_t start;     /*!< Memory-mapped address */
+        uint32_t end;       /*!< Exclusive */
+    } range[WRITE_VERIFY_RANGES];
+    uint32_t check;         /*!< Over magic, count and range[], see write_verify_attach() */
+} write_verify_t;
+
+#if LOADER_WRITE_VERIFY
+extern write_verify_t write_verify;
+
+void write_verify_reset(void);
+void write_verify_attach(void);
+HAL_StatusTypeDef write_verify_write(uint8_t *buffer, uint32_t address, uint32_t size);
+void write_verify_forget(uint32_t address, uint32_t size);
+uint32_t write_verify_covered(uint32_t address, uint32_t size);
+#else
+static inline void write_verify_reset(void) {}
+static inline void write_verify_attach(void) {}
+static inline HAL_StatusTypeDef write_verify_write(uint8_t *buffer, uint32_t address, uint32_t size) { return rmw_write(buffer, address - MEMORY_BASE_ADDR, size); }
+static inline void write_verify_forget(uint32_t address, uint32_t size) { (void)address; (void)size; }
+static inline uint32_t write_verify_covered(uint32_t address, uint32_t size) { (void)address; (void)size; return 0; }
+#endif
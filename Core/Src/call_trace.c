@@ -0,0 +1,58 @@
+#include <string.h>
+#include "call_trace.h"
+
+#if LOADER_CALL_TRACE
+
+/* Default visibility, see loader_telemetry */
+call_trace_t call_trace __attribute__((section(".calltrace"), used, visibility("default")));
+
+static call_trace_record_t pending;
+
+void call_trace_begin(uint32_t op, uint32_t address, uint32_t size, uint32_t arg)
+{
+    if (call_trace.magic != CALL_TRACE_MAGIC || call_trace.version != CALL_TRACE_VERSION)
+    {
+        memset(&call_trace, 0, sizeof(call_trace));
+        call_trace.magic = CALL_TRACE_MAGIC;
+        call_trace.version = CALL_TRACE_VERSION;
+        call_trace.depth = CALL_TRACE_DEPTH;
+    }
+
+    pending.op = op;
+    pending.address = address;
+    pending.size = size;
+    pending.arg = arg;
+}
+
+void call_trace_end(uint32_t status, uint32_t cycles)
+{
+    call_trace_record_t *last = NULL;
+
+    pending.status = (status > 0xFF) ? 0xFF : status;
+    call_trace.core_clock_hz = SystemCoreClock;
+
+    if (call_trace.count != 0)
+    {
+        last = &call_trace.records[call_trace.count - 1];
+        if (last->op == pending.op && last->status == 0 && pending.status == 0 &&
+            last->size == pending.size && last->arg == pending.arg && pending.size != 0 &&
+            last->address + last->repeat * last->size == pending.address)
+        {
+            last->repeat++;
+            last->cycles += cycles;
+            return;
+        }
+    }
+
+    if (call_trace.count >= CALL_TRACE_DEPTH)
+    {
+        call_trace.dropped++;
+        return;
+    }
+
+    pending.repeat = 1;
+    pending.cycles = cycles;
+    call_trace.records[call_trace.count++] = pending;
+}
+
+#endif
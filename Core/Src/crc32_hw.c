@@ -0,0 +1,50 @@
+#include "crc32_hw.h"
+
+/* The HAL CRC module is not part of the loader build, the peripheral is
+ * programmed directly. Reflected input, reflected output, the default
+ * 0x04C11DB7 polynomial and a 0xFFFFFFFF seed give the standard CRC-32 once
+ * the result is inverted. The input reversal has to match the write width:
+ * by byte for byte writes, over the whole word for word writes, so that the
+ * little-endian bytes of a word enter the CRC in memory order. */
+
+/**
+ * @brief  Enable the CRC peripheral clock and configure it for CRC-32.
+ */
+void crc32_hw_init(void)
+{
+    __HAL_RCC_CRC_CLK_ENABLE();
+    CRC->POL = 0x04C11DB7U;
+    CRC->INIT = 0xFFFFFFFFU;
+    CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT;
+}
+
+/**
+ * @brief  CRC-32 of a buffer. Whole words are fed while the buffer is word
+ *         aligned, which keeps memory-mapped QSPI reads at 32 bits.
+ * @param  data: start of the buffer, any alignment
+ * @param  size: length in bytes
+ * @retval CRC-32 of the buffer
+ */
+uint32_t crc32_hw_compute(const uint8_t *data, uint32_t size)
+{
+    SET_BIT(CRC->CR, CRC_CR_RESET);
+
+    MODIFY_REG(CRC->CR, CRC_CR_REV_IN, CRC_CR_REV_IN_0);
+    while (size != 0 && ((uint32_t)data & 3U) != 0)
+    {
+        *(__IO uint8_t *)&CRC->DR = *data++;
+        size--;
+    }
+    MODIFY_REG(CRC->CR, CRC_CR_REV_IN, CRC_CR_REV_IN);
+    for (; size >= 4; size -= 4, data += 4)
+    {
+        CRC->DR = *(const uint32_t *)data;
+    }
+    MODIFY_REG(CRC->CR, CRC_CR_REV_IN, CRC_CR_REV_IN_0);
+    while (size-- != 0)
+    {
+        *(__IO uint8_t *)&CRC->DR = *data++;
+    }
+
+    return ~CRC->DR;
+}
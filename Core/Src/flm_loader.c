@@ -0,0 +1,201 @@
+/* CMSIS-Pack flash algorithm (FLM) for Keil MDK and pyOCD, see FlashOS.h.
+ *
+ * The host transfers FLM_PAGE_SIZE bytes per ProgramPage() call, which is
+ * split into 256 byte W25Q page programs here, so a 2 MB image costs a few
+ * hundred debugger round trips instead of 8192. The linker script
+ * (cmake/flm/flm_linker.ld) reserves two page buffers behind the algorithm
+ * for double buffering, see tools/flm_pyocd.py.
+ *
+ * Untested: the FLM has not yet been built with arm-none-eabi-gcc nor
+ * loaded by Keil or pyOCD, and the host build (tools/loader_host.py) does
+ * not cover this file. */
+
+#include "FlashOS.h"
+#include "main.h"
+#include "gpio.h"
+#include "quadspi.h"
+#include "w25qxx.h"
+#include "timebase.h"
+#include "telemetry.h"
+#include "manifest.h"
+#include "mass_erase.h"
+#include "verify_policy.h"
+
+#ifndef FLM_PAGE_SIZE
+#define FLM_PAGE_SIZE 0x2000
+#endif
+
+#if (FLM_PAGE_SIZE > PAGE_MAX) || (FLM_PAGE_SIZE % MEMORY_PAGE_SIZE)
+#error "FLM_PAGE_SIZE must be a multiple of MEMORY_PAGE_SIZE and at most PAGE_MAX"
+#endif
+
+struct FlashDevice const FlashDevice __attribute__((section("DevDscr"), used)) = {
+    FLASH_DRV_VERS,          // Driver Version, do not modify!
+    "W25Q16_STM32L4xx-QSPI", // Device Name
+    EXTSPI,                  // Device Type
+    MEMORY_BASE_ADDR,        // Device Start Address
+    MEMORY_USABLE_SIZE,      // Device Size in Bytes (2MB without the manifest)
+    FLM_PAGE_SIZE,           // Programming Page Size, split into 256 byte pages
+    0x00,                    // Reserved, must be 0
+    0xFF,                    // Initial Content of Erased Memory
+    10000,                   // Program Page Timeout 100 mSec
+    6000,                    // Erase Sector Timeout 6000 mSec
+
+    // Specify Size and Address of Sectors
+    {{MEMORY_SECTOR_SIZE, 0x00000000},
+     {SECTOR_END}}};
+
+/**
+ * @brief  Bring up clock, QUADSPI and flash, reusing them when still
+ *         configured from a previous call.
+ * @param  adr: device base address (unused)
+ * @param  clk: clock frequency (unused)
+ * @param  fnc: 1 erase, 2 program, 3 verify
+ * @retval 0 on success
+ */
+int Init(unsigned long adr, unsigned long clk, unsigned long fnc)
+{
+    uint8_t configured = SystemClock_IsConfigured();
+
+    (void)adr;
+    (void)clk;
+    if (configured)
+    {
+        /* .data is reloaded with every download, so SystemCoreClock reads
+         * the reset value again while the PLL is still running */
+        SystemCoreClockUpdate();
+    }
+    timebase_init();
+    telemetry_begin(TELEMETRY_INIT, 0, 0, fnc);
+    manifest_reset();
+    if (configured && (MX_QUADSPI_Attach() == HAL_OK) && (w25qxx_attach() == HAL_OK))
+    {
+        telemetry_count_init_attached();
+        verify_policy_attach();
+        telemetry_end(0, HAL_OK);
+        return 0;
+    }
+
+    hqspi.Instance = QUADSPI;
+    HAL_QSPI_DeInit(&hqspi);
+    HAL_Init();
+    SystemClock_Config();
+    MX_GPIO_Init();
+    MX_QUADSPI_Init();
+    w25qxx_init();
+    verify_policy_reset();
+    telemetry_end(0, HAL_OK);
+
+    return 0;
+}
+
+int UnInit(unsigned long fnc)
+{
+    (void)fnc;
+
+    return (manifest_commit() == HAL_OK) ? 0 : 1;
+}
+
+int EraseChip(void)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    telemetry_begin(TELEMETRY_MASS_ERASE, 0, 0, 0);
+    w25qxx_exit_memory_mapped_mode();
+    ret = manifest_mark(MEMORY_BASE_ADDR, MEMORY_USABLE_SIZE);
+    if (ret == HAL_OK)
+    {
+        ret = mass_erase();
+    }
+    telemetry_end((ret == HAL_OK) ? MEMORY_FLASH_SIZE : 0, ret);
+
+    return (ret == HAL_OK) ? 0 : 1;
+}
+
+int EraseSector(unsigned long adr)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    telemetry_begin(TELEMETRY_SECTOR_ERASE, adr, MEMORY_SECTOR_SIZE, 0);
+    w25qxx_exit_memory_mapped_mode();
+    ret = manifest_mark(adr, MEMORY_SECTOR_SIZE);
+    if (ret == HAL_OK)
+    {
+        ret = w25qxx_erase_sector(adr - MEMORY_BASE_ADDR);
+    }
+    telemetry_end((ret == HAL_OK) ? MEMORY_SECTOR_SIZE : 0, ret);
+
+    return (ret == HAL_OK) ? 0 : 1;
+}
+
+/**
+ * @brief  Program up to FLM_PAGE_SIZE bytes, any alignment.
+ * @retval 0 on success
+ */
+int ProgramPage(unsigned long adr, unsigned long sz, unsigned char *buf)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    telemetry_begin(TELEMETRY_WRITE, adr, sz, 0);
+    w25qxx_exit_memory_mapped_mode();
+    ret = manifest_mark(adr, sz);
+    if (ret == HAL_OK)
+    {
+        ret = w25qxx_write(buf, adr - MEMORY_BASE_ADDR, sz);
+    }
+    telemetry_end((ret == HAL_OK) ? sz : 0, ret);
+
+    return (ret == HAL_OK) ? 0 : 1;
+}
+
+/**
+ * @retval 0 when the range only holds pat, 1 otherwise
+ */
+int BlankCheck(unsigned long adr, unsigned long sz, unsigned char pat)
+{
+    unsigned long i = 0;
+
+    telemetry_begin(TELEMETRY_FL_CHECK_BLANK, adr, sz, pat);
+    w25qxx_enter_memory_mapped_mode();
+    while (i < sz && *(unsigned char *)(adr + i) == pat)
+    {
+        i++;
+    }
+    telemetry_end(i, (i == sz) ? HAL_OK : TELEMETRY_ERR_BLANK);
+
+    return (i == sz) ? 0 : 1;
+}
+
+/**
+ * @retval adr + sz on success, the first mismatching address otherwise
+ */
+unsigned long Verify(unsigned long adr, unsigned long sz, unsigned char *buf)
+{
+    unsigned long i = 0;
+
+    telemetry_begin(TELEMETRY_FL_VERIFY, adr, sz, 0);
+    w25qxx_enter_memory_mapped_mode();
+    if (verify_policy_get() != VERIFY_POLICY_FULL)
+    {
+        unsigned long failed = verify_policy_check(adr, buf, sz);
+
+        telemetry_end((failed != 0) ? 0 : sz, (failed != 0) ? TELEMETRY_ERR_VERIFY : HAL_OK);
+        if (failed != 0)
+        {
+            return failed;
+        }
+        manifest_verified(adr, sz);
+        return adr + sz;
+    }
+    while (i < sz && *(unsigned char *)(adr + i) == buf[i])
+    {
+        i++;
+    }
+    if (i == sz)
+    {
+        manifest_verified(adr, sz);
+    }
+    telemetry_end(i, (i == sz) ? HAL_OK : TELEMETRY_ERR_VERIFY);
+
+    return adr + i;
+}
@@ -0,0 +1,104 @@
+#include "lz_decode.h"
+
+_Static_assert((LZ_WINDOW & (LZ_WINDOW - 1)) == 0 && LZ_WINDOW % LZ_FLUSH == 0, "bad LZ window");
+
+static uint8_t window[LZ_WINDOW];
+
+static uint32_t lz_get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/**
+ * @brief  Decoded size announced by a stream header.
+ * @retval size in bytes, LZ_ERR_FORMAT if the header is invalid
+ */
+int32_t lz_decoded_size(const uint8_t *src, uint32_t size)
+{
+    if (size < LZ_HEADER_SIZE || lz_get32(src) != LZ_MAGIC || lz_get32(src + 4) > INT32_MAX)
+    {
+        return LZ_ERR_FORMAT;
+    }
+
+    return (int32_t)lz_get32(src + 4);
+}
+
+/**
+ * @brief  Decode a stream, handing the output to 'sink' chunk by chunk.
+ * @param  src: stream including the header
+ * @param  size: stream length in bytes
+ * @param  base: destination address of the first output byte, only used
+ *               to align the chunks to LZ_FLUSH
+ * @retval decoded size, LZ_ERR_FORMAT or LZ_ERR_SINK
+ */
+int32_t lz_decode(const uint8_t *src, uint32_t size, uint32_t base, lz_sink_t sink, void *ctx)
+{
+    const uint8_t *end = src + size;
+    int32_t total = lz_decoded_size(src, size);
+    uint32_t out = 0;
+    uint32_t flushed = 0;
+
+    if (total < 0)
+    {
+        return total;
+    }
+
+    src += LZ_HEADER_SIZE;
+    while (out < (uint32_t)total)
+    {
+        uint32_t token;
+        uint32_t count;
+        uint32_t distance = 0;
+
+        if (src >= end)
+        {
+            return LZ_ERR_FORMAT;
+        }
+        token = *src++;
+        if (token < LZ_MAX_LITERALS)
+        {
+            count = token + 1;
+            if ((uint32_t)(end - src) < count)
+            {
+                return LZ_ERR_FORMAT;
+            }
+        }
+        else
+        {
+            count = (token & 0x7F) + LZ_MIN_MATCH;
+            if (end - src < 2)
+            {
+                return LZ_ERR_FORMAT;
+            }
+            distance = ((uint32_t)src[0] | (uint32_t)src[1] << 8) + 1;
+            src += 2;
+            if (distance > out || distance > LZ_WINDOW)
+            {
+                return LZ_ERR_FORMAT;
+            }
+        }
+        if (count > (uint32_t)total - out)
+        {
+            return LZ_ERR_FORMAT;
+        }
+
+        while (count--)
+        {
+            uint32_t pos = (base + out) % LZ_WINDOW;
+
+            /* Matches may overlap their own output, copy byte by byte */
+            window[pos] = (distance != 0) ? window[(pos - distance) % LZ_WINDOW] : *src++;
+            out++;
+            if ((base + out) % LZ_FLUSH == 0 || out == (uint32_t)total)
+            {
+                if (sink(ctx, flushed, &window[(base + flushed) % LZ_WINDOW], out - flushed) != 0)
+                {
+                    return LZ_ERR_SINK;
+                }
+                flushed = out;
+            }
+        }
+    }
+
+    return total;
+}
@@ -23,6 +23,7 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "w25qxx.h"
+#include "timebase.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -60,24 +61,23 @@ void SystemClock_Config(void);
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
+/* SysTick interrupts are not available to the loader, the HAL timebase
+   is served from the DWT cycle counter instead */
 HAL_StatusTypeDef HAL_InitTick(uint32_t TickPriority)
-{ 
+{
   (void)TickPriority;
+  timebase_init();
   return HAL_OK;
 }
- 
+
 uint32_t HAL_GetTick(void)
 {
-  return 1;
+  return timebase_get_ms();
 }
 
 void HAL_Delay(uint32_t Delay)
 {
-  (void)Delay;
-  for (volatile int i=0; i<0x100000; i++)
-  {
-    __asm__ __volatile__("nop"); 
-  }
+  timebase_delay_ms(Delay);
 }
 
 /* USER CODE END 0 */
@@ -185,7 +185,41 @@ void SystemClock_Config(void)
 }
 
 /* USER CODE BEGIN 4 */
+/**
+  * @brief  Check whether SystemClock_Config() has already been applied
+  * @retval 1 when SYSCLK runs from the PLL with the expected settings, 0 otherwise
+  */
+uint8_t SystemClock_IsConfigured(void)
+{
+  uint32_t pllcfgr = RCC->PLLCFGR;
+
+  if (!__HAL_RCC_PWR_IS_CLK_ENABLED() || (HAL_PWREx_GetVoltageRange() != PWR_REGULATOR_VOLTAGE_SCALE1))
+  {
+    return 0;
+  }
 
+  if (READ_BIT(RCC->CR, RCC_CR_PLLRDY) == 0U || __HAL_RCC_GET_SYSCLK_SOURCE() != RCC_SYSCLKSOURCE_STATUS_PLLCLK)
+  {
+    return 0;
+  }
+
+  if ((pllcfgr & RCC_PLLCFGR_PLLSRC) != RCC_PLLSOURCE_HSI ||
+      ((pllcfgr & RCC_PLLCFGR_PLLM) >> RCC_PLLCFGR_PLLM_Pos) != (1U - 1U) ||
+      ((pllcfgr & RCC_PLLCFGR_PLLN) >> RCC_PLLCFGR_PLLN_Pos) != 10U ||
+      ((pllcfgr & RCC_PLLCFGR_PLLR) >> RCC_PLLCFGR_PLLR_Pos) != ((RCC_PLLR_DIV2 >> 1U) - 1U) ||
+      (pllcfgr & RCC_PLLCFGR_PLLREN) == 0U)
+  {
+    return 0;
+  }
+
+  if (READ_BIT(RCC->CFGR, RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2) != 0U ||
+      __HAL_FLASH_GET_LATENCY() != FLASH_LATENCY_4)
+  {
+    return 0;
+  }
+
+  return 1;
+}
 /* USER CODE END 4 */
 
 /**
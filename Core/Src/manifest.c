@@ -0,0 +1,221 @@
+#include <stddef.h>
+#include <string.h>
+#include "manifest.h"
+#include "crc32_hw.h"
+
+#if LOADER_MANIFEST
+
+/* The loader image is not reloaded between entry point calls but has no
+ * startup code either, so the session state is validated by a magic like
+ * the telemetry block. Sectors changed by Write / SectorErase / MassErase
+ * are tracked in a bitmap; the manifest is marked stale (a single word
+ * program, no erase) before the first change and rewritten once the
+ * changed range has been verified. */
+
+#define MANIFEST_STATE_MAGIC 0x5353464D
+#define MANIFEST_OFFSET (MEMORY_MANIFEST_ADDR - MEMORY_BASE_ADDR)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t dirty[(MANIFEST_SECTORS + 31) / 32];
+    uint32_t dirty_end;    /*!< End of the highest changed sector, 0 if clean */
+    uint32_t generation;   /*!< Generation of the manifest found on flash */
+    uint8_t base_valid;    /*!< Flash table is current for the clean sectors */
+} manifest_state_t;
+
+_Static_assert(sizeof(manifest_t) <= MEMORY_MANIFEST_SIZE, "manifest does not fit its sector");
+
+static manifest_state_t state;
+static manifest_t manifest;
+
+static HAL_StatusTypeDef manifest_open(void)
+{
+    manifest_header_t header;
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t stale = 0;
+
+    memset(&state, 0, sizeof(state));
+    state.magic = MANIFEST_STATE_MAGIC;
+
+    ret = w25qxx_read((uint8_t *)&header, MANIFEST_OFFSET, sizeof(header));
+    if (ret != HAL_OK)
+    {
+        return ret;
+    }
+    if (header.magic != MANIFEST_MAGIC || header.version != MANIFEST_VERSION)
+    {
+        return HAL_OK;
+    }
+
+    state.generation = header.generation;
+    state.base_valid = (header.sector_size == MEMORY_SECTOR_SIZE) && (header.sector_count == MANIFEST_SECTORS) &&
+                       (header.stale == 0xFFFFFFFFU);
+    if (state.base_valid)
+    {
+        /* Invalidate before any data sector changes, a session that never
+         * reaches manifest_commit() must not leave a current-looking table */
+        ret = w25qxx_write((uint8_t *)&stale, MANIFEST_OFFSET + offsetof(manifest_header_t, stale), sizeof(stale));
+    }
+
+    return ret;
+}
+
+/**
+ * @brief  Forget the session state. Called by every Init(): a state left
+ *         by an earlier session, or by a download that did not reach
+ *         manifest_commit(), no longer describes the flash.
+ * @retval None
+ */
+void manifest_reset(void)
+{
+    state.magic = 0;
+}
+
+/**
+ * @brief  Record that a range of the data area is about to change.
+ * @param  address: start address in the memory-mapped window
+ * @param  size: length in bytes, MEMORY_USABLE_SIZE for a mass erase
+ * @retval HAL status of the manifest invalidation
+ */
+HAL_StatusTypeDef manifest_mark(uint32_t address, uint32_t size)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t first = (address - MEMORY_BASE_ADDR) / MEMORY_SECTOR_SIZE;
+    uint32_t last = (address - MEMORY_BASE_ADDR + size - 1) / MEMORY_SECTOR_SIZE;
+
+    if (size == 0)
+    {
+        return HAL_OK;
+    }
+    if (state.magic != MANIFEST_STATE_MAGIC)
+    {
+        ret = manifest_open();
+    }
+
+    for (uint32_t i = first; i <= last && i < MANIFEST_SECTORS; i++)
+    {
+        state.dirty[i / 32] |= 1U << (i % 32);
+    }
+    if (last >= MANIFEST_SECTORS)
+    {
+        last = MANIFEST_SECTORS - 1;
+    }
+    if (MEMORY_BASE_ADDR + (last + 1) * MEMORY_SECTOR_SIZE > state.dirty_end)
+    {
+        state.dirty_end = MEMORY_BASE_ADDR + (last + 1) * MEMORY_SECTOR_SIZE;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief  Report a successfully verified range. The manifest is rewritten
+ *         once verification has reached the end of the changed range.
+ * @param  address: start address in the memory-mapped window
+ * @param  size: length in bytes
+ * @retval HAL status of the manifest update
+ */
+HAL_StatusTypeDef manifest_verified(uint32_t address, uint32_t size)
+{
+    const manifest_header_t *header = (const manifest_header_t *)MEMORY_MANIFEST_ADDR;
+
+    if (state.magic != MANIFEST_STATE_MAGIC)
+    {
+        /* STM32CubeProgrammer calls Init() between the writes and Verify():
+         * the changed range is lost, but a missing or stale table tells
+         * that the flash changed, so rehash all of it */
+        if (w25qxx_enter_memory_mapped_mode() != HAL_OK)
+        {
+            return HAL_ERROR;
+        }
+        if (header->magic == MANIFEST_MAGIC && header->version == MANIFEST_VERSION && header->stale == 0xFFFFFFFFU)
+        {
+            return HAL_OK;
+        }
+        memset(&state, 0, sizeof(state));
+        state.magic = MANIFEST_STATE_MAGIC;
+        state.generation = (header->magic == MANIFEST_MAGIC) ? header->generation : 0;
+        state.dirty_end = MEMORY_BASE_ADDR + MEMORY_USABLE_SIZE;
+
+        return manifest_commit();
+    }
+    if (state.dirty_end == 0)
+    {
+        return HAL_OK;
+    }
+    if (address + size <= state.dirty_end - MEMORY_SECTOR_SIZE)
+    {
+        return HAL_OK;
+    }
+
+    return manifest_commit();
+}
+
+/**
+ * @brief  Rewrite the manifest for the changed sectors. Clean sectors keep
+ *         their entry when the table on flash was current, otherwise every
+ *         sector is hashed.
+ * @retval HAL status
+ */
+HAL_StatusTypeDef manifest_commit(void)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    if (state.magic != MANIFEST_STATE_MAGIC || state.dirty_end == 0)
+    {
+        return HAL_OK;
+    }
+
+    ret = w25qxx_enter_memory_mapped_mode();
+    if (ret != HAL_OK)
+    {
+        return ret;
+    }
+
+    crc32_hw_init();
+    for (uint32_t i = 0; i < MANIFEST_SECTORS; i++)
+    {
+        if (state.base_valid && !(state.dirty[i / 32] & (1U << (i % 32))))
+        {
+            manifest.crc[i] = ((const manifest_t *)MEMORY_MANIFEST_ADDR)->crc[i];
+        }
+        else
+        {
+            manifest.crc[i] = crc32_hw_compute((const uint8_t *)(MEMORY_BASE_ADDR + i * MEMORY_SECTOR_SIZE), MEMORY_SECTOR_SIZE);
+        }
+    }
+    manifest.header.magic = MANIFEST_MAGIC;
+    manifest.header.version = MANIFEST_VERSION;
+    manifest.header.generation = state.generation + 1;
+    manifest.header.sector_size = MEMORY_SECTOR_SIZE;
+    manifest.header.sector_count = MANIFEST_SECTORS;
+    manifest.header.table_crc = crc32_hw_compute((const uint8_t *)manifest.crc, sizeof(manifest.crc));
+    manifest.header.stale = 0xFFFFFFFFU;
+    manifest.header.reserved = 0xFFFFFFFFU;
+    /* The old table is gone once the sector is erased, a retry rehashes */
+    state.base_valid = 0;
+
+    /* Table first, header last: an interrupted update leaves no magic */
+    w25qxx_exit_memory_mapped_mode();
+    ret = w25qxx_erase_sector(MANIFEST_OFFSET);
+    if (ret == HAL_OK)
+    {
+        ret = w25qxx_write((uint8_t *)manifest.crc, MANIFEST_OFFSET + sizeof(manifest_header_t), sizeof(manifest.crc));
+    }
+    if (ret == HAL_OK)
+    {
+        ret = w25qxx_write((uint8_t *)&manifest.header, MANIFEST_OFFSET, sizeof(manifest_header_t));
+    }
+    if (ret != HAL_OK)
+    {
+        return ret;
+    }
+
+    /* The next change starts over from the table just written */
+    state.magic = 0;
+
+    return HAL_OK;
+}
+
+#endif
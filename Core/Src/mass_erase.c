@@ -0,0 +1,66 @@
+#include "mass_erase.h"
+#include "telemetry.h"
+
+#if LOADER_SMART_MASS_ERASE
+
+#define MASS_ERASE_BLOCKS (MEMORY_FLASH_SIZE / MEMORY_BLOCK_SIZE)
+
+static uint32_t mass_erase_block_used(uint32_t block)
+{
+    const uint32_t *word = (const uint32_t *)(MEMORY_BASE_ADDR + block * MEMORY_BLOCK_SIZE);
+
+    for (uint32_t i = 0; i < MEMORY_BLOCK_SIZE / 4; i++)
+    {
+        if (word[i] != 0xFFFFFFFFU)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  Erase the whole chip, skipping blank 64K blocks when that is
+ *         cheaper than a chip erase. Leaves memory-mapped mode.
+ * @retval HAL status
+ */
+HAL_StatusTypeDef mass_erase(void)
+{
+    uint32_t used[(MASS_ERASE_BLOCKS + 31) / 32] = {0};
+    uint32_t count = 0;
+    HAL_StatusTypeDef ret = w25qxx_enter_memory_mapped_mode();
+
+    for (uint32_t block = 0; ret == HAL_OK && block < MASS_ERASE_BLOCKS; block++)
+    {
+        if (mass_erase_block_used(block))
+        {
+            used[block / 32] |= 1U << (block % 32);
+            count++;
+        }
+    }
+    w25qxx_exit_memory_mapped_mode();
+    if (ret != HAL_OK)
+    {
+        return ret;
+    }
+
+    if (count * W25X_tBE_TYP_US >= W25X_tCE_TYP_US ||
+        count * W25X_tBE_MAX_MS >= W25X_tCE_MAX_MS)
+    {
+        return w25qxx_erase_chip();
+    }
+
+    for (uint32_t block = 0; ret == HAL_OK && block < MASS_ERASE_BLOCKS; block++)
+    {
+        if (used[block / 32] & (1U << (block % 32)))
+        {
+            ret = w25qxx_erase_block(block * MEMORY_BLOCK_SIZE);
+        }
+    }
+    telemetry_count_skipped_sectors((MASS_ERASE_BLOCKS - count) * (MEMORY_BLOCK_SIZE / MEMORY_SECTOR_SIZE));
+
+    return ret;
+}
+
+#endif
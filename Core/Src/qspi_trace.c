@@ -0,0 +1,58 @@
+#include <string.h>
+#include "qspi_trace.h"
+
+#if LOADER_TRACE
+
+/* Default visibility, see loader_telemetry */
+qspi_trace_t qspi_trace __attribute__((section(".trace"), used, visibility("default")));
+
+/* Single producer, so the ring only needs ordered stores: a record is
+ * filled in first and published by advancing head. The end time stamp of
+ * the newest record is completed afterwards. */
+void qspi_trace_begin(const QSPI_CommandTypeDef *cmd, qspi_trace_kind_t kind)
+{
+    qspi_trace_record_t *rec;
+
+    if (qspi_trace.magic != QSPI_TRACE_MAGIC || qspi_trace.version != QSPI_TRACE_VERSION)
+    {
+        memset(&qspi_trace, 0, sizeof(qspi_trace));
+        qspi_trace.magic = QSPI_TRACE_MAGIC;
+        qspi_trace.version = QSPI_TRACE_VERSION;
+        qspi_trace.depth = QSPI_TRACE_DEPTH;
+    }
+
+    rec = &qspi_trace.records[qspi_trace.head & (QSPI_TRACE_DEPTH - 1)];
+    rec->start = DWT->CYCCNT;
+    rec->end = rec->start;
+    rec->kind = kind;
+    if (cmd != NULL)
+    {
+        rec->opcode = cmd->Instruction;
+        rec->address = cmd->Address;
+        rec->length = cmd->NbData;
+        rec->dummy = cmd->DummyCycles;
+        rec->lines = ((cmd->InstructionMode >> QUADSPI_CCR_IMODE_Pos) & 0x3) |
+                     (((cmd->AddressMode >> QUADSPI_CCR_ADMODE_Pos) & 0x3) << 2) |
+                     (((cmd->DataMode >> QUADSPI_CCR_DMODE_Pos) & 0x3) << 4) |
+                     (((cmd->DdrMode >> QUADSPI_CCR_DDRM_Pos) & 0x1) << 6);
+    }
+    else
+    {
+        rec->opcode = 0;
+        rec->address = 0;
+        rec->length = 0;
+        rec->dummy = 0;
+        rec->lines = 0;
+    }
+
+    __DMB();
+    qspi_trace.head++;
+    qspi_trace.core_clock_hz = SystemCoreClock;
+}
+
+void qspi_trace_end(void)
+{
+    qspi_trace.records[(qspi_trace.head - 1) & (QSPI_TRACE_DEPTH - 1)].end = DWT->CYCCNT;
+}
+
+#endif
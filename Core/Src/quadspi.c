@@ -135,5 +135,64 @@ void HAL_QSPI_MspDeInit(QSPI_HandleTypeDef* qspiHandle)
 }
 
 /* USER CODE BEGIN 1 */
+/**
+  * @brief  Re-attach the handle to a QUADSPI left configured by MX_QUADSPI_Init()
+  * @note   Nothing is written to the peripheral unless it is in memory-mapped
+  *         mode, in which case the transfer is aborted.
+  * @retval HAL_OK when the clock, pins and registers match, HAL_ERROR otherwise
+  */
+HAL_StatusTypeDef MX_QUADSPI_Attach(void)
+{
+  uint32_t cr = QUADSPI->CR;
+  uint32_t dcr = QUADSPI->DCR;
+
+  if (!__HAL_RCC_QSPI_IS_CLK_ENABLED() || (cr & QUADSPI_CR_EN) == 0U)
+  {
+    return HAL_ERROR;
+  }
+
+  /* PB10/PB11 (CLK/NCS) must still be routed to AF10 */
+  if (((GPIOB->MODER >> (10U * 2U)) & 0xFU) != ((GPIO_MODE_AF_PP & 0x3U) * 0x5U) ||
+      ((GPIOB->AFR[1] >> ((10U - 8U) * 4U)) & 0xFFU) != (GPIO_AF10_QUADSPI * 0x11U))
+  {
+    return HAL_ERROR;
+  }
+
+  hqspi.Instance = QUADSPI;
+  hqspi.Init.ClockPrescaler = 1;
+  hqspi.Init.FifoThreshold = 4;
+  hqspi.Init.SampleShifting = QSPI_SAMPLE_SHIFTING_HALFCYCLE;
+  hqspi.Init.FlashSize = 0x14;
+  hqspi.Init.ChipSelectHighTime = QSPI_CS_HIGH_TIME_4_CYCLE;
+  hqspi.Init.ClockMode = QSPI_CLOCK_MODE_0;
+  hqspi.Init.FlashID = QSPI_FLASH_ID_1;
+  hqspi.Init.DualFlash = QSPI_DUALFLASH_DISABLE;
 
+  if ((cr & (QUADSPI_CR_PRESCALER | QUADSPI_CR_SSHIFT | QUADSPI_CR_FTHRES)) !=
+      ((hqspi.Init.ClockPrescaler << QUADSPI_CR_PRESCALER_Pos) | hqspi.Init.SampleShifting |
+       ((hqspi.Init.FifoThreshold - 1U) << QUADSPI_CR_FTHRES_Pos)))
+  {
+    return HAL_ERROR;
+  }
+
+  /* CSHT is toggled between commands by the driver, so only FSIZE and CKMODE are compared */
+  if ((dcr & (QUADSPI_DCR_FSIZE | QUADSPI_DCR_CKMODE)) !=
+      ((hqspi.Init.FlashSize << QUADSPI_DCR_FSIZE_Pos) | hqspi.Init.ClockMode))
+  {
+    return HAL_ERROR;
+  }
+
+  hqspi.Lock = HAL_UNLOCKED;
+  hqspi.ErrorCode = HAL_QSPI_ERROR_NONE;
+  hqspi.Timeout = HAL_QSPI_TIMEOUT_DEFAULT_VALUE;
+  hqspi.State = HAL_QSPI_STATE_READY;
+
+  if ((QUADSPI->SR & QUADSPI_SR_BUSY) != 0U)
+  {
+    /* A previous Read()/Verify() left the peripheral in memory-mapped mode */
+    return HAL_QSPI_Abort(&hqspi);
+  }
+
+  return HAL_OK;
+}
 /* USER CODE END 1 */
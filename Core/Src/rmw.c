@@ -0,0 +1,125 @@
+#include <string.h>
+#include "rmw.h"
+#include "telemetry.h"
+
+#if LOADER_WRITE_RMW
+
+static uint8_t sector[MEMORY_SECTOR_SIZE];
+
+static uint32_t rmw_blank(const uint8_t *data, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        if (data[i] != 0xFF)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Merge, erase and reprogram the non-blank pages of the sector at base */
+static HAL_StatusTypeDef rmw_rewrite(uint32_t base, uint32_t start, uint8_t *buffer, uint32_t size)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t end = start + size;
+    uint32_t skipped = 0;
+
+    if (start > 0)
+    {
+        ret = w25qxx_read(sector, base, start);
+    }
+    if (ret == HAL_OK && end < MEMORY_SECTOR_SIZE)
+    {
+        ret = w25qxx_read(&sector[end], base + end, MEMORY_SECTOR_SIZE - end);
+    }
+    if (ret == HAL_OK)
+    {
+        memcpy(&sector[start], buffer, size);
+        ret = w25qxx_erase_sector(base);
+    }
+    for (uint32_t page = 0; ret == HAL_OK && page < MEMORY_SECTOR_SIZE; page += MEMORY_PAGE_SIZE)
+    {
+        if (rmw_blank(&sector[page], MEMORY_PAGE_SIZE))
+        {
+            skipped++;
+            continue;
+        }
+        ret = w25qxx_program_page(&sector[page], base + page, MEMORY_PAGE_SIZE);
+    }
+    telemetry_count_skipped_pages(skipped);
+
+    return ret;
+}
+
+/* Program the part of one sector in [offset, offset + size) */
+static HAL_StatusTypeDef rmw_sector(uint8_t *buffer, uint32_t offset, uint32_t size)
+{
+    uint32_t base = offset - offset % MEMORY_SECTOR_SIZE;
+    uint32_t start = offset - base;
+    uint32_t done = 0;
+    uint32_t skipped = 0;
+    uint8_t set = 0;
+    HAL_StatusTypeDef ret = w25qxx_read(&sector[start], offset, size);
+
+    if (ret != HAL_OK)
+    {
+        return ret;
+    }
+    for (uint32_t i = 0; i < size; i++)
+    {
+        set |= (uint8_t)(~sector[start + i] & buffer[i]);
+    }
+    if (set)
+    {
+        return rmw_rewrite(base, start, buffer, size);
+    }
+
+    /* Only clears bits: program the pages that change, in place */
+    while (ret == HAL_OK && done < size)
+    {
+        uint32_t chunk = MEMORY_PAGE_SIZE - (offset + done) % MEMORY_PAGE_SIZE;
+
+        chunk = (chunk < size - done) ? chunk : size - done;
+        if (memcmp(&sector[start + done], buffer + done, chunk) == 0)
+        {
+            skipped++;
+        }
+        else
+        {
+            ret = w25qxx_program_page(buffer + done, offset + done, chunk);
+        }
+        done += chunk;
+    }
+    telemetry_count_skipped_pages(skipped);
+
+    return ret;
+}
+
+/**
+ * @brief  w25qxx_write() for a target that need not be erased.
+ * @param  buffer: data to program
+ * @param  offset: flash offset
+ * @param  size: number of bytes
+ * @retval HAL status
+ */
+HAL_StatusTypeDef rmw_write(uint8_t *buffer, uint32_t offset, uint32_t size)
+{
+    HAL_StatusTypeDef ret = write_cache_flush();
+
+    while (ret == HAL_OK && size)
+    {
+        uint32_t chunk = MEMORY_SECTOR_SIZE - offset % MEMORY_SECTOR_SIZE;
+
+        chunk = (chunk < size) ? chunk : size;
+        ret = rmw_sector(buffer, offset, chunk);
+        buffer += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+
+    return ret;
+}
+
+#endif
@@ -0,0 +1,286 @@
+#include <string.h>
+#include "sector_map.h"
+#include "telemetry.h"
+
+#if LOADER_LAZY_ERASE
+
+/* Validated by a magic like the manifest state, see manifest.c */
+
+#define SECTOR_MAP_MAGIC 0x50414D53 /* "SMAP" */
+#define SECTOR_MAP_SECTORS (MEMORY_FLASH_SIZE / MEMORY_SECTOR_SIZE)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t erased[SECTOR_MAP_SECTORS / 32];     /*!< Blank, not written since */
+    uint32_t programmed[SECTOR_MAP_SECTORS / 32]; /*!< Erased, then written */
+} sector_map_t;
+
+static sector_map_t map;
+static uint8_t sector[MEMORY_SECTOR_SIZE];
+
+#define SECTOR_BIT(bits, i) ((bits)[(i) / 32] & (1U << ((i) % 32)))
+#define SECTOR_SET(bits, i) ((bits)[(i) / 32] |= (1U << ((i) % 32)))
+#define SECTOR_CLEAR(bits, i) ((bits)[(i) / 32] &= ~(1U << ((i) % 32)))
+
+static void sector_map_open(void)
+{
+    if (map.magic != SECTOR_MAP_MAGIC)
+    {
+        memset(&map, 0, sizeof(map));
+        map.magic = SECTOR_MAP_MAGIC;
+    }
+}
+
+/* Sector index range [*first, *last] of a memory-mapped range, 0 if empty */
+static uint32_t sector_map_range(uint32_t address, uint32_t size, uint32_t *first, uint32_t *last)
+{
+    if (size == 0 || address < MEMORY_BASE_ADDR || address - MEMORY_BASE_ADDR >= MEMORY_FLASH_SIZE)
+    {
+        return 0;
+    }
+    *first = (address - MEMORY_BASE_ADDR) / MEMORY_SECTOR_SIZE;
+    *last = (address - MEMORY_BASE_ADDR + size - 1) / MEMORY_SECTOR_SIZE;
+    if (*last >= SECTOR_MAP_SECTORS)
+    {
+        *last = SECTOR_MAP_SECTORS - 1;
+    }
+
+    return 1;
+}
+
+/* Blank check of [offset, offset + size) through the memory-mapped window */
+static uint32_t sector_map_is_blank(uint32_t offset, uint32_t size)
+{
+    const uint8_t *byte = (const uint8_t *)(MEMORY_BASE_ADDR + offset);
+    uint32_t i = 0;
+
+    w25qxx_enter_memory_mapped_mode();
+    for (; i < size && ((offset + i) & 3); i++)
+    {
+        if (byte[i] != 0xFF)
+        {
+            return 0;
+        }
+    }
+    for (; i + 4 <= size; i += 4)
+    {
+        if (*(const uint32_t *)&byte[i] != 0xFFFFFFFFU)
+        {
+            return 0;
+        }
+    }
+    for (; i < size; i++)
+    {
+        if (byte[i] != 0xFF)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Erase the sector at base keeping everything outside [start, end): the
+ * data of an earlier session the host does not send again */
+static HAL_StatusTypeDef sector_map_merge(uint32_t base, uint32_t start, uint32_t end)
+{
+    HAL_StatusTypeDef ret = w25qxx_read(sector, base, MEMORY_SECTOR_SIZE);
+
+    if (ret == HAL_OK)
+    {
+        memset(&sector[start], 0xFF, end - start);
+        ret = w25qxx_erase_sector(base);
+    }
+    for (uint32_t page = 0; ret == HAL_OK && page < MEMORY_SECTOR_SIZE; page += MEMORY_PAGE_SIZE)
+    {
+        for (uint32_t i = 0; i < MEMORY_PAGE_SIZE; i++)
+        {
+            if (sector[page + i] != 0xFF)
+            {
+                ret = w25qxx_program_page(&sector[page], base + page, MEMORY_PAGE_SIZE);
+                break;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief  Forget all sector states.
+ * @retval None
+ */
+void sector_map_reset(void)
+{
+    map.magic = 0;
+}
+
+/**
+ * @brief  Make sure the part of every sector about to be written is
+ *         erased. A sector not yet known is blank checked: a blank one is
+ *         kept, one the range covers is erased, and one with data where
+ *         the range goes is erased with the data outside the range
+ *         merged back, since it may be from an earlier session. Only
+ *         whole blank or erased sectors become known, a merged one is
+ *         checked again by the next Write(). Leaves memory-mapped mode.
+ * @param  address: start address in the memory-mapped window
+ * @param  size: length in bytes
+ * @retval HAL status of the erases
+ */
+HAL_StatusTypeDef sector_map_prepare(uint32_t address, uint32_t size)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t first;
+    uint32_t last;
+    uint32_t skipped = 0;
+    uint32_t checked = 0;
+
+    if (!sector_map_range(address, size, &first, &last))
+    {
+        return HAL_OK;
+    }
+    sector_map_open();
+    for (uint32_t i = first; ret == HAL_OK && i <= last; i++)
+    {
+        uint32_t base = i * MEMORY_SECTOR_SIZE;
+        uint32_t start = (address - MEMORY_BASE_ADDR > base) ? address - MEMORY_BASE_ADDR - base : 0;
+        uint32_t end = address - MEMORY_BASE_ADDR + size - base;
+
+        if (SECTOR_BIT(map.programmed, i))
+        {
+            continue;
+        }
+        end = (end < MEMORY_SECTOR_SIZE) ? end : MEMORY_SECTOR_SIZE;
+        if (!SECTOR_BIT(map.erased, i))
+        {
+            checked = 1;
+            if (sector_map_is_blank(base, MEMORY_SECTOR_SIZE))
+            {
+                skipped++;
+            }
+            else if (start == 0 && end == MEMORY_SECTOR_SIZE)
+            {
+                w25qxx_exit_memory_mapped_mode();
+                ret = w25qxx_erase_sector(base);
+            }
+            else
+            {
+                if (!sector_map_is_blank(base + start, end - start))
+                {
+                    w25qxx_exit_memory_mapped_mode();
+                    ret = sector_map_merge(base, start, end);
+                }
+                continue;
+            }
+        }
+        if (ret == HAL_OK)
+        {
+            SECTOR_CLEAR(map.erased, i);
+            SECTOR_SET(map.programmed, i);
+        }
+    }
+    if (checked)
+    {
+        w25qxx_exit_memory_mapped_mode();
+    }
+    telemetry_count_skipped_sectors(skipped);
+
+    return ret;
+}
+
+/**
+ * @brief  w25qxx_erase_sector() that skips sectors known to be erased.
+ * @param  offset: flash offset of the sector
+ * @retval HAL status
+ */
+HAL_StatusTypeDef sector_map_erase(uint32_t offset)
+{
+    uint32_t i = offset / MEMORY_SECTOR_SIZE;
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    if (i >= SECTOR_MAP_SECTORS)
+    {
+        return w25qxx_erase_sector(offset);
+    }
+    sector_map_open();
+    if (SECTOR_BIT(map.erased, i))
+    {
+        telemetry_count_skipped_sectors(1);
+        return HAL_OK;
+    }
+
+    SECTOR_CLEAR(map.programmed, i);
+    ret = w25qxx_erase_sector(offset);
+    if (ret == HAL_OK)
+    {
+        SECTOR_SET(map.erased, i);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief  Record a successful chip erase.
+ * @retval None
+ */
+void sector_map_erased_all(void)
+{
+    sector_map_open();
+    memset(map.erased, 0xFF, sizeof(map.erased));
+    memset(map.programmed, 0, sizeof(map.programmed));
+}
+
+/**
+ * @brief  Record a range written without sector_map_prepare() (Fill,
+ *         WriteCompressed, streaming), so later erases are not skipped
+ *         and Write() does not erase it on first touch.
+ * @param  address: start address in the memory-mapped window
+ * @param  size: length in bytes
+ * @retval None
+ */
+void sector_map_programmed(uint32_t address, uint32_t size)
+{
+    uint32_t first;
+    uint32_t last;
+
+    if (!sector_map_range(address, size, &first, &last))
+    {
+        return;
+    }
+    sector_map_open();
+    for (uint32_t i = first; i <= last; i++)
+    {
+        SECTOR_CLEAR(map.erased, i);
+        SECTOR_SET(map.programmed, i);
+    }
+}
+
+/**
+ * @brief  Check whether a range lies in sectors known to be erased.
+ * @param  address: start address in the memory-mapped window
+ * @param  size: length in bytes
+ * @retval 1 if known blank, 0 if it has to be read
+ */
+uint32_t sector_map_blank(uint32_t address, uint32_t size)
+{
+    uint32_t first;
+    uint32_t last;
+
+    if (map.magic != SECTOR_MAP_MAGIC || !sector_map_range(address, size, &first, &last) ||
+        address + size > MEMORY_BASE_ADDR + MEMORY_FLASH_SIZE)
+    {
+        return 0;
+    }
+    for (uint32_t i = first; i <= last; i++)
+    {
+        if (!SECTOR_BIT(map.erased, i))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+#endif
@@ -12,6 +12,14 @@
 #include "w25qxx.h"
 #include "segger_loader.h"
 #include "stldr_loader.h"
+#include "telemetry.h"
+#include "timebase.h"
+#include "manifest.h"
+#include "stream.h"
+#include "write_cache.h"
+#include "sector_map.h"
+#include "write_verify.h"
+#include "verify_policy.h"
 
 #define PrgCode __attribute__((section("PrgCode"), __used__))
 #define DevDescr __attribute__((section("DevDscr")))
@@ -21,8 +29,8 @@ struct FlashDevice const FlashDevice DevDescr = {
     "W25Q16_STM32L4xx-QSPI", // Device Name
     EXTSPI,                  // Device Type
     0x90000000,              // Device Start Address
-    MEMORY_FLASH_SIZE,       // Device Size in Bytes (2MB)
-    MEMORY_PAGE_SIZE,        // Programming Page Size 4096 Bytes
+    MEMORY_USABLE_SIZE,      // Device Size in Bytes (2MB without the manifest)
+    MEMORY_TRANSFER_PAGE_SIZE, // Programming Page Size, split into MEMORY_PAGE_SIZE programs
     0x00,                    // Reserved, must be 0
     0xFF,                    // Initial Content of Erased Memory
     10000,                   // Program Page Timeout 100 mSec
@@ -37,6 +45,7 @@ int PrgCode SEGGER_FL_Prepare(unsigned long PreparePara0, unsigned long PrepareP
     (void)PreparePara0;
     (void)PreparePara1;
     (void)PreparePara2;
+    /* Init() also drops the session state of the optional modules */
     return (Init() == 1) ? (0) : (-1);
 }
 
@@ -45,7 +54,11 @@ int PrgCode SEGGER_FL_Restore(unsigned long RestorePara0, unsigned long RestoreP
     (void)RestorePara0;
     (void)RestorePara1;
     (void)RestorePara2;
-    return 0;
+    if (write_cache_flush() != HAL_OK)
+    {
+        return -1;
+    }
+    return (manifest_commit() == HAL_OK) ? (0) : (-1);
 }
 
 int PrgCode SEGGER_FL_Program(unsigned long DestAddr, unsigned long NumBytes, unsigned char *pSrcBuff)
@@ -56,17 +69,30 @@ int PrgCode SEGGER_FL_Program(unsigned long DestAddr, unsigned long NumBytes, un
 int PrgCode SEGGER_FL_Erase(unsigned long SectorAddr, unsigned long SectorIndex, unsigned long NumSectors)
 {
     unsigned long start = (SectorAddr - MEMORY_BASE_ADDR) / MEMORY_SECTOR_SIZE;
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t erased = 0;
 
+    telemetry_begin(TELEMETRY_FL_ERASE, SectorAddr, NumSectors, SectorIndex);
     w25qxx_exit_memory_mapped_mode();
-    for (unsigned long i = start + SectorIndex; i < (SectorIndex + NumSectors); i++)
+    ret = write_cache_flush();
+    if (ret == HAL_OK)
+    {
+        ret = manifest_mark(SectorAddr, NumSectors * MEMORY_SECTOR_SIZE);
+    }
+    write_verify_forget(SectorAddr, NumSectors * MEMORY_SECTOR_SIZE);
+    /* SectorAddr is the first sector to erase, SectorIndex only its index */
+    for (unsigned long i = start; (ret == HAL_OK) && (i < (start + NumSectors)); i++)
     {
-        if (HAL_OK != w25qxx_erase_sector(i * MEMORY_SECTOR_SIZE))
+        ret = sector_map_erase(i * MEMORY_SECTOR_SIZE);
+        if (HAL_OK != ret)
         {
-            return -1;
+            break;
         }
+        erased += MEMORY_SECTOR_SIZE;
     }
+    telemetry_end(erased, ret);
 
-    return 0;
+    return (ret == HAL_OK) ? (0) : (-1);
 }
 
 int PrgCode SEGGER_FL_EraseChip(void)
@@ -79,30 +105,61 @@ int PrgCode SEGGER_FL_Read(unsigned long Addr, unsigned long NumBytes, unsigned
     return (Read(Addr, NumBytes, pDestBuff) == 1) ? (0) : (-1);
 }
 
+int PrgCode SEGGER_FL_Fill(unsigned long Addr, unsigned long NumBytes, unsigned char *pPattern, unsigned long PatternLen)
+{
+    return (Fill(Addr, NumBytes, pPattern, PatternLen) == 1) ? (0) : (-1);
+}
+
 unsigned long PrgCode SEGGER_FL_Verify(unsigned long Addr, unsigned long NumBytes, unsigned char *pData)
 {
+    telemetry_begin(TELEMETRY_FL_VERIFY, Addr, NumBytes, 0);
+    write_cache_flush();
+    if (write_verify_covered(Addr, NumBytes))
+    {
+        /* Compared page by page when it was written */
+        telemetry_end(NumBytes, HAL_OK);
+        return Addr + NumBytes;
+    }
     w25qxx_enter_memory_mapped_mode();
+    if (verify_policy_get() != VERIFY_POLICY_FULL)
+    {
+        unsigned long failed = verify_policy_check(Addr, pData, NumBytes);
+
+        telemetry_end((failed != 0) ? 0 : NumBytes, (failed != 0) ? TELEMETRY_ERR_VERIFY : HAL_OK);
+        return (failed != 0) ? failed : Addr + NumBytes;
+    }
     for (unsigned int i = 0; i < NumBytes; i++)
     {
         if (pData[i] != *(unsigned char *)(Addr + i))
         {
+            telemetry_end(i, TELEMETRY_ERR_VERIFY);
             return Addr + i;
         }
     }
+    telemetry_end(NumBytes, HAL_OK);
 
     return Addr + NumBytes;
 }
 
 int PrgCode SEGGER_FL_CheckBlank(unsigned long Addr, unsigned long NumBytes, unsigned char BlankValue)
 {
+    telemetry_begin(TELEMETRY_FL_CHECK_BLANK, Addr, NumBytes, BlankValue);
+    write_cache_flush();
+    if (BlankValue == 0xFF && sector_map_blank(Addr, NumBytes))
+    {
+        telemetry_end(NumBytes, HAL_OK);
+        return 0;
+    }
     w25qxx_enter_memory_mapped_mode();
     for (unsigned int i = 0; i < NumBytes; i++)
     {
         if (BlankValue != *(unsigned char *)(Addr + i))
         {
+            telemetry_end(i, TELEMETRY_ERR_BLANK);
             return 1;
         }
     }
+    telemetry_end(NumBytes, HAL_OK);
 
     return 0;
 }
@@ -112,6 +169,8 @@ unsigned long PrgCode SEGGER_FL_CalcCRC(unsigned long crc, unsigned long Addr, u
     unsigned char data = 0;
     unsigned char xor = 0;
 
+    telemetry_begin(TELEMETRY_FL_CALC_CRC, Addr, NumBytes, Polynom);
+    write_cache_flush();
     w25qxx_enter_memory_mapped_mode();
     for (unsigned int i = 0; i < NumBytes; i++)
     {
@@ -125,6 +184,56 @@ unsigned long PrgCode SEGGER_FL_CalcCRC(unsigned long crc, unsigned long Addr, u
             data >>= 1;
         }
     }
+    telemetry_end(NumBytes, HAL_OK);
 
     return crc;
-}
\ No newline at end of file
+}
+
+/* Streaming mailbox of StreamStart(), located by the host through this
+ * symbol. Loader-specific, J-Link does not know it */
+stream_mailbox_t stream_mailbox __attribute__((__used__));
+
+/* Each block takes the Write() path: manifest, lazy erase, fused verify,
+ * read-modify-write and write cache as built */
+static int StreamProgram(uint32_t address, const uint8_t *data, uint32_t size)
+{
+    return (Write(address, size, (uint8_t *)data) == 1) ? 0 : -1;
+}
+
+int PrgCode SEGGER_OPEN_Program(unsigned long DestAddr, unsigned long NumBytes, unsigned char *pSrcBuff)
+{
+    /* Any size and alignment, w25qxx_write() splits into pages. A plain
+     * SEGGER_FL_Program(), not the J-Link turbo mode */
+    return SEGGER_FL_Program(DestAddr, NumBytes, pSrcBuff);
+}
+
+/**
+ * @brief  Loader-specific streaming mode, not part of the SEGGER API: stay
+ *         running and program the blocks the host drops into
+ *         stream_mailbox (see stream.h), so each block costs a RAM
+ *         download instead of a halt / run / breakpoint round trip, and
+ *         programming overlaps the download of the next block.
+ *         J-Link never calls it, it is started from a J-Link script or
+ *         tools/stream_harness.py only.
+ * @retval 0 on success, -1 if a block failed or the host went quiet for
+ *         STREAM_TIMEOUT_MS (stream_mailbox.status)
+ */
+int PrgCode StreamStart(unsigned long StartPara0, unsigned long StartPara1, unsigned long StartPara2)
+{
+    uint32_t status;
+
+    (void)StartPara0;
+    (void)StartPara1;
+    (void)StartPara2;
+    telemetry_begin(TELEMETRY_STREAM, (uint32_t)&stream_mailbox, STREAM_SLOT_SIZE, STREAM_SLOTS);
+    w25qxx_exit_memory_mapped_mode();
+    status = (write_cache_flush() == HAL_OK) ? stream_run(&stream_mailbox, StreamProgram, timebase_get_ms)
+                                             : STREAM_ERR_PROGRAM;
+    if (status == STREAM_OK && write_cache_flush() != HAL_OK)
+    {
+        status = STREAM_ERR_PROGRAM;
+    }
+    telemetry_end(stream_mailbox.bytes, status);
+
+    return (status == STREAM_OK) ? (0) : (-1);
+}
@@ -1,6 +1,18 @@
+#include <string.h>
 #include "main.h"
 #include "gpio.h"
 #include "w25qxx.h"
+#include "timebase.h"
+#include "telemetry.h"
+#include "crc32_hw.h"
+#include "manifest.h"
+#include "lz_decode.h"
+#include "write_cache.h"
+#include "rmw.h"
+#include "sector_map.h"
+#include "mass_erase.h"
+#include "write_verify.h"
+#include "verify_policy.h"
 #include "stldr_loader.h"
 #include "DevInf.h"
 
@@ -11,29 +23,52 @@ struct StorageInfo const StorageInfo __attribute__((section(".dev_info"))) = {
     "W25Q16_STM32L4xx-QSPI",             // Device Name + version number
     NOR_FLASH,                           // Device Type
     0x90000000,                          // Device Start Address
-    MEMORY_FLASH_SIZE,                   // Device Size in Bytes
-    MEMORY_PAGE_SIZE,                    // Programming Page Size
+    MEMORY_USABLE_SIZE,                  // Device Size in Bytes (without the manifest)
+    MEMORY_TRANSFER_PAGE_SIZE,           // Programming Page Size, split into MEMORY_PAGE_SIZE programs
     0xFF,                                // Initial Content of Erased Memory
 
     // Specify Size and Address of Sectors (view example below)
     {   {
-            (MEMORY_FLASH_SIZE / MEMORY_SECTOR_SIZE),  // Sector Numbers,
+            (MEMORY_USABLE_SIZE / MEMORY_SECTOR_SIZE), // Sector Numbers,
             MEMORY_SECTOR_SIZE                         // Sector Size
         },
         { 0x00000000, 0x00000000 }
     }
 };
 
-extern void SystemClock_Config(void);
-
 /**
  * @brief  System initialization.
+ *         When the clock tree, QUADSPI and flash are still configured from a
+ *         previous call the hardware is reused as-is, otherwise everything is
+ *         brought up from reset.
  * @param  None
  * @retval  LOADER_OK = 1   : Operation succeeded
  * @retval  LOADER_FAIL = 0 : Operation failed
  */
 int Init(void)
 {
+    uint8_t configured = SystemClock_IsConfigured();
+
+    if (configured)
+    {
+        /* .data is reloaded with every download, so SystemCoreClock reads
+         * the reset value again while the PLL is still running */
+        SystemCoreClockUpdate();
+    }
+    timebase_init();
+    telemetry_begin(TELEMETRY_INIT, 0, 0, 0);
+    sector_map_reset();
+    manifest_reset();
+
+    if (configured && (MX_QUADSPI_Attach() == HAL_OK) && (w25qxx_attach() == HAL_OK))
+    {
+        telemetry_count_init_attached();
+        write_verify_attach();
+        verify_policy_attach();
+        telemetry_end(0, HAL_OK);
+        return LOADER_OK;
+    }
+
     hqspi.Instance = QUADSPI;
 	HAL_QSPI_DeInit(&hqspi);
     HAL_Init();
@@ -41,10 +76,32 @@ int Init(void)
     MX_GPIO_Init();
     MX_QUADSPI_Init();
     w25qxx_init();
+    write_cache_reset();
+    write_verify_reset();
+    verify_policy_reset();
+    telemetry_end(0, HAL_OK);
 
     return LOADER_OK;
 }
 
+/* The Write() path for every entry point that programs data: manifest,
+ * lazy erase, fused verify, read-modify-write and write cache as built */
+static HAL_StatusTypeDef WriteChain(uint32_t Address, uint32_t Size, uint8_t *buffer)
+{
+    HAL_StatusTypeDef ret = manifest_mark(Address, Size);
+
+    if (ret == HAL_OK)
+    {
+        ret = sector_map_prepare(Address, Size);
+    }
+    if (ret == HAL_OK)
+    {
+        ret = write_verify_write(buffer, Address, Size);
+    }
+
+    return ret;
+}
+
 /**
  * @brief   Program memory.
  * @param   Address: page address
@@ -55,25 +112,29 @@ int Init(void)
  */
 int Write(uint32_t Address, uint32_t Size, uint8_t *buffer)
 {
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    telemetry_begin(TELEMETRY_WRITE, Address, Size, 0);
     w25qxx_exit_memory_mapped_mode();
-    if (w25qxx_write(buffer, Address - MEMORY_BASE_ADDR, Size) != HAL_OK)
-    {
-        return LOADER_FAIL;
-    }
+    ret = WriteChain(Address, Size, buffer);
+    telemetry_end(Size, ret);
 
-    return LOADER_OK;
+    return (ret == HAL_OK) ? LOADER_OK : LOADER_FAIL;
 }
 
 int Read(uint32_t Address, uint32_t Size, uint8_t *Buffer)
 {
     unsigned int i = 0;
 
+    telemetry_begin(TELEMETRY_READ, Address, Size, 0);
+    write_cache_flush();
     w25qxx_enter_memory_mapped_mode();
     for (i = 0; i < Size; i++)
     {
         *(uint8_t *)Buffer++ = *(uint8_t *)Address;
         Address++;
     }
+    telemetry_end(Size, HAL_OK);
 
     return 1;
 }
@@ -87,20 +148,34 @@ int Read(uint32_t Address, uint32_t Size, uint8_t *Buffer)
  */
 int SectorErase(uint32_t EraseStartAddress, uint32_t EraseEndAddress)
 {
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t erased = 0;
+
+    telemetry_begin(TELEMETRY_SECTOR_ERASE, EraseStartAddress, EraseEndAddress - EraseStartAddress + 1, 0);
     w25qxx_exit_memory_mapped_mode();
-    while (EraseEndAddress >= EraseStartAddress)
+    ret = write_cache_flush();
+    if (ret == HAL_OK)
     {
-        if (w25qxx_erase_sector(EraseStartAddress - MEMORY_BASE_ADDR) != HAL_OK)
-            return LOADER_FAIL;
+        ret = manifest_mark(EraseStartAddress, EraseEndAddress - EraseStartAddress + 1);
+    }
+    write_verify_forget(EraseStartAddress, EraseEndAddress - EraseStartAddress + MEMORY_SECTOR_SIZE);
+    while (ret == HAL_OK && EraseEndAddress >= EraseStartAddress)
+    {
+        ret = sector_map_erase(EraseStartAddress - MEMORY_BASE_ADDR);
+        if (ret != HAL_OK)
+            break;
         EraseStartAddress += MEMORY_SECTOR_SIZE;
+        erased += MEMORY_SECTOR_SIZE;
     }
+    telemetry_end(erased, ret);
 
-    return LOADER_OK;
+    return (ret == HAL_OK) ? LOADER_OK : LOADER_FAIL;
 }
 
 /**
  * Description :
- * Mass erase of external flash area
+ * Mass erase of external flash area. Blank 64K blocks are skipped when
+ * that beats a chip erase, see mass_erase.h
  * Optional command - delete in case usage of mass erase is not planed
  * Inputs    :
  *      none
@@ -110,13 +185,25 @@ int SectorErase(uint32_t EraseStartAddress, uint32_t EraseEndAddress)
  */
 int MassErase(void)
 {
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    telemetry_begin(TELEMETRY_MASS_ERASE, 0, 0, 0);
     w25qxx_exit_memory_mapped_mode();
-    if (HAL_OK != w25qxx_erase_chip())
+    /* Pending data is about to be erased anyway */
+    write_cache_flush();
+    ret = manifest_mark(MEMORY_BASE_ADDR, MEMORY_USABLE_SIZE);
+    if (ret == HAL_OK)
     {
-        return LOADER_FAIL;
+        ret = mass_erase();
+    }
+    if (ret == HAL_OK)
+    {
+        sector_map_erased_all();
     }
+    write_verify_reset();
+    telemetry_end((ret == HAL_OK) ? MEMORY_FLASH_SIZE : 0, ret);
 
-    return LOADER_OK;
+    return (ret == HAL_OK) ? LOADER_OK : LOADER_FAIL;
 }
 
 /**
@@ -137,6 +224,10 @@ uint32_t CheckSum(uint32_t StartAddress, uint32_t Size, uint32_t InitVal)
     unsigned int cnt;
     uint32_t Val;
 
+    telemetry_begin(TELEMETRY_CHECKSUM, StartAddress, Size, InitVal);
+    /* Also called on its own, not only from Verify() */
+    write_cache_flush();
+    w25qxx_enter_memory_mapped_mode();
     StartAddress -= StartAddress % 4;
     Size += (Size % 4 == 0) ? 0 : 4 - (Size % 4);
 
@@ -194,6 +285,7 @@ uint32_t CheckSum(uint32_t StartAddress, uint32_t Size, uint32_t InitVal)
         }
         StartAddress += 4;
     }
+    telemetry_end(Size, HAL_OK);
 
     return (InitVal);
 }
@@ -219,15 +311,305 @@ uint64_t Verify(uint32_t MemoryAddr, uint32_t RAMBufferAddr, uint32_t Size, uint
     uint64_t checksum = 0;
 
     Size *= 4;
+    telemetry_begin(TELEMETRY_VERIFY, MemoryAddr, Size, missalignement);
+    /* A failed flush shows up as a mismatch */
+    write_cache_flush();
     w25qxx_enter_memory_mapped_mode();
     checksum = CheckSum((uint32_t)MemoryAddr + (missalignement & 0xf), Size - ((missalignement >> 16) & 0xF), InitVal);
+    if (write_verify_covered(MemoryAddr, Size))
+    {
+        /* Compared page by page when it was written */
+        VerifiedData = Size;
+        MemoryAddr += Size;
+    }
+    else if (verify_policy_get() != VERIFY_POLICY_FULL)
+    {
+        uint32_t failed = verify_policy_check(MemoryAddr, (const uint8_t *)RAMBufferAddr, Size);
+
+        if (failed != 0)
+        {
+            telemetry_end(0, TELEMETRY_ERR_VERIFY);
+            return ((checksum << 32) + failed);
+        }
+        VerifiedData = Size;
+        MemoryAddr += Size;
+    }
     while (Size > VerifiedData)
     {
         if (*(uint8_t *)MemoryAddr++ != *((uint8_t *)RAMBufferAddr + VerifiedData))
+        {
+            telemetry_end(VerifiedData, TELEMETRY_ERR_VERIFY);
             return ((checksum << 32) + (MemoryAddr + VerifiedData));
+        }
 
         VerifiedData++;
     }
+    /* A failed manifest update only leaves the manifest marked stale */
+    telemetry_end(Size, manifest_verified(MemoryAddr - Size, Size));
 
     return (checksum << 32);
 }
+
+/**
+ * Description :
+ * Computes the CRC-32 of every sector overlapping a range, so the host can
+ * compare them with its image and transfer only the sectors that differ.
+ * Not part of the STM32CubeProgrammer interface, call it from a debugger
+ * script (see tools/loader_host.py SectorCrc for the host side).
+ * Inputs    :
+ *      StartAddress  : Flash address, rounded down to a sector boundary
+ *      Size          : Size of the range in bytes
+ *      Table         : RAM buffer receiving one CRC-32 (as zlib crc32())
+ *                      per sector
+ * outputs   :
+ *     R0             : Number of sectors written to Table, 0 on failure
+ */
+int SectorCrc(uint32_t StartAddress, uint32_t Size, uint32_t *Table)
+{
+    uint32_t address = StartAddress - (StartAddress - MEMORY_BASE_ADDR) % MEMORY_SECTOR_SIZE;
+    uint32_t end = StartAddress + Size;
+    int count = 0;
+
+    telemetry_begin(TELEMETRY_SECTOR_CRC, StartAddress, Size, (uint32_t)Table);
+    /* Compared without forming StartAddress + Size, which may wrap */
+    if (StartAddress < MEMORY_BASE_ADDR || StartAddress - MEMORY_BASE_ADDR >= MEMORY_FLASH_SIZE || Size == 0 ||
+        Size > MEMORY_FLASH_SIZE - (StartAddress - MEMORY_BASE_ADDR) || Table == NULL || ((uint32_t)Table & 3) ||
+        write_cache_flush() != HAL_OK || w25qxx_enter_memory_mapped_mode() != HAL_OK)
+    {
+        telemetry_end(0, HAL_ERROR);
+        return 0;
+    }
+
+    crc32_hw_init();
+    for (; address < end; address += MEMORY_SECTOR_SIZE)
+    {
+        Table[count++] = crc32_hw_compute((const uint8_t *)address, MEMORY_SECTOR_SIZE);
+    }
+    telemetry_end(count * MEMORY_SECTOR_SIZE, HAL_OK);
+
+    return count;
+}
+
+static int WriteCompressedSink(void *ctx, uint32_t offset, const uint8_t *data, uint32_t size)
+{
+    uint32_t Address = *(uint32_t *)ctx;
+
+    return (WriteChain(Address + offset, size, (uint8_t *)data) == HAL_OK) ? 0 : -1;
+}
+
+/**
+ * @brief   Program memory from a WLZ1 compressed buffer (tools/lz_pack.py).
+ *          The data is decoded in RAM one page at a time straight into the
+ *          Write() path, so only the compressed stream has to cross the
+ *          debug link. The decoded image must fit the flash.
+ * @param   Address: destination address of the decoded data
+ * @param   Size   : size of the compressed stream
+ * @param   buffer : pointer to the compressed stream
+ * @retval  LOADER_OK = 1   : Operation succeeded
+ * @retval  LOADER_FAIL = 0 : Operation failed (bad stream or program error)
+ */
+int WriteCompressed(uint32_t Address, uint32_t Size, uint8_t *buffer)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    int32_t decoded = lz_decoded_size(buffer, Size);
+
+    telemetry_begin(TELEMETRY_WRITE_COMPRESSED, Address, Size, (decoded < 0) ? 0 : decoded);
+    if (decoded < 0 || Address < MEMORY_BASE_ADDR || Address - MEMORY_BASE_ADDR >= MEMORY_FLASH_SIZE ||
+        (uint32_t)decoded > MEMORY_FLASH_SIZE - (Address - MEMORY_BASE_ADDR))
+    {
+        telemetry_end(0, HAL_ERROR);
+        return LOADER_FAIL;
+    }
+    w25qxx_exit_memory_mapped_mode();
+    ret = manifest_mark(Address, decoded);
+    if (ret == HAL_OK)
+    {
+        /* The whole range at once, so a sector with data the sink reaches
+         * in page sized pieces is erased or merged only once */
+        ret = sector_map_prepare(Address, decoded);
+    }
+    if (ret == HAL_OK && lz_decode(buffer, Size, Address, WriteCompressedSink, &Address) != decoded)
+    {
+        ret = HAL_ERROR;
+    }
+    telemetry_end((ret == HAL_OK) ? decoded : 0, ret);
+
+    return (ret == HAL_OK) ? LOADER_OK : LOADER_FAIL;
+}
+
+/* Fill() goes through WriteChain() in whole sectors when the build merges
+ * or erases them there, so each sector is handled once */
+#if LOADER_WRITE_RMW || LOADER_LAZY_ERASE
+#define FILL_CHUNK_SIZE MEMORY_SECTOR_SIZE
+#else
+#define FILL_CHUNK_SIZE MEMORY_PAGE_SIZE
+#endif
+
+/**
+ * @brief   Fill memory with a repeating pattern generated on the target, so
+ *          constant regions need no data transfer. The pattern phase is
+ *          relative to Address. The pattern is programmed like Write()
+ *          data, so the target must be erased unless the build erases or
+ *          merges on write. Filling with the erase value programs
+ *          nothing and only checks that the range is blank.
+ * @param   Address   : start address
+ * @param   Size      : number of bytes to fill
+ * @param   Pattern   : pattern bytes in RAM
+ * @param   PatternLen: pattern length, 1 to MEMORY_PAGE_SIZE
+ * @retval  LOADER_OK = 1   : Operation succeeded
+ * @retval  LOADER_FAIL = 0 : Operation failed or range not blank
+ */
+int Fill(uint32_t Address, uint32_t Size, uint8_t *Pattern, uint32_t PatternLen)
+{
+    static uint8_t page[FILL_CHUNK_SIZE];
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t blank = 1;
+    uint32_t done = 0;
+
+    telemetry_begin(TELEMETRY_FILL, Address, Size, PatternLen);
+    if (PatternLen == 0 || PatternLen > MEMORY_PAGE_SIZE)
+    {
+        telemetry_end(0, HAL_ERROR);
+        return LOADER_FAIL;
+    }
+    for (uint32_t i = 0; i < PatternLen; i++)
+    {
+        blank &= (Pattern[i] == 0xFF);
+    }
+
+    if (write_cache_flush() != HAL_OK)
+    {
+        telemetry_end(0, HAL_ERROR);
+        return LOADER_FAIL;
+    }
+
+    if (blank)
+    {
+        w25qxx_enter_memory_mapped_mode();
+        done = sector_map_blank(Address, Size) ? Size : 0;
+        while (done < Size && *(uint8_t *)(Address + done) == 0xFF)
+        {
+            done++;
+        }
+        telemetry_end(done, (done == Size) ? HAL_OK : TELEMETRY_ERR_BLANK);
+
+        return (done == Size) ? LOADER_OK : LOADER_FAIL;
+    }
+
+    w25qxx_exit_memory_mapped_mode();
+    while (ret == HAL_OK && done < Size)
+    {
+        uint32_t chunk = FILL_CHUNK_SIZE - (Address + done) % FILL_CHUNK_SIZE;
+
+        if (chunk > Size - done)
+        {
+            chunk = Size - done;
+        }
+        for (uint32_t i = 0; i < chunk; i++)
+        {
+            page[i] = Pattern[(done + i) % PatternLen];
+        }
+        ret = WriteChain(Address + done, chunk, page);
+        done += chunk;
+    }
+    telemetry_end((ret == HAL_OK) ? Size : 0, ret);
+
+    return (ret == HAL_OK) ? LOADER_OK : LOADER_FAIL;
+}
+
+static batch_status_t BatchVerify(const batch_op_t *op, const uint8_t *Data)
+{
+    const uint8_t *flash = (const uint8_t *)op->address;
+    const uint8_t *data = Data + op->offset;
+
+    write_cache_flush();
+    w25qxx_enter_memory_mapped_mode();
+    for (uint32_t i = 0; i < op->size; i++)
+    {
+        if (flash[i] != data[i])
+        {
+            return BATCH_STATUS_FAIL;
+        }
+    }
+    manifest_verified(op->address, op->size);
+
+    return BATCH_STATUS_OK;
+}
+
+static batch_status_t BatchRun(const batch_op_t *op, uint8_t *Data)
+{
+    int ret = LOADER_FAIL;
+    uint32_t crc = 0;
+
+    switch (op->op)
+    {
+    case BATCH_ERASE:
+        ret = (op->size == 0) ? LOADER_OK : SectorErase(op->address, op->address + op->size - 1);
+        break;
+    case BATCH_PROGRAM:
+        ret = Write(op->address, op->size, Data + op->offset);
+        break;
+    case BATCH_PROGRAM_COMPRESSED:
+        ret = WriteCompressed(op->address, op->size, Data + op->offset);
+        break;
+    case BATCH_VERIFY:
+        return BatchVerify(op, Data);
+    case BATCH_CRC:
+        write_cache_flush();
+        w25qxx_enter_memory_mapped_mode();
+        crc32_hw_init();
+        crc = crc32_hw_compute((const uint8_t *)op->address, op->size);
+        memcpy(Data + op->offset, &crc, sizeof(crc));
+        ret = LOADER_OK;
+        break;
+    case BATCH_FILL:
+        ret = Fill(op->address, op->size, Data + op->offset, op->length);
+        break;
+    case BATCH_MASS_ERASE:
+        ret = MassErase();
+        break;
+    default:
+        return BATCH_STATUS_BAD_OP;
+    }
+
+    return (ret == LOADER_OK) ? BATCH_STATUS_OK : BATCH_STATUS_FAIL;
+}
+
+/**
+ * @brief   Execute a list of operations in one call, so a plan with many
+ *          small regions costs a single debugger round trip
+ *          (tools/flash_plan.py --batch writes the descriptors). Execution
+ *          stops at the first failing operation, the remaining ones are
+ *          reported as skipped.
+ * @param   Count : number of descriptors
+ * @param   Ops   : operation descriptors in RAM
+ * @param   Data  : data buffer the descriptor offsets refer to
+ * @param   Status: receives one batch_status_t per descriptor
+ * @retval  LOADER_OK = 1   : All operations succeeded
+ * @retval  LOADER_FAIL = 0 : An operation failed, see Status
+ */
+int Batch(uint32_t Count, const batch_op_t *Ops, uint8_t *Data, uint32_t *Status)
+{
+    batch_status_t status = BATCH_STATUS_OK;
+    uint32_t done = 0;
+
+    telemetry_begin(TELEMETRY_BATCH, (uint32_t)Ops, Count, (uint32_t)Data);
+    for (uint32_t i = 0; i < Count; i++)
+    {
+        if (status != BATCH_STATUS_OK)
+        {
+            Status[i] = BATCH_STATUS_SKIPPED;
+            continue;
+        }
+        status = BatchRun(&Ops[i], Data);
+        Status[i] = status;
+        done += (status == BATCH_STATUS_OK) ? Ops[i].size : 0;
+    }
+    if (write_cache_flush() != HAL_OK)
+    {
+        status = BATCH_STATUS_FAIL;
+    }
+    telemetry_end(done, (status == BATCH_STATUS_OK) ? HAL_OK : HAL_ERROR);
+
+    return (status == BATCH_STATUS_OK) ? LOADER_OK : LOADER_FAIL;
+}
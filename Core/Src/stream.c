@@ -0,0 +1,75 @@
+#include "stream.h"
+
+/**
+ * @brief  Serve the mailbox until the host stops the session.
+ * @param  mailbox: shared RAM mailbox, reset here
+ * @param  program: called once per block, in order
+ * @param  now_ms: clock for the STREAM_TIMEOUT_MS idle timeout
+ * @retval STREAM_OK, STREAM_ERR_TIMEOUT or the STREAM_ERR_* code of the
+ *         first failed block
+ */
+uint32_t stream_run(stream_mailbox_t *mailbox, stream_program_t program, stream_clock_t now_ms)
+{
+    uint32_t tail = 0;
+    uint32_t idle = now_ms();
+
+    mailbox->command = STREAM_CMD_RUN;
+    mailbox->head = 0;
+    mailbox->tail = 0;
+    mailbox->status = STREAM_OK;
+    mailbox->bytes = 0;
+    mailbox->slot_size = STREAM_SLOT_SIZE;
+    mailbox->slot_count = STREAM_SLOTS;
+    STREAM_BARRIER();
+    mailbox->magic = STREAM_MAGIC;
+
+    for (;;)
+    {
+        const stream_slot_t *slot;
+
+        if (mailbox->head == tail)
+        {
+            if (mailbox->command == STREAM_CMD_STOP)
+            {
+                /* The host sets STOP after its last head update */
+                STREAM_BARRIER();
+                if (mailbox->head == tail)
+                {
+                    break;
+                }
+            }
+            if (now_ms() - idle >= STREAM_TIMEOUT_MS)
+            {
+                mailbox->status = STREAM_ERR_TIMEOUT;
+                break;
+            }
+            continue;
+        }
+        /* Slot contents are valid once head has moved past them */
+        STREAM_BARRIER();
+        slot = &mailbox->slots[tail % STREAM_SLOTS];
+        if (slot->size == 0)
+        {
+            break;
+        }
+        if (slot->size > STREAM_SLOT_SIZE)
+        {
+            mailbox->status = STREAM_ERR_SIZE;
+            break;
+        }
+        if (program(slot->address, slot->data, slot->size) != 0)
+        {
+            mailbox->status = STREAM_ERR_PROGRAM;
+            break;
+        }
+        mailbox->bytes += slot->size;
+        STREAM_BARRIER();
+        mailbox->tail = ++tail;
+        idle = now_ms();
+    }
+
+    STREAM_BARRIER();
+    mailbox->magic = 0;
+
+    return mailbox->status;
+}
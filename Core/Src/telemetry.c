@@ -0,0 +1,112 @@
+#include <string.h>
+#include "telemetry.h"
+#include "call_trace.h"
+
+#if LOADER_TELEMETRY
+
+/* Default visibility: the FLM, built with every symbol hidden
+ * (cmake/flm/flm_pic.h), reaches it at its fixed address through the GOT */
+telemetry_t loader_telemetry __attribute__((section(".telemetry"), used, visibility("default")));
+
+/* Entry points call each other (Verify -> CheckSum, SEGGER_FL_* -> Write...),
+ * only the outermost one is accounted */
+static uint32_t depth = 0;
+static telemetry_op_stats_t *current = NULL;
+static uint32_t start_cycles = 0;
+
+static void telemetry_check(void)
+{
+    /* The section is not loaded, so it holds garbage after power-up. Writing
+     * 0 to the magic from the debugger clears the statistics, as does a
+     * loader with a different layout. */
+    if (loader_telemetry.magic != TELEMETRY_MAGIC || loader_telemetry.version != TELEMETRY_VERSION ||
+        loader_telemetry.op_num != TELEMETRY_OP_NUM)
+    {
+        memset(&loader_telemetry, 0, sizeof(loader_telemetry));
+        loader_telemetry.magic = TELEMETRY_MAGIC;
+        loader_telemetry.version = TELEMETRY_VERSION;
+        loader_telemetry.op_num = TELEMETRY_OP_NUM;
+    }
+}
+
+void telemetry_begin(telemetry_op_t op, uint32_t address, uint32_t size, uint32_t arg)
+{
+    if (depth++ != 0)
+    {
+        return;
+    }
+
+    telemetry_check();
+    call_trace_begin(op, address, size, arg);
+    current = &loader_telemetry.ops[op];
+    current->calls++;
+    start_cycles = DWT->CYCCNT;
+}
+
+void telemetry_end(uint32_t bytes, uint32_t error)
+{
+    uint32_t cycles = DWT->CYCCNT - start_cycles;
+
+    if (depth == 0 || --depth != 0)
+    {
+        return;
+    }
+
+    current->bytes += bytes;
+    current->cycles_total += cycles;
+    if (current->calls == 1 || cycles < current->cycles_min)
+    {
+        current->cycles_min = cycles;
+    }
+    if (cycles > current->cycles_max)
+    {
+        current->cycles_max = cycles;
+    }
+    if (error != 0)
+    {
+        current->errors++;
+        current->last_error = error;
+    }
+    loader_telemetry.core_clock_hz = SystemCoreClock;
+    current = NULL;
+    call_trace_end(error, cycles);
+}
+
+void telemetry_count_command(void)
+{
+    if (current != NULL)
+    {
+        current->commands++;
+    }
+}
+
+void telemetry_count_poll(void)
+{
+    if (current != NULL)
+    {
+        current->polls++;
+    }
+}
+
+void telemetry_count_skipped_pages(uint32_t pages)
+{
+    if (current != NULL)
+    {
+        current->skipped_pages += pages;
+    }
+}
+
+void telemetry_count_skipped_sectors(uint32_t sectors)
+{
+    if (current != NULL)
+    {
+        current->skipped_sectors += sectors;
+    }
+}
+
+void telemetry_count_init_attached(void)
+{
+    loader_telemetry.init_attached++;
+}
+
+#endif
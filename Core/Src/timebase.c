@@ -0,0 +1,82 @@
+#include "timebase.h"
+
+/* The loader runs without interrupts, so the DWT cycle counter replaces
+ * SysTick as the HAL timebase. The millisecond tick is derived from it on
+ * demand and stays correct as long as it is read at least once per CYCCNT
+ * wrap (~53 s at 80 MHz), which every timeout loop does. */
+
+static uint32_t cycles_per_us = 4;
+static uint32_t cycles_per_ms = 4000;
+static uint32_t last_cycles = 0;
+static uint32_t ticks_ms = 0;
+
+static void timebase_update(void)
+{
+    uint32_t elapsed = DWT->CYCCNT - last_cycles;
+    uint32_t ms = elapsed / cycles_per_ms;
+
+    ticks_ms += ms;
+    last_cycles += ms * cycles_per_ms;
+}
+
+/**
+ * @brief  Start the cycle counter and latch the current core clock.
+ *         Must be called again after SystemCoreClock changes.
+ */
+void timebase_init(void)
+{
+    if ((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0U)
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        last_cycles = 0;
+    }
+    else
+    {
+        /* Account the time elapsed so far at the previous rate */
+        timebase_update();
+    }
+
+    cycles_per_us = SystemCoreClock / 1000000U;
+    if (cycles_per_us == 0U)
+    {
+        cycles_per_us = 1;
+    }
+    cycles_per_ms = cycles_per_us * 1000U;
+}
+
+uint32_t timebase_get_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+uint32_t timebase_get_ms(void)
+{
+    timebase_update();
+
+    return ticks_ms;
+}
+
+uint32_t timebase_cycles_to_us(uint32_t cycles)
+{
+    return cycles / cycles_per_us;
+}
+
+void timebase_delay_us(uint32_t us)
+{
+    uint32_t start = DWT->CYCCNT;
+    uint32_t cycles = us * cycles_per_us;
+
+    while ((DWT->CYCCNT - start) < cycles)
+    {
+    }
+}
+
+void timebase_delay_ms(uint32_t ms)
+{
+    while (ms--)
+    {
+        timebase_delay_us(1000U);
+    }
+}
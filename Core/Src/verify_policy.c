@@ -0,0 +1,200 @@
+#include "verify_policy.h"
+#include "crc32_hw.h"
+
+#if LOADER_VERIFY_POLICIES
+
+/* Written by the host through this symbol, validated by its magic */
+verify_config_t verify_config __attribute__((__used__));
+
+static uint32_t verify_policy_min(uint32_t a, uint32_t b)
+{
+    return (a < b) ? a : b;
+}
+
+static uint32_t verify_policy_max(uint32_t a, uint32_t b)
+{
+    return (a > b) ? a : b;
+}
+
+/* Integer hash spreading the sampled pages over the image, mirrored by
+ * tools/loader_host.py */
+static uint32_t verify_policy_mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7FEB352DU;
+    x ^= x >> 15;
+    x *= 0x846CA68BU;
+    x ^= x >> 16;
+
+    return x;
+}
+
+/* Byte-wise compare of [from, to) with the host buffer holding [address, ...) */
+static uint32_t verify_policy_compare(uint32_t address, const uint8_t *buffer, uint32_t from, uint32_t to)
+{
+    for (uint32_t a = from; a < to; a++)
+    {
+        if (*(const uint8_t *)a != buffer[a - address])
+        {
+            return a;
+        }
+    }
+
+    return 0;
+}
+
+/* Chunks whose last byte lies in [address, end), each checked once per pass */
+static uint32_t verify_policy_crc(uint32_t address, uint32_t end, uint32_t covered)
+{
+    uint32_t base = verify_config.base;
+    uint32_t chunk = verify_config.chunk;
+    uint32_t image_end = base + verify_config.size;
+
+    crc32_hw_init();
+    for (uint32_t start = base + (address - base) / chunk * chunk; start < covered && start < end; start += chunk)
+    {
+        uint32_t stop = verify_policy_min(start + chunk, image_end);
+
+        if (stop > address && stop <= end &&
+            crc32_hw_compute((const uint8_t *)start, stop - start) != verify_config.crc[(start - base) / chunk])
+        {
+            return start;
+        }
+    }
+
+    return 0;
+}
+
+/* Sampled pages of [from, to), then the whole image once its end is reached */
+static uint32_t verify_policy_sampled(uint32_t address, const uint8_t *buffer, uint32_t from, uint32_t to)
+{
+    uint32_t base = verify_config.base;
+    uint32_t image_end = base + verify_config.size;
+    uint32_t every = (verify_config.every != 0) ? verify_config.every : 1;
+    uint32_t failed = 0;
+
+    for (uint32_t page = from - (from - MEMORY_BASE_ADDR) % MEMORY_PAGE_SIZE; failed == 0 && page < to; page += MEMORY_PAGE_SIZE)
+    {
+        uint32_t index = (page - MEMORY_BASE_ADDR) / MEMORY_PAGE_SIZE;
+
+        if (verify_policy_mix(index ^ verify_config.seed) % every == 0)
+        {
+            failed = verify_policy_compare(address, buffer, verify_policy_max(page, from),
+                                           verify_policy_min(page + MEMORY_PAGE_SIZE, to));
+        }
+    }
+    if (failed == 0 && address < image_end && image_end <= to)
+    {
+        crc32_hw_init();
+        if (crc32_hw_compute((const uint8_t *)base, verify_config.size) != verify_config.image_crc)
+        {
+            failed = base;
+        }
+    }
+
+    return failed;
+}
+
+/**
+ * @brief  Drop the verify_config block. Called by a full Init(): the RAM
+ *         after a reset holds nothing the host wrote for this loader.
+ * @retval None
+ */
+void verify_policy_reset(void)
+{
+    verify_config.magic = 0;
+}
+
+/**
+ * @brief  Re-validate the verify_config block when Init() reattaches to a
+ *         configured target, dropping one whose fields are out of range.
+ * @retval None
+ */
+void verify_policy_attach(void)
+{
+    if (verify_policy_get() == VERIFY_POLICY_FULL)
+    {
+        verify_config.magic = 0;
+    }
+}
+
+/**
+ * @brief  Policy in effect for the next Verify().
+ * @retval VERIFY_POLICY_FULL, VERIFY_POLICY_CRC or VERIFY_POLICY_SAMPLED
+ */
+uint32_t verify_policy_get(void)
+{
+    uint32_t policy;
+
+    if (verify_config.magic != VERIFY_CONFIG_MAGIC || verify_config.size == 0 ||
+        verify_config.base < MEMORY_BASE_ADDR || verify_config.base - MEMORY_BASE_ADDR >= MEMORY_FLASH_SIZE ||
+        verify_config.size > MEMORY_FLASH_SIZE - (verify_config.base - MEMORY_BASE_ADDR))
+    {
+        return VERIFY_POLICY_FULL;
+    }
+    policy = (verify_config.policy == VERIFY_POLICY_DEFAULT) ? LOADER_VERIFY_POLICY : verify_config.policy;
+    if (policy == VERIFY_POLICY_CRC && verify_config.chunk == 0)
+    {
+        return VERIFY_POLICY_FULL;
+    }
+
+    return (policy == VERIFY_POLICY_CRC || policy == VERIFY_POLICY_SAMPLED) ? policy : VERIFY_POLICY_FULL;
+}
+
+/**
+ * @brief  Verify a range with the configured policy. The flash must be in
+ *         memory-mapped mode.
+ * @param  address: start address in the memory-mapped window
+ * @param  buffer: host data for [address, address + size), only read for
+ *         the bytes the policy compares
+ * @param  size: length in bytes
+ * @retval 0 if the range passed, otherwise the address of the failing byte,
+ *         CRC chunk or image
+ */
+uint32_t verify_policy_check(uint32_t address, const uint8_t *buffer, uint32_t size)
+{
+    uint32_t policy = verify_policy_get();
+    uint32_t end = address + size;
+    uint32_t base = verify_config.base;
+    uint32_t covered;
+    uint32_t failed = 0;
+
+    if (policy == VERIFY_POLICY_FULL)
+    {
+        return verify_policy_compare(address, buffer, address, end);
+    }
+    covered = base + verify_config.size;
+    if (policy == VERIFY_POLICY_CRC)
+    {
+        covered = base + verify_policy_min(verify_config.size, VERIFY_CRC_CHUNKS * verify_config.chunk);
+    }
+    if (address < base)
+    {
+        failed = verify_policy_compare(address, buffer, address, verify_policy_min(end, base));
+    }
+    if (failed == 0 && end > base && address < covered)
+    {
+        if (policy == VERIFY_POLICY_CRC)
+        {
+            failed = verify_policy_crc(verify_policy_max(address, base), verify_policy_min(end, covered), covered);
+        }
+        else
+        {
+            failed = verify_policy_sampled(address, buffer, verify_policy_max(address, base), verify_policy_min(end, covered));
+        }
+    }
+    if (failed == 0 && end > covered)
+    {
+        failed = verify_policy_compare(address, buffer, verify_policy_max(address, covered), end);
+    }
+    /* The block describes one image: the Verify() reaching its end uses
+     * it up, so it cannot apply to a later session */
+    if (address < base + verify_config.size && end >= base + verify_config.size)
+    {
+        verify_config.magic = 0;
+    }
+
+    return failed;
+}
+
+#endif
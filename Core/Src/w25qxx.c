@@ -1,5 +1,8 @@
 #include "quadspi.h"
 #include "w25qxx.h"
+#include "timebase.h"
+#include "telemetry.h"
+#include "qspi_trace.h"
 
 /* =============== CMD ================ */
 #define W25X_WriteEnable 0x06
@@ -10,6 +13,7 @@
 #define W25X_WriteStatusReg1 0x01
 #define W25X_WriteStatusReg2 0x31
 #define W25X_WriteStatusReg3 0x11
+#define W25X_VolatileSRWriteEnable 0x50
 #define W25X_ReadData 0x03
 #define W25X_FastReadData 0x0B
 #define W25X_FastReadDual 0x3B
@@ -56,9 +60,77 @@
 /* Status Register */
 #define W25X_SR_WIP (0x01)  /*!< Write in progress */
 #define W25X_SR_WREN (0x02) /*!< Write enable latch */
+#define W25X_SR2_QE (0x02)  /*!< Quad enable */
+
+/* JEDEC manufacturer ID of Winbond */
+#define W25X_MANUFACTURER_ID 0xEF
+
+/* Status polling: interval bounds in SCK cycles, fraction of the expected
+ * busy time polled instead of waited, and weight of the running average */
+#define W25X_POLL_INTERVAL_MIN 0x10U
+#define W25X_POLL_INTERVAL_MAX 0xFFFFU
+#define W25X_POLL_INTERVAL_DIV 16U
+#define W25X_POLL_EARLY_DIV 4U
+#define W25X_POLL_AVG_WEIGHT 8
+
+typedef struct
+{
+    uint32_t avg_us;     /*!< Running average of the measured busy time */
+    uint32_t timeout_ms; /*!< Datasheet worst case */
+} w25qxx_poll_profile_t;
+
+enum
+{
+    W25X_OP_PROGRAM,
+    W25X_OP_SECTOR_ERASE,
+    W25X_OP_BLOCK_ERASE,
+    W25X_OP_CHIP_ERASE,
+    W25X_OP_NUM
+};
+
+/* Seeded with the datasheet typical times */
+static w25qxx_poll_profile_t poll_profiles[W25X_OP_NUM] = {
+    [W25X_OP_PROGRAM] = {W25X_tPP_TYP_US, W25X_tPP_MAX_MS},
+    [W25X_OP_SECTOR_ERASE] = {W25X_tSE_TYP_US, W25X_tSE_MAX_MS},
+    [W25X_OP_BLOCK_ERASE] = {W25X_tBE_TYP_US, W25X_tBE_MAX_MS},
+    [W25X_OP_CHIP_ERASE] = {W25X_tCE_TYP_US, W25X_tCE_MAX_MS},
+};
 
 static volatile int qspi_mode = 0;
 
+static HAL_StatusTypeDef w25qxx_command(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    telemetry_count_command();
+    qspi_trace_begin(cmd, QSPI_TRACE_COMMAND);
+    ret = HAL_QSPI_Command(hqspi, cmd, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+    if (cmd->DataMode == QSPI_DATA_NONE)
+    {
+        qspi_trace_end();
+    }
+
+    return ret;
+}
+
+static HAL_StatusTypeDef w25qxx_transmit(uint8_t *pData)
+{
+    HAL_StatusTypeDef ret = HAL_QSPI_Transmit(&hqspi, pData, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+
+    qspi_trace_end();
+
+    return ret;
+}
+
+static HAL_StatusTypeDef w25qxx_receive(uint8_t *pData)
+{
+    HAL_StatusTypeDef ret = HAL_QSPI_Receive(&hqspi, pData, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+
+    qspi_trace_end();
+
+    return ret;
+}
+
 static HAL_StatusTypeDef w25qxx_reset(QSPI_HandleTypeDef *hqspi)
 {
     QSPI_CommandTypeDef cmd = {0};
@@ -75,30 +147,33 @@ static HAL_StatusTypeDef w25qxx_reset(QSPI_HandleTypeDef *hqspi)
     cmd.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
     cmd.Instruction = W25X_EnableReset;
-    if (HAL_QSPI_Command(hqspi, &cmd, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+    if (w25qxx_command(hqspi, &cmd) != HAL_OK)
     {
         return HAL_ERROR;
     }
 
     cmd.Instruction = W25X_ResetDevice;
-    if (HAL_QSPI_Command(hqspi, &cmd, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+    if (w25qxx_command(hqspi, &cmd) != HAL_OK)
     {
         return HAL_ERROR;
     }
 
     cmd.InstructionMode = QSPI_INSTRUCTION_4_LINES;
     cmd.Instruction = W25X_EnableReset;
-    if (HAL_QSPI_Command(hqspi, &cmd, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+    if (w25qxx_command(hqspi, &cmd) != HAL_OK)
     {
         return HAL_ERROR;
     }
 
     cmd.Instruction = W25X_ResetDevice;
-    if (HAL_QSPI_Command(hqspi, &cmd, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+    if (w25qxx_command(hqspi, &cmd) != HAL_OK)
     {
         return HAL_ERROR;
     }
 
+    /* The device ignores commands until tRST has elapsed */
+    timebase_delay_us(W25X_tRST_US);
+
     return HAL_OK;
 }
 
@@ -123,7 +198,7 @@ static HAL_StatusTypeDef w25qxx_send_cmd(QSPI_HandleTypeDef *hqspi, uint32_t ins
     cmd.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
     cmd.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-    return HAL_QSPI_Command(hqspi, &cmd, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+    return w25qxx_command(hqspi, &cmd);
 }
 
 uint16_t w25qxx_get_id(void)
@@ -131,17 +206,33 @@ uint16_t w25qxx_get_id(void)
     uint8_t id[6];
 
     w25qxx_send_cmd(&hqspi, W25X_QUAD_ManufactDeviceID, 0x00, QSPI_ADDRESS_24_BITS, 6, QSPI_INSTRUCTION_1_LINE, QSPI_ADDRESS_4_LINES, QSPI_DATA_4_LINES, sizeof(id));
-    HAL_QSPI_Receive(&hqspi, id, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+    w25qxx_receive(id);
 
     return (id[0] << 8) | id[1];
 }
 
+static uint8_t w25qxx_get_manufacturer(void)
+{
+    uint8_t id[3] = {0};
+
+    if (w25qxx_send_cmd(&hqspi, W25X_JedecDeviceID, 0x00, QSPI_ADDRESS_8_BITS, 0, QSPI_INSTRUCTION_1_LINE, QSPI_ADDRESS_NONE, QSPI_DATA_1_LINE, sizeof(id)) != HAL_OK)
+    {
+        return 0;
+    }
+    if (w25qxx_receive(id) != HAL_OK)
+    {
+        return 0;
+    }
+
+    return id[0];
+}
+
 uint8_t w25qxx_read_sr(uint8_t addr)
 {
     uint8_t byte = 0;
 
     w25qxx_send_cmd(&hqspi, addr, 0x00, QSPI_ADDRESS_8_BITS, 0, QSPI_INSTRUCTION_1_LINE, QSPI_ADDRESS_NONE, QSPI_DATA_1_LINE, 1);
-    HAL_QSPI_Receive(&hqspi, &byte, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+    w25qxx_receive(&byte);
 
     return byte;
 }
@@ -150,7 +241,7 @@ uint8_t w25qxx_write_sr(uint8_t addr, uint8_t data)
 {
     w25qxx_send_cmd(&hqspi, addr, 0x00, QSPI_ADDRESS_8_BITS, 0, QSPI_INSTRUCTION_1_LINE, QSPI_ADDRESS_NONE, QSPI_DATA_1_LINE, 1);
 
-    return HAL_QSPI_Transmit(&hqspi, &data, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+    return w25qxx_transmit(&data);
 }
 
 static uint32_t w25qxx_write_enable(void)
@@ -169,7 +260,7 @@ static uint32_t w25qxx_write_enable(void)
     cmd.DdrMode = QSPI_DDR_MODE_DISABLE;
     cmd.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
     cmd.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
-    ret = HAL_QSPI_Command(&hqspi, &cmd, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+    ret = w25qxx_command(&hqspi, &cmd);
     if (ret != HAL_OK)
     {
         return ret;
@@ -180,25 +271,24 @@ static uint32_t w25qxx_write_enable(void)
     cfg.Mask = 0x02;
     cfg.MatchMode = QSPI_MATCH_MODE_AND;
     cfg.StatusBytesSize = 1;
-    cfg.Interval = 0x10;
+    cfg.Interval = W25X_POLL_INTERVAL_MIN;
     cfg.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE;
     cmd.Instruction = W25X_ReadStatusReg1;
     cmd.DataMode = QSPI_DATA_1_LINE;
 
-    return HAL_QSPI_AutoPolling(&hqspi, &cmd, &cfg, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
-}
+    telemetry_count_poll();
+    qspi_trace_begin(&cmd, QSPI_TRACE_POLL);
+    ret = HAL_QSPI_AutoPolling(&hqspi, &cmd, &cfg, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+    qspi_trace_end();
 
-void w25qxx_wait_free(void)
-{
-    while ((w25qxx_read_sr(W25X_ReadStatusReg1) & 0x01) == 0x01)
-    {
-    }
+    return ret;
 }
 
-static uint32_t w25qxx_auto_polling_memory_ready(QSPI_HandleTypeDef *hqspi, uint32_t timeout)
+static uint32_t w25qxx_auto_polling_memory_ready(QSPI_HandleTypeDef *hqspi, uint32_t interval, uint32_t timeout)
 {
     QSPI_CommandTypeDef cmd;
     QSPI_AutoPollingTypeDef cfg;
+    HAL_StatusTypeDef ret = HAL_OK;
 
     /* Configure automatic polling mode to wait for memory ready */
     cmd.InstructionMode = QSPI_INSTRUCTION_1_LINE;
@@ -216,28 +306,91 @@ static uint32_t w25qxx_auto_polling_memory_ready(QSPI_HandleTypeDef *hqspi, uint
     cfg.Match = 0;
     cfg.Mask = W25X_SR_WIP;
     cfg.MatchMode = QSPI_MATCH_MODE_AND;
-    cfg.Interval = 0x10;
+    cfg.Interval = interval;
     cfg.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE;
     cfg.StatusBytesSize = 1;
 
-    return HAL_QSPI_AutoPolling(hqspi, &cmd, &cfg, timeout);
+    telemetry_count_poll();
+    qspi_trace_begin(&cmd, QSPI_TRACE_POLL);
+    ret = HAL_QSPI_AutoPolling(hqspi, &cmd, &cfg, timeout);
+    qspi_trace_end();
+
+    return ret;
+}
+
+/**
+ * @brief  Wait for the end of a program/erase operation.
+ *         Most of the expected busy time is waited out without touching the
+ *         bus, the remainder is polled at an interval proportional to it. The
+ *         expectation tracks a running average of the times measured on this
+ *         particular chip.
+ */
+static HAL_StatusTypeDef w25qxx_wait_ready(w25qxx_poll_profile_t *profile)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t start = timebase_get_cycles();
+    uint32_t sck_mhz = HAL_RCC_GetHCLKFreq() / (hqspi.Init.ClockPrescaler + 1) / 1000000U;
+    uint32_t interval = (profile->avg_us / W25X_POLL_INTERVAL_DIV) * sck_mhz;
+    uint32_t elapsed = 0;
+
+    if (interval < W25X_POLL_INTERVAL_MIN)
+    {
+        interval = W25X_POLL_INTERVAL_MIN;
+    }
+    else if (interval > W25X_POLL_INTERVAL_MAX)
+    {
+        interval = W25X_POLL_INTERVAL_MAX;
+    }
+
+    timebase_delay_us(profile->avg_us - profile->avg_us / W25X_POLL_EARLY_DIV);
+    ret = w25qxx_auto_polling_memory_ready(&hqspi, interval, profile->timeout_ms);
+
+    if (ret == HAL_OK)
+    {
+        elapsed = timebase_cycles_to_us(timebase_get_cycles() - start);
+        if (elapsed > profile->timeout_ms * 1000U)
+        {
+            elapsed = profile->timeout_ms * 1000U;
+        }
+        profile->avg_us += (int32_t)(elapsed - profile->avg_us) / W25X_POLL_AVG_WEIGHT;
+    }
+
+    return ret;
+}
+
+static void w25qxx_set_quad_enable(void)
+{
+    uint8_t sr2 = w25qxx_read_sr(W25X_ReadStatusReg2);
+
+    /* QE is usually already set, skip the status register write entirely */
+    if (sr2 & W25X_SR2_QE)
+    {
+        return;
+    }
+
+#if W25QXX_QE_VOLATILE
+    /* Volatile write: takes effect immediately, no tW busy time and no SR wear */
+    w25qxx_send_cmd(&hqspi, W25X_VolatileSRWriteEnable, 0x00, QSPI_ADDRESS_8_BITS, 0, QSPI_INSTRUCTION_1_LINE, QSPI_ADDRESS_NONE, QSPI_DATA_NONE, 0);
+    w25qxx_write_sr(W25X_WriteStatusReg2, sr2 | W25X_SR2_QE);
+#else
+    w25qxx_write_enable();
+    w25qxx_write_sr(W25X_WriteStatusReg2, sr2 | W25X_SR2_QE);
+    w25qxx_auto_polling_memory_ready(&hqspi, W25X_POLL_INTERVAL_MIN, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+#endif
 }
 
 static void w25qxx_enter_qspi(void)
 {
     uint8_t data = (8 / 2 - 1) << 4 | ((8 / 8 - 1) & 0x03);
-    uint8_t ret = w25qxx_read_sr(W25X_ReadStatusReg2);
 
-    w25qxx_write_enable();
-    ret |= 0x2;
-    w25qxx_write_sr(W25X_WriteStatusReg2, ret);
+    w25qxx_set_quad_enable();
     w25qxx_send_cmd(&hqspi, W25X_EnterQSPIMode, 0x00, QSPI_ADDRESS_8_BITS, 0, QSPI_INSTRUCTION_1_LINE, QSPI_ADDRESS_NONE, QSPI_DATA_NONE, 0);
     /* Configure automatic polling mode to wait the memory is ready */
-    w25qxx_auto_polling_memory_ready(&hqspi, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+    w25qxx_auto_polling_memory_ready(&hqspi, W25X_POLL_INTERVAL_MIN, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
     /* Set read parameters */
     w25qxx_write_enable();
     w25qxx_send_cmd(&hqspi, W25X_SetReadParam, 0x00, QSPI_ADDRESS_8_BITS, 0, QSPI_INSTRUCTION_4_LINES, QSPI_ADDRESS_NONE, QSPI_DATA_4_LINES, 1);
-    HAL_QSPI_Transmit(&hqspi, &data, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+    w25qxx_transmit(&data);
 }
 
 HAL_StatusTypeDef w25qxx_enter_memory_mapped_mode(void)
@@ -245,6 +398,12 @@ HAL_StatusTypeDef w25qxx_enter_memory_mapped_mode(void)
     QSPI_CommandTypeDef cmd = {0};
     QSPI_MemoryMappedTypeDef cfg = {0};
 
+    /* Still mapped from an earlier call; HAL_QSPI_MemoryMapped() would
+     * answer HAL_BUSY */
+    if (HAL_QSPI_GetState(&hqspi) == HAL_QSPI_STATE_BUSY_MEM_MAPPED)
+    {
+        return HAL_OK;
+    }
     cmd.InstructionMode = QSPI_INSTRUCTION_1_LINE;
     cmd.Instruction = W25X_QUAD_INOUT_FAST_READ_CMD;
     cmd.AddressSize = QSPI_ADDRESS_24_BITS;
@@ -252,7 +411,7 @@ HAL_StatusTypeDef w25qxx_enter_memory_mapped_mode(void)
     cmd.Address = 0;
     cmd.AlternateByteMode = QSPI_ALTERNATE_BYTES_4_LINES;
     cmd.AlternateBytes = 0xFF;
-    cmd.AlternateBytesSize = 1;
+    cmd.AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
     cmd.DdrMode = QSPI_DDR_MODE_DISABLE;
     cmd.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
     cmd.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
@@ -262,12 +421,25 @@ HAL_StatusTypeDef w25qxx_enter_memory_mapped_mode(void)
     cfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_DISABLE;
     cfg.TimeOutPeriod = 0;
 
-    return HAL_QSPI_MemoryMapped(&hqspi, &cmd, &cfg);
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    telemetry_count_command();
+    qspi_trace_begin(&cmd, QSPI_TRACE_MEMORY_MAPPED);
+    ret = HAL_QSPI_MemoryMapped(&hqspi, &cmd, &cfg);
+    qspi_trace_end();
+
+    return ret;
 }
 
 HAL_StatusTypeDef w25qxx_exit_memory_mapped_mode(void)
 {
-    return HAL_QSPI_Abort(&hqspi);
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    qspi_trace_begin(NULL, QSPI_TRACE_ABORT);
+    ret = HAL_QSPI_Abort(&hqspi);
+    qspi_trace_end();
+
+    return ret;
 }
 
 void w25qxx_init(void)
@@ -277,13 +449,38 @@ void w25qxx_init(void)
     w25qxx_enter_qspi();
 }
 
+HAL_StatusTypeDef w25qxx_attach(void)
+{
+    /* The device only answers a single-line JEDEC read when it is in SPI mode */
+    if (w25qxx_get_manufacturer() != W25X_MANUFACTURER_ID)
+    {
+        return HAL_ERROR;
+    }
+
+    /* Nothing may be left running from the previous session */
+    if (w25qxx_read_sr(W25X_ReadStatusReg1) & W25X_SR_WIP)
+    {
+        return HAL_ERROR;
+    }
+
+    if ((w25qxx_read_sr(W25X_ReadStatusReg2) & W25X_SR2_QE) == 0)
+    {
+        return HAL_ERROR;
+    }
+
+    return HAL_OK;
+}
+
 HAL_StatusTypeDef w25qxx_erase_sector(uint32_t SectorAddress)
 {
     HAL_StatusTypeDef ret = HAL_OK;
 
     w25qxx_write_enable();
     ret = w25qxx_send_cmd(&hqspi, W25X_SectorErase, SectorAddress, QSPI_ADDRESS_24_BITS, 0, QSPI_INSTRUCTION_1_LINE, QSPI_ADDRESS_1_LINE, QSPI_DATA_NONE, 0);
-    w25qxx_wait_free();
+    if (ret == HAL_OK)
+    {
+        ret = w25qxx_wait_ready(&poll_profiles[W25X_OP_SECTOR_ERASE]);
+    }
 
     return ret;
 }
@@ -294,7 +491,10 @@ HAL_StatusTypeDef w25qxx_erase_block(uint32_t BlockAddress)
 
     w25qxx_write_enable();
     ret = w25qxx_send_cmd(&hqspi, W25X_BlockErase, BlockAddress, QSPI_ADDRESS_24_BITS, 0, QSPI_INSTRUCTION_1_LINE, QSPI_ADDRESS_1_LINE, QSPI_DATA_NONE, 0);
-    w25qxx_wait_free();
+    if (ret == HAL_OK)
+    {
+        ret = w25qxx_wait_ready(&poll_profiles[W25X_OP_BLOCK_ERASE]);
+    }
 
     return ret;
 }
@@ -305,7 +505,10 @@ HAL_StatusTypeDef w25qxx_erase_chip(void)
 
     w25qxx_write_enable();
     ret = w25qxx_send_cmd(&hqspi, W25X_ChipErase, 0x00, QSPI_ADDRESS_8_BITS, 0, QSPI_INSTRUCTION_1_LINE, QSPI_ADDRESS_NONE, QSPI_DATA_NONE, 0);
-    w25qxx_wait_free();
+    if (ret == HAL_OK)
+    {
+        ret = w25qxx_wait_ready(&poll_profiles[W25X_OP_CHIP_ERASE]);
+    }
 
     return ret;
 }
@@ -316,8 +519,14 @@ HAL_StatusTypeDef w25qxx_program_page(uint8_t *pData, uint32_t WriteAddr, uint32
 
     w25qxx_write_enable();
     ret = w25qxx_send_cmd(&hqspi, W25X_QUAD_INPUT_PAGE_PROG_CMD, WriteAddr, QSPI_ADDRESS_24_BITS, 0, QSPI_INSTRUCTION_1_LINE, QSPI_ADDRESS_1_LINE, QSPI_DATA_4_LINES, Size);
-    HAL_QSPI_Transmit(&hqspi, pData, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
-    w25qxx_wait_free();
+    if (ret == HAL_OK)
+    {
+        ret = w25qxx_transmit(pData);
+    }
+    if (ret == HAL_OK)
+    {
+        ret = w25qxx_wait_ready(&poll_profiles[W25X_OP_PROGRAM]);
+    }
 
     return ret;
 }
@@ -333,16 +542,20 @@ HAL_StatusTypeDef w25qxx_read(uint8_t *pData, uint32_t ReadAddr, uint32_t Size)
     cmd.AddressMode = QSPI_ADDRESS_4_LINES;
     cmd.AddressSize = QSPI_ADDRESS_24_BITS;
     cmd.Address = ReadAddr;
-    cmd.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+    /* M7-0 driven to 0xFF so the flash does not enter continuous read mode
+     * and take the next command as an address */
+    cmd.AlternateByteMode = QSPI_ALTERNATE_BYTES_4_LINES;
+    cmd.AlternateBytes = 0xFF;
+    cmd.AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
     cmd.DataMode = QSPI_DATA_4_LINES;
-    cmd.DummyCycles = 6U;
+    cmd.DummyCycles = 4U;
     cmd.NbData = Size;
     cmd.DdrMode = QSPI_DDR_MODE_DISABLE;
     cmd.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
     cmd.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
     /* Configure the command */
-    if (HAL_QSPI_Command(&hqspi, &cmd, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+    if (w25qxx_command(&hqspi, &cmd) != HAL_OK)
     {
         return HAL_ERROR;
     }
@@ -352,7 +565,7 @@ HAL_StatusTypeDef w25qxx_read(uint8_t *pData, uint32_t ReadAddr, uint32_t Size)
                QSPI_CS_HIGH_TIME_5_CYCLE);
 
     /* Reception of the data */
-    if (HAL_QSPI_Receive(&hqspi, pData, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+    if (w25qxx_receive(pData) != HAL_OK)
     {
         return HAL_ERROR;
     }
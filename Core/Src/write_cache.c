@@ -0,0 +1,103 @@
+#include <string.h>
+#include "write_cache.h"
+
+#if LOADER_WRITE_CACHE
+
+/* One page worth of pending data, [start, end) within the page at 'page'.
+ * Validated by a magic since the loader has no startup code to clear it,
+ * see manifest.c. */
+
+#define WRITE_CACHE_MAGIC 0x45484357 /* "WCHE" */
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t page;         /*!< Flash offset of the cached page */
+    uint32_t start;
+    uint32_t end;
+    uint8_t data[MEMORY_PAGE_SIZE];
+} write_cache_t;
+
+static write_cache_t cache;
+
+/**
+ * @brief  Drop the pending partial page without programming it. Called by a
+ *         full Init(), the page belongs to a session that ended with a reset.
+ */
+void write_cache_reset(void)
+{
+    cache.magic = 0;
+}
+
+/**
+ * @brief  Program the pending partial page, if any.
+ * @retval HAL status of the page program, HAL_OK when nothing was pending
+ */
+HAL_StatusTypeDef write_cache_flush(void)
+{
+    if (cache.magic != WRITE_CACHE_MAGIC)
+    {
+        return HAL_OK;
+    }
+
+    /* Dropped even on failure, the error is reported once */
+    cache.magic = 0;
+    w25qxx_exit_memory_mapped_mode();
+
+    return w25qxx_program_page(&cache.data[cache.start], cache.page + cache.start, cache.end - cache.start);
+}
+
+/**
+ * @brief  w25qxx_write() with partial pages held back until complete.
+ * @param  buffer: data to program
+ * @param  offset: flash offset
+ * @param  size: number of bytes
+ * @retval HAL status of the page programs issued by this call
+ */
+HAL_StatusTypeDef write_cache_write(uint8_t *buffer, uint32_t offset, uint32_t size)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t n;
+
+    if (cache.magic == WRITE_CACHE_MAGIC && offset != cache.page + cache.end)
+    {
+        ret = write_cache_flush();
+    }
+
+    while (ret == HAL_OK && size)
+    {
+        if (cache.magic == WRITE_CACHE_MAGIC)
+        {
+            /* Continues the cached page */
+            n = MEMORY_PAGE_SIZE - cache.end;
+            n = (n < size) ? n : size;
+            memcpy(&cache.data[cache.end], buffer, n);
+            cache.end += n;
+            if (cache.end == MEMORY_PAGE_SIZE)
+            {
+                ret = write_cache_flush();
+            }
+        }
+        else if (offset % MEMORY_PAGE_SIZE == 0 && size >= MEMORY_PAGE_SIZE)
+        {
+            /* Whole pages go straight to the flash */
+            n = size - size % MEMORY_PAGE_SIZE;
+            ret = w25qxx_write(buffer, offset, n);
+        }
+        else
+        {
+            cache.page = offset - offset % MEMORY_PAGE_SIZE;
+            cache.start = offset % MEMORY_PAGE_SIZE;
+            cache.end = cache.start;
+            cache.magic = WRITE_CACHE_MAGIC;
+            continue;
+        }
+        buffer += n;
+        offset += n;
+        size -= n;
+    }
+
+    return ret;
+}
+
+#endif
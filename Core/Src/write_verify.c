@@ -0,0 +1,168 @@
+#include <string.h>
+#include "write_verify.h"
+
+#if LOADER_WRITE_VERIFY
+
+/* Located by the host through this symbol, validated by its magic */
+write_verify_t write_verify __attribute__((__used__));
+
+static uint8_t readback[MEMORY_PAGE_SIZE];
+
+/* Over everything but the check word, so a block that survived a
+ * reset or an application run is not taken for the loader's */
+static uint32_t write_verify_sum(void)
+{
+    uint32_t sum = write_verify.magic ^ write_verify.count;
+
+    for (uint32_t i = 0; i < write_verify.count && i < WRITE_VERIFY_RANGES; i++)
+    {
+        sum = (sum << 5 | sum >> 27) ^ write_verify.range[i].start;
+        sum = (sum << 5 | sum >> 27) ^ write_verify.range[i].end;
+    }
+
+    return sum;
+}
+
+static void write_verify_open(void)
+{
+    if (write_verify.magic != WRITE_VERIFY_MAGIC)
+    {
+        memset(&write_verify, 0, sizeof(write_verify));
+        write_verify.magic = WRITE_VERIFY_MAGIC;
+    }
+}
+
+static void write_verify_add(uint32_t start, uint32_t end)
+{
+    uint32_t last = write_verify.count - 1;
+
+    if (write_verify.count && write_verify.range[last].end == start)
+    {
+        write_verify.range[last].end = end;
+    }
+    else if (write_verify.count < WRITE_VERIFY_RANGES)
+    {
+        write_verify.range[write_verify.count].start = start;
+        write_verify.range[write_verify.count].end = end;
+        write_verify.count++;
+    }
+    /* Otherwise the range is simply not remembered and gets a full Verify() */
+    write_verify.check = write_verify_sum();
+}
+
+/**
+ * @brief  Forget all verified ranges.
+ * @retval None
+ */
+void write_verify_reset(void)
+{
+    write_verify.magic = 0;
+}
+
+/**
+ * @brief  Keep the verified ranges when Init() reattaches to a target that
+ *         was not reset since, as STM32CubeProgrammer calls Init() before
+ *         Verify(). A block that does not check out is dropped.
+ * @retval None
+ */
+void write_verify_attach(void)
+{
+    if (write_verify.magic != WRITE_VERIFY_MAGIC || write_verify.count > WRITE_VERIFY_RANGES ||
+        write_verify.check != write_verify_sum())
+    {
+        write_verify.magic = 0;
+    }
+}
+
+/**
+ * @brief  Program a range page by page, reading every page back right
+ *         after it is programmed. Remembers the range when all pages match.
+ * @param  buffer: data to program
+ * @param  address: start address in the memory-mapped window
+ * @param  size: number of bytes
+ * @retval HAL_ERROR on the first mismatch (write_verify.fail_address)
+ */
+HAL_StatusTypeDef write_verify_write(uint8_t *buffer, uint32_t address, uint32_t size)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t done = 0;
+
+    write_verify_open();
+    write_verify_forget(address, size);
+    write_verify.fail_address = 0;
+    while (ret == HAL_OK && done < size)
+    {
+        uint32_t offset = address - MEMORY_BASE_ADDR + done;
+        uint32_t chunk = MEMORY_PAGE_SIZE - offset % MEMORY_PAGE_SIZE;
+
+        chunk = (chunk < size - done) ? chunk : size - done;
+        ret = rmw_write(buffer + done, offset, chunk);
+        if (ret == HAL_OK)
+        {
+            ret = w25qxx_read(readback, offset, chunk);
+        }
+        if (ret == HAL_OK && memcmp(readback, buffer + done, chunk) != 0)
+        {
+            write_verify.fail_address = address + done;
+            ret = HAL_ERROR;
+        }
+        done += chunk;
+    }
+    if (ret == HAL_OK)
+    {
+        write_verify_add(address, address + size);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief  Drop the verified ranges overlapping a range about to change.
+ * @param  address: start address in the memory-mapped window
+ * @param  size: length in bytes
+ * @retval None
+ */
+void write_verify_forget(uint32_t address, uint32_t size)
+{
+    uint32_t kept = 0;
+
+    if (write_verify.magic != WRITE_VERIFY_MAGIC)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < write_verify.count; i++)
+    {
+        if (write_verify.range[i].end <= address || write_verify.range[i].start >= address + size)
+        {
+            write_verify.range[kept++] = write_verify.range[i];
+        }
+    }
+    write_verify.count = kept;
+    write_verify.check = write_verify_sum();
+}
+
+/**
+ * @brief  Check whether a range was verified by Write() and not changed
+ *         since.
+ * @param  address: start address in the memory-mapped window
+ * @param  size: length in bytes
+ * @retval 1 if covered by a single verified range
+ */
+uint32_t write_verify_covered(uint32_t address, uint32_t size)
+{
+    if (write_verify.magic != WRITE_VERIFY_MAGIC)
+    {
+        return 0;
+    }
+    for (uint32_t i = 0; i < write_verify.count; i++)
+    {
+        if (write_verify.range[i].start <= address && address + size <= write_verify.range[i].end)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#endif
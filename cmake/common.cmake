@@ -1,5 +1,7 @@
 cmake_minimum_required(VERSION 3.22)
 
+# Bytes per host Write() / SEGGER_FL_Program() call, see MEMORY_TRANSFER_PAGE_SIZE
+set(LOADER_TRANSFER_PAGE_SIZE 0x2000 CACHE STRING "Advertised program page size, multiple of 256, 256 to 65536")
 
 set(COMMON_INC 
     ${CMAKE_SOURCE_DIR}/Core/Inc
@@ -37,6 +39,19 @@ set(COMMON_SRC
     ${CMAKE_SOURCE_DIR}/Core/Src/sysmem.c
     ${CMAKE_SOURCE_DIR}/Core/Src/syscalls.c
     ${CMAKE_SOURCE_DIR}/Core/Src/w25qxx.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/timebase.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/telemetry.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/qspi_trace.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/call_trace.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/crc32_hw.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/manifest.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/lz_decode.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/write_cache.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/rmw.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/sector_map.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/mass_erase.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/write_verify.c
+    ${CMAKE_SOURCE_DIR}/Core/Src/verify_policy.c
 )
 
 
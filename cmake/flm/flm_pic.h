@@ -0,0 +1,9 @@
+#pragma once
+
+/* Force-included into every FLM source (cmake/flm/CMakeLists.txt).
+ * With -fPIC, symbols of default visibility are reached through GOT
+ * entries, which the static link fills with their link address, 0 based
+ * here. Hidden symbols are reached PC-relative, which holds wherever the
+ * host loads the algorithm. The pragma also covers extern declarations,
+ * -fvisibility=hidden would not. */
+#pragma GCC visibility push(hidden)
@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""Replay a recorded host session (Core/Inc/call_trace.h) against the
+loader sources built for the host (loader_host.py).
+
+Build the loader with LOADER_CALL_TRACE=1, run a real STM32CubeProgrammer
+or J-Link session, dump the DIAG region and replay it:
+
+    STM32_Programmer_CLI -c port=SWD mode=HOTPLUG -u 0x2000E000 0x2000 diag.bin
+    call_replay.py diag.bin --image firmware.bin
+    call_replay.py diag.bin -D LOADER_LAZY_ERASE=1
+
+Write and Verify calls take their data from --image (placed at the flash
+base address) or from a seeded random stream. The report compares the
+simulated time of every entry point with the cycles recorded on target,
+which is how a loader change, or a build option given with -D, can be
+evaluated against the exact call pattern a host tool produces.
+"""
+
+import argparse
+import os
+import random
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from loader_host import Loader  # noqa: E402
+from lz_pack import compress  # noqa: E402
+from telemetry_decode import OPS  # noqa: E402
+
+MAGIC = 0x4C4C4143
+VERSION = 1
+
+HEADER = struct.Struct("<8I")
+RECORD = struct.Struct("<BBH5I")
+
+
+def find_calls(data):
+    for off in range(0, len(data) - HEADER.size + 1, 4):
+        magic, version = struct.unpack_from("<2I", data, off)
+        if magic == MAGIC and version == VERSION:
+            return off
+    raise ValueError("no call trace block found")
+
+
+def decode(data):
+    off = find_calls(data)
+    _, _, depth, count, dropped, clock = HEADER.unpack_from(data, off)[:6]
+    records = []
+    for n in range(min(count, depth)):
+        op, status, _, address, size, arg, repeat, cycles = RECORD.unpack_from(
+            data, off + HEADER.size + n * RECORD.size)
+        records.append({"op": op, "status": status, "address": address, "size": size,
+                        "arg": arg, "repeat": repeat, "cycles": cycles})
+    return clock, dropped, records
+
+
+class Source:
+    """Provides the bytes the host wrote, from an image or a random stream."""
+
+    def __init__(self, base, image=None, seed=0):
+        self.base = base
+        self.image = image
+        self.rng = random.Random(seed)
+        self.cache = {}
+
+    def get(self, addr, size):
+        if self.image is not None:
+            off = addr - self.base
+            chunk = self.image[max(off, 0):off + size]
+            return chunk + b"\xFF" * (size - len(chunk))
+        key = (addr, size)
+        if key not in self.cache:
+            self.cache[key] = bytes(self.rng.getrandbits(8) for _ in range(size))
+        return self.cache[key]
+
+
+class NotReplayable(Exception):
+    pass
+
+
+def call(loader, source, name, address, size, arg):
+    if name == "Init":
+        loader.Init()
+    elif name == "Write":
+        loader.Write(address, source.get(address, size))
+    elif name == "Read":
+        loader.Read(address, size)
+    elif name == "SectorErase":
+        loader.SectorErase(address, address + size - 1)
+    elif name == "MassErase":
+        loader.MassErase()
+    elif name == "CheckSum":
+        loader.CheckSum(address, size, arg)
+    elif name == "Verify":
+        loader.Verify(address, source.get(address, size))
+    elif name == "SEGGER_FL_Erase":
+        loader.SEGGER_FL_Erase(address, arg, size)
+    elif name == "SEGGER_FL_Verify":
+        loader.SEGGER_FL_Verify(address, source.get(address, size))
+    elif name == "SEGGER_FL_CheckBlank":
+        loader.SEGGER_FL_CheckBlank(address, size, arg & 0xFF)
+    elif name == "SEGGER_FL_CalcCRC":
+        loader.SEGGER_FL_CalcCRC(0, address, size, arg)
+    elif name == "SectorCrc":
+        loader.SectorCrc(address, size)
+    elif name == "Fill":
+        loader.Fill(address, size, source.get(address, arg))
+    elif name in ("Batch", "StreamStart"):
+        # The descriptors / streamed blocks are not part of the trace
+        raise NotReplayable(name)
+    elif name == "WriteCompressed":
+        loader.WriteCompressed(address, compress(source.get(address, arg)))
+    else:
+        raise ValueError("unknown entry point %s" % name)
+
+
+def replay(records, loader, source):
+    """Re-executes the records, returns per entry point statistics."""
+    stats = {}
+    for r in records:
+        name = OPS[r["op"]] if r["op"] < len(OPS) else "op%d" % r["op"]
+        s = stats.setdefault(name, {"calls": 0, "bytes": 0, "sim_us": 0.0, "cycles": 0})
+        # Only byte ranges advance between merged calls (see call_trace_end)
+        step = 0 if name == "SEGGER_FL_Erase" else r["size"]
+        for i in range(r["repeat"]):
+            before = loader.time_us
+            try:
+                call(loader, source, name, r["address"] + i * step, r["size"], r["arg"])
+            except NotReplayable:
+                s["skipped"] = s.get("skipped", 0) + 1
+            s["sim_us"] += loader.time_us - before
+        s["calls"] += r["repeat"]
+        if name != "SEGGER_FL_Erase":
+            s["bytes"] += r["repeat"] * r["size"]
+        s["cycles"] += r["cycles"]
+    return stats
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", help="binary dump containing the call trace block")
+    parser.add_argument("--image", help="binary image written by the session")
+    parser.add_argument("--seed", type=int, default=0, help="seed for random write data")
+    parser.add_argument("--attached", action="store_true",
+                        help="start with the flash already configured (fast Init)")
+    parser.add_argument("-D", dest="defines", action="append", default=[], help="build option, as for the compiler")
+    args = parser.parse_args()
+
+    with open(args.dump, "rb") as f:
+        clock, dropped, records = decode(f.read())
+    image = None
+    if args.image:
+        with open(args.image, "rb") as f:
+            image = f.read()
+
+    loader = Loader(args.defines)
+    if args.attached:
+        loader.Init()
+        loader.reset_stats()
+    source = Source(loader.geo.base, image, args.seed)
+    stats = replay(records, loader, source)
+
+    mhz = clock / 1e6 if clock else 80.0
+    print("%-22s %8s %10s %12s %12s" % ("entry point", "calls", "bytes", "target ms", "sim ms"))
+    total_target = total_sim = 0.0
+    for name, s in stats.items():
+        target = s["cycles"] / mhz / 1000
+        sim = s["sim_us"] / 1000
+        total_target += target
+        total_sim += sim
+        print("%-22s %8d %10d %12.3f %12.3f%s" % (name, s["calls"], s["bytes"], target, sim,
+                                                  "  (not replayed)" if s.get("skipped") else ""))
+    print("%-22s %8s %10s %12.3f %12.3f" % ("total", "", "", total_target, total_sim))
+    if dropped:
+        print("warning: %d calls were dropped, the trace table was full" % dropped)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,48 @@
+/* Stand-in for cmsis_gcc.h when the loader sources are built for the host
+ * (tools/loader_host.py passes it with -include). Claiming the include guard
+ * keeps the Cortex-M inline assembly out; the intrinsics the sources use
+ * become barriers or no-ops, and __disable_irq() ends the call through
+ * host_halt() since the only caller is Error_Handler(). */
+
+#ifndef CMSIS_HOST_H
+#define CMSIS_HOST_H
+
+#define __CMSIS_GCC_H
+
+#include <stdint.h>
+
+#define __ASM __asm
+#define __INLINE inline
+#define __STATIC_INLINE static inline
+#define __STATIC_FORCEINLINE __attribute__((always_inline)) static inline
+#define __NO_RETURN __attribute__((__noreturn__))
+#define __USED __attribute__((used))
+#define __WEAK __attribute__((weak))
+#define __PACKED __attribute__((packed, aligned(1)))
+#define __PACKED_STRUCT struct __attribute__((packed, aligned(1)))
+#define __PACKED_UNION union __attribute__((packed, aligned(1)))
+#define __ALIGNED(x) __attribute__((aligned(x)))
+#define __RESTRICT __restrict
+#define __COMPILER_BARRIER() __asm volatile("" ::: "memory")
+
+void host_halt(const char *reason) __attribute__((__noreturn__));
+
+#define __disable_irq() host_halt("Error_Handler")
+#define __enable_irq() ((void)0)
+#define __get_PRIMASK() 0U
+#define __set_PRIMASK(x) ((void)(x))
+#define __get_BASEPRI() 0U
+#define __set_BASEPRI(x) ((void)(x))
+#define __get_FPSCR() 0U
+#define __set_FPSCR(x) ((void)(x))
+#define __NOP() ((void)0)
+#define __WFI() ((void)0)
+#define __WFE() ((void)0)
+#define __SEV() ((void)0)
+#define __ISB() __COMPILER_BARRIER()
+#define __DSB() __COMPILER_BARRIER()
+#define __DMB() __COMPILER_BARRIER()
+#define __REV(x) __builtin_bswap32(x)
+#define __CLZ(x) (uint8_t)((x) ? __builtin_clz(x) : 32)
+
+#endif
@@ -0,0 +1,384 @@
+#!/usr/bin/env python3
+"""Turn an image into a minimal W25Q programming plan.
+
+Takes a BIN, Intel HEX or ELF image and, optionally, what the flash holds
+now: a full dump (--current) or per-sector CRC-32 values (--crcs, a JSON
+list, {"sector_size": N, "crcs": [...]} or the raw table written by the
+loader's SectorCrc entry point; CRC-32 as computed by zlib) or a dump of
+the manifest sector kept by a LOADER_MANIFEST build (--manifest, read
+from the last sector of the memory-mapped window).
+Prints a JSON plan with
+
+  * the erase set as 4K sector erases, or one chip erase when that is
+    cheaper with the W25Q erase times; these are the erases the loader's
+    SectorErase / MassErase entry points and Batch() operations issue
+  * the pages to program, merged into contiguous runs; pages that are
+    all 0xFF after erase or already hold the right data are skipped
+  * estimated times from the w25q_model bus model, next to a baseline that
+    erases every touched sector and programs the whole image
+
+Bytes of a touched sector outside the image are preserved when their
+current value is known. Geometry comes from w25qxx.h, or from the
+StorageInfo / FlashDevice descriptor of a built loader with --loader.
+
+    flash_plan.py firmware.hex --current dump.bin -o plan.json
+
+With --batch PREFIX the plan is also written as input for the loader's
+Batch() entry point: PREFIX.ops holds the batch_op_t descriptors (erase,
+program and verify for every run) and PREFIX.data the buffer they refer to.
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+import zlib
+from concurrent.futures import ProcessPoolExecutor
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from loader_inspect import Elf  # noqa: E402
+from loader_host import (BATCH_ERASE, BATCH_MASS_ERASE, BATCH_PROGRAM,  # noqa: E402
+                         BATCH_VERIFY)
+from w25q_model import Flash, Geometry, Timing  # noqa: E402
+
+ERASED = 0xFF
+
+
+# -- image loading -------------------------------------------------------------
+
+def load_hex(path):
+    segments = []
+    upper = 0
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            if not line.startswith(":"):
+                raise ValueError("%s:%d: not an Intel HEX record" % (path, n))
+            raw = bytes.fromhex(line[1:])
+            if sum(raw) & 0xFF:
+                raise ValueError("%s:%d: bad checksum" % (path, n))
+            count, offset, kind = raw[0], (raw[1] << 8) | raw[2], raw[3]
+            data = raw[4:4 + count]
+            if kind == 0:
+                segments.append((upper + offset, data))
+            elif kind == 1:
+                break
+            elif kind == 2:
+                upper = ((data[0] << 8) | data[1]) << 4
+            elif kind == 4:
+                upper = ((data[0] << 8) | data[1]) << 16
+    return segments
+
+
+def load_elf(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+        raise ValueError("not a little-endian ELF32 file")
+    phoff, = struct.unpack_from("<I", data, 0x1C)
+    phentsize, phnum = struct.unpack_from("<2H", data, 0x2A)
+    segments = []
+    for i in range(phnum):
+        ptype, offset, _, paddr, filesz = struct.unpack_from("<5I", data, phoff + i * phentsize)
+        if ptype == 1 and filesz:  # PT_LOAD
+            segments.append((paddr, data[offset:offset + filesz]))
+    return segments
+
+
+def load_image(path, base):
+    ext = os.path.splitext(path)[1].lower()
+    if ext in (".hex", ".ihex"):
+        return load_hex(path)
+    if ext in (".elf", ".axf", ".out"):
+        return load_elf(path)
+    with open(path, "rb") as f:
+        return [(base, f.read())]
+
+
+def storage_geometry(path):
+    """Geometry advertised by a built loader, so the plan matches what the
+    host will see."""
+    elf = Elf(path)
+    geo = Geometry()
+    if "StorageInfo" in elf.symbols:
+        raw = elf.read(elf.symbols["StorageInfo"][0], 128)
+        _, geo.base, geo.size, geo.transfer, geo.erase_value = struct.unpack_from("<H2xIIIB", raw, 100)
+        geo.sector = struct.unpack_from("<2I", raw, 120)[1]
+    elif "FlashDevice" in elf.symbols:
+        raw = elf.read(elf.symbols["FlashDevice"][0], 168)
+        _, geo.base, geo.size, geo.transfer, _, geo.erase_value, _, _, geo.sector, _ = struct.unpack_from(
+            "<HIIIIB3xIIII", raw, 130)
+    else:
+        raise ValueError("%s has no StorageInfo or FlashDevice descriptor" % path)
+    return geo
+
+
+# -- per-sector analysis -------------------------------------------------------
+
+def analyse_sector(job):
+    """Classifies one sector. Runs in a worker process."""
+    index, target, mask, current, crc, page = job
+    size = len(target)
+    result = {"index": index, "action": "none", "pages": [], "blank": False}
+    touched = any(mask)
+
+    if current is None and crc is not None:
+        blank = bytes([ERASED]) * size
+        if crc == zlib.crc32(blank):
+            current = blank
+        elif all(mask) and crc == zlib.crc32(target):
+            current = target
+    if current is not None:
+        result["blank"] = current.count(ERASED) == size
+    if not touched:
+        return result
+
+    if current is None:
+        desired = bytes(t if m else ERASED for t, m in zip(target, mask))
+        result["action"] = "erase"
+    else:
+        desired = bytes(t if m else c for t, m, c in zip(target, mask, current))
+        want = int.from_bytes(desired, "little")
+        have = int.from_bytes(current, "little")
+        if want == have:
+            result["action"] = "skip"
+            return result
+        result["action"] = "program" if want & have == want else "erase"
+
+    for off in range(0, size, page):
+        chunk = desired[off:off + page]
+        if result["action"] == "erase":
+            needed = chunk.count(ERASED) != len(chunk)
+        else:
+            needed = chunk != current[off:off + page]
+        if needed:
+            result["pages"].append(off)
+    return result
+
+
+def analyse(geo, segments, current=None, crcs=None, jobs=None):
+    target = bytearray([ERASED]) * geo.size
+    mask = bytearray(geo.size)
+    for addr, data in segments:
+        off = addr - geo.base
+        if off < 0 or off + len(data) > geo.size:
+            raise ValueError("image data at 0x%08X-0x%08X is outside the flash" % (addr, addr + len(data) - 1))
+        target[off:off + len(data)] = data
+        mask[off:off + len(data)] = b"\x01" * len(data)
+
+    work = []
+    for i in range(geo.size // geo.sector):
+        lo, hi = i * geo.sector, (i + 1) * geo.sector
+        work.append((i, bytes(target[lo:hi]), bytes(mask[lo:hi]),
+                     current[lo:hi] if current is not None else None,
+                     crcs[i] if crcs is not None else None, geo.page))
+    if jobs == 1:
+        results = list(map(analyse_sector, work))
+    else:
+        with ProcessPoolExecutor(max_workers=jobs) as pool:
+            results = list(pool.map(analyse_sector, work, chunksize=16))
+    return target, mask, results
+
+
+# -- planning ------------------------------------------------------------------
+
+def plan_erases(geo, timing, results):
+    """Sector erases for the sectors that need erasing, or a chip erase when
+    that is cheaper and every other sector is known to be blank. Block
+    erases are not planned, no loader entry point issues them."""
+    need = [r["action"] == "erase" for r in results]
+    free = [n or (r["action"] == "none" and r["blank"]) for n, r in zip(need, results)]
+    if not any(need):
+        return []
+    if all(free) and timing.tCE < sum(need) * timing.tSE:
+        return [{"op": "chip", "address": geo.base, "size": geo.size}]
+
+    return [{"op": "sector", "address": geo.base + i * geo.sector, "size": geo.sector}
+            for i, n in enumerate(need) if n]
+
+
+def page_runs(geo, results):
+    runs = []
+    for r in results:
+        for off in r["pages"]:
+            addr = geo.base + r["index"] * geo.sector + off
+            if runs and runs[-1]["address"] + runs[-1]["size"] == addr:
+                runs[-1]["size"] += geo.page
+            else:
+                runs.append({"address": addr, "size": geo.page})
+    return runs
+
+
+def estimate(geo, timing, erases, runs, target):
+    flash = Flash(geometry=geo, timing=timing)
+    for e in erases:
+        off = e["address"] - geo.base
+        if e["op"] == "chip":
+            flash.erase_chip()
+        else:
+            flash.erase_sector(off)
+    erase_us = flash.time_us
+    for run in runs:
+        off = run["address"] - geo.base
+        flash.write(off, target[off:off + run["size"]])
+    return {"erase_us": round(erase_us), "program_us": round(flash.time_us - erase_us),
+            "total_us": round(flash.time_us)}
+
+
+def baseline(geo, timing, mask, target):
+    """Erase every touched sector and program the whole image span."""
+    flash = Flash(geometry=geo, timing=timing)
+    for i in range(geo.size // geo.sector):
+        if any(mask[i * geo.sector:(i + 1) * geo.sector]):
+            flash.erase_sector(i * geo.sector)
+    used = [i for i in range(0, geo.size, geo.page) if any(mask[i:i + geo.page])]
+    for off in used:
+        flash.program_page(off, target[off:off + geo.page])
+    return round(flash.time_us)
+
+
+def make_plan(geo, segments, current=None, crcs=None, worst=False, jobs=None):
+    timing = Timing(worst=worst)
+    target, mask, results = analyse(geo, segments, current, crcs, jobs)
+    erases = plan_erases(geo, timing, results)
+    runs = page_runs(geo, results)
+    touched_pages = sum(1 for i in range(0, geo.size, geo.page) if any(mask[i:i + geo.page]))
+    programmed = sum(len(r["pages"]) for r in results)
+    return target, {
+        "geometry": {"base": geo.base, "size": geo.size, "page": geo.page, "transfer": geo.transfer,
+                     "sector": geo.sector, "block": geo.block, "erase_value": geo.erase_value},
+        "erase": erases,
+        "program": runs,
+        "stats": {
+            "touched_sectors": sum(r["action"] != "none" for r in results),
+            "skipped_sectors": sum(r["action"] == "skip" for r in results),
+            "erased_sectors": sum(r["action"] == "erase" for r in results),
+            "programmed_pages": programmed,
+            "skipped_pages": max(touched_pages - programmed, 0),
+            "write_calls": sum(-(-run["size"] // geo.transfer) for run in runs),
+        },
+        "estimate": dict(estimate(geo, timing, erases, runs, target), baseline_us=baseline(geo, timing, mask, target),
+                         timing="worst" if worst else "typical"),
+    }
+
+
+MANIFEST_MAGIC = 0x544E464D
+MANIFEST_VERSION = 1
+MANIFEST_HEADER = struct.Struct("<8I")
+
+
+def load_manifest(path, geo):
+    """Per-sector CRCs from a manifest dump (Core/Inc/manifest.h). Shrinks
+    geo to the data area the manifest covers."""
+    with open(path, "rb") as f:
+        raw = f.read()
+    magic, version, generation, sector, count, table_crc, stale, _ = MANIFEST_HEADER.unpack_from(raw)
+    if magic != MANIFEST_MAGIC or version != MANIFEST_VERSION:
+        raise ValueError("%s: no manifest found" % path)
+    if stale != 0xFFFFFFFF:
+        raise ValueError("%s: manifest generation %d is stale, the last session did not complete" % (path, generation))
+    if sector != geo.sector:
+        raise ValueError("manifest uses %d byte sectors, flash has %d" % (sector, geo.sector))
+    table = raw[MANIFEST_HEADER.size:MANIFEST_HEADER.size + 4 * count]
+    if len(table) != 4 * count or zlib.crc32(table) != table_crc:
+        raise ValueError("%s: manifest table is corrupt" % path)
+    geo.size = count * sector
+    return list(struct.unpack("<%dI" % count, table)), generation
+
+
+BATCH_OP = struct.Struct("<5I")
+
+
+def batch(plan, target):
+    """Batch() descriptors and data buffer for a plan."""
+    base = plan["geometry"]["base"]
+    ops = []
+    data = bytearray()
+    for e in plan["erase"]:
+        if e["op"] == "chip":
+            ops.append((BATCH_MASS_ERASE, 0, 0, 0, 0))
+        else:
+            ops.append((BATCH_ERASE, e["address"], e["size"], 0, 0))
+    for run in plan["program"]:
+        off = run["address"] - base
+        ops.append((BATCH_PROGRAM, run["address"], run["size"], len(data), 0))
+        ops.append((BATCH_VERIFY, run["address"], run["size"], len(data), 0))
+        data += target[off:off + run["size"]]
+    return b"".join(BATCH_OP.pack(*op) for op in ops), bytes(data)
+
+
+def load_crcs(path, geo):
+    with open(path, "rb") as f:
+        raw = f.read()
+    try:
+        doc = json.loads(raw)
+    except ValueError:
+        # SectorCrc table dumped from target RAM
+        doc = list(struct.unpack("<%dI" % (len(raw) // 4), raw[:len(raw) // 4 * 4]))
+    if isinstance(doc, dict):
+        if doc.get("sector_size", geo.sector) != geo.sector:
+            raise ValueError("CRC table uses %d byte sectors, flash has %d" % (doc["sector_size"], geo.sector))
+        doc = doc["crcs"]
+    if len(doc) != geo.size // geo.sector:
+        raise ValueError("CRC table has %d entries, expected %d" % (len(doc), geo.size // geo.sector))
+    return [int(c, 0) if isinstance(c, str) else c for c in doc]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="BIN, HEX or ELF image")
+    parser.add_argument("--base", type=lambda s: int(s, 0), help="load address of a BIN image (default: flash base)")
+    state = parser.add_mutually_exclusive_group()
+    state.add_argument("--current", help="dump of the current flash contents")
+    state.add_argument("--crcs", help="JSON per-sector CRC-32 of the current flash contents")
+    state.add_argument("--manifest", help="dump of the manifest sector (LOADER_MANIFEST builds)")
+    state.add_argument("--assume-blank", action="store_true", help="treat the flash as fully erased")
+    parser.add_argument("--loader", help="take the geometry from a built .stldr / .SFL")
+    parser.add_argument("--worst", action="store_true", help="use worst-case instead of typical timing")
+    parser.add_argument("-j", "--jobs", type=int, help="worker processes for sector hashing (default: all cores)")
+    parser.add_argument("-o", "--output", help="write the plan here instead of stdout")
+    parser.add_argument("--batch", metavar="PREFIX", help="also write PREFIX.ops / PREFIX.data for Batch()")
+    args = parser.parse_args()
+
+    try:
+        geo = storage_geometry(args.loader) if args.loader else Geometry()
+        segments = load_image(args.image, args.base if args.base is not None else geo.base)
+        current = crcs = None
+        if args.current:
+            with open(args.current, "rb") as f:
+                current = f.read()
+            if len(current) != geo.size:
+                raise ValueError("flash dump is %d bytes, expected %d" % (len(current), geo.size))
+        elif args.crcs:
+            crcs = load_crcs(args.crcs, geo)
+        elif args.manifest:
+            crcs, generation = load_manifest(args.manifest, geo)
+        elif args.assume_blank:
+            current = bytes([ERASED]) * geo.size
+        target, plan = make_plan(geo, segments, current, crcs, args.worst, args.jobs)
+        if args.batch:
+            ops, data = batch(plan, target)
+            with open(args.batch + ".ops", "wb") as f:
+                f.write(ops)
+            with open(args.batch + ".data", "wb") as f:
+                f.write(data)
+            plan["batch"] = {"ops": len(ops) // BATCH_OP.size, "data_size": len(data)}
+        if args.manifest:
+            plan["manifest_generation"] = generation
+    except (OSError, ValueError, struct.error) as e:
+        sys.exit(str(e))
+
+    text = json.dumps(plan, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
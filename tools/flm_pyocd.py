@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Turn the built W25Q16_STM32L4xx_FLM.FLM into a pyOCD flash_algo dict.
+
+pyOCD can load the .FLM directly from a CMSIS pack, but then it uses a
+single page buffer. The dict printed here lists both __page_buffer0 and
+__page_buffer1 from the linker script, so pyOCD downloads the next
+FLM_PAGE_SIZE page while ProgramPage() programs the previous one.
+
+The algorithm is position independent with PrgCode at 0 (see
+cmake/flm/flm_linker.ld). pyOCD places the standard 32 byte breakpoint
+header at load_address 0x20000000 and the algorithm right behind it, so
+the entry points, static base, stack and page buffers below are offsets
+from 0x20000020. The build is rejected if it still holds an absolute
+address of its own code or data.
+
+Not yet tried: the FLM has not been built with arm-none-eabi-gcc nor run
+through this script or pyOCD, so the output is unverified.
+
+  flm_pyocd.py build/cmake/flm/W25Q16_STM32L4xx_FLM.FLM > w25q16_algo.py
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from loader_inspect import DIAG_START, Elf  # noqa: E402
+
+LOAD_ADDRESS = 0x20000000
+HEADER = [0xE00ABE00, 0x062D780D, 0x24084068, 0xD3000040, 0x1E644058, 0x1C49D1FA, 0x2A001E52, 0x4770D1F2]
+BLOB_SECTIONS = ("PrgCode", "PrgData", "DevDscr")
+
+SHT_REL = 9
+SHF_ALLOC = 2
+# Relocations that store an absolute address: ABS32, TARGET1, MOVW/MOVT
+ABSOLUTE_RELOCS = {2: "R_ARM_ABS32", 38: "R_ARM_TARGET1", 43: "R_ARM_MOVW_ABS_NC", 44: "R_ARM_MOVT_ABS",
+                   47: "R_ARM_THM_MOVW_ABS_NC", 48: "R_ARM_THM_MOVT_ABS"}
+
+
+def section(elf, name):
+    for s in elf.sections:
+        if s["name"] == name:
+            return s
+    raise ValueError("section %s not found, not an FLM build?" % name)
+
+
+def symbol(elf, name):
+    if name not in elf.symbols:
+        raise ValueError("symbol %s not found" % name)
+    return elf.symbols[name][0]
+
+
+def check_position_independent(elf):
+    """Raise unless the image only refers to itself PC-relative. Needs the
+    relocations kept by --emit-relocs."""
+    if section(elf, "PrgCode")["addr"] != 0:
+        raise ValueError("PrgCode is not linked at 0, not a position independent FLM")
+    image = {i for i, s in enumerate(elf.sections) if s["flags"] & SHF_ALLOC and s["addr"] < DIAG_START}
+    rels = [s for s in elf.sections if s["type"] == SHT_REL and s["info"] in image]
+    if not rels:
+        raise ValueError("no relocations in the FLM, link it with --emit-relocs")
+    for rel in rels:
+        target = elf.sections[rel["info"]]
+        symtab = elf.sections[rel["link"]]
+        for off in range(rel["offset"], rel["offset"] + rel["size"], 8):
+            where, info = struct.unpack_from("<2I", elf.data, off)
+            if info & 0xFF not in ABSOLUTE_RELOCS:
+                continue
+            shndx = struct.unpack_from("<H", elf.data, symtab["offset"] + (info >> 8) * 16 + 14)[0]
+            if shndx in image:
+                raise ValueError("%s at %s+0x%X stores an absolute address into %s" % (
+                    ABSOLUTE_RELOCS[info & 0xFF], target["name"], where - target["addr"], elf.sections[shndx]["name"]))
+    start, end = symbol(elf, "__got_start"), symbol(elf, "__got_end")
+    for addr in range(start, end, 4):
+        (value,) = struct.unpack("<I", elf.read(addr, 4))
+        if 0 < value < DIAG_START:
+            raise ValueError("GOT entry at 0x%X holds the link address 0x%X, is a symbol not hidden?" % (
+                addr, value))
+
+
+def flash_algo(elf):
+    check_position_independent(elf)
+    blob = b""
+    for name in BLOB_SECTIONS:
+        s = section(elf, name)
+        if s["addr"] < len(blob):
+            raise ValueError("%s at 0x%08X overlaps the previous section" % (name, s["addr"]))
+        blob += b"\0" * (s["addr"] - len(blob))
+        if s["type"] == 8:  # NOBITS: .bss inside PrgData is zeroed by the host download
+            blob += b"\0" * s["size"]
+        else:
+            blob += elf.data[s["offset"]:s["offset"] + s["size"]]
+    blob += b"\0" * (-len(blob) % 4)
+    words = HEADER + list(struct.unpack("<%dI" % (len(blob) // 4), blob))
+
+    raw = elf.read(symbol(elf, "FlashDevice"), 168)
+    _, _, size, page = struct.unpack_from("<HIII", raw, 130)
+    base = LOAD_ADDRESS + 4 * len(HEADER)
+    if base + symbol(elf, "__stack_top") > DIAG_START:
+        raise ValueError("algorithm, page buffers and stack overlap DIAG once loaded at 0x%08X" % base)
+    return {
+        "load_address": LOAD_ADDRESS,
+        "instructions": words,
+        "pc_init": base + (symbol(elf, "Init") & ~1),
+        "pc_unInit": base + (symbol(elf, "UnInit") & ~1),
+        "pc_program_page": base + (symbol(elf, "ProgramPage") & ~1),
+        "pc_erase_sector": base + (symbol(elf, "EraseSector") & ~1),
+        "pc_eraseAll": base + (symbol(elf, "EraseChip") & ~1),
+        "static_base": base + section(elf, "PrgData")["addr"],
+        "begin_stack": base + symbol(elf, "__stack_top"),
+        "begin_data": base + symbol(elf, "__page_buffer0"),
+        "page_buffers": [base + symbol(elf, "__page_buffer0"), base + symbol(elf, "__page_buffer1")],
+        "min_program_length": page,
+        "analyzer_supported": False,
+    }, size
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("flm", help="W25Q16_STM32L4xx_FLM.FLM")
+    args = parser.parse_args()
+
+    try:
+        algo, size = flash_algo(Elf(args.flm))
+    except (OSError, ValueError, struct.error) as e:
+        sys.exit(str(e))
+
+    print("# Generated by tools/flm_pyocd.py from %s, device size 0x%X" % (os.path.basename(args.flm), size))
+    print("flash_algo = {")
+    for key, value in algo.items():
+        if key == "instructions":
+            print("    'instructions': [")
+            for i in range(0, len(value), 4):
+                print("        " + ", ".join("0x%08X" % w for w in value[i:i + 4]) + ",")
+            print("    ],")
+        elif key == "page_buffers":
+            print("    'page_buffers': [%s]," % ", ".join("0x%08X" % a for a in value))
+        elif isinstance(value, bool):
+            print("    '%s': %s," % (key, value))
+        else:
+            print("    '%s': 0x%08X," % (key, value))
+    print("}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,313 @@
+#!/usr/bin/env python3
+"""Loader throughput benchmark on the simulated QSPI flash.
+
+Runs the loader sources themselves, built for the host by loader_host.py
+with each scenario's build options against the W25Q16JV model, so driver
+and entry point changes move the numbers. The STM32CubeProgrammer entry
+points are driven through a matrix of chunk sizes (256 B to 64 KB),
+aligned/unaligned addresses, blank/random/sparse images, chip and partial
+erase, and verify/checksum/CRC over the whole 2 MB; the report gives
+simulated time, MB/s and QSPI command counts. The session_* scenarios
+program a blank, random or sparse image the way STM32CubeProgrammer does
+(only pages holding data, only the sectors they touch, Init() before
+Verify()), for the default build and each LOADER_* option build.
+The host_* scenarios add a fixed debugger round trip per call to compare
+the 256 B flash page with the advertised MEMORY_TRANSFER_PAGE_SIZE. The
+hex_* scenarios write 16 byte records as from a HEX file, with and without
+the LOADER_WRITE_CACHE page combining. The update_* scenarios change a 100
+byte record in a programmed sector, once the host way (erase, resend 4K)
+and once through LOADER_WRITE_RMW, including the data download. The
+sparse_* scenarios program a sparse image over an older one, erasing the
+range first or relying on LOADER_LAZY_ERASE. The verify_512K_* scenarios
+check a programmed image with each verify_policy.h policy, including the host
+round trips and the download of the buffer bytes the policy reads.
+
+    loader_bench.py                    run and print
+    loader_bench.py --check            also fail (exit 1) on regressions
+    loader_bench.py --update-baseline  store the current results
+
+The baseline lives in tools/bench_baseline.json. A scenario regresses when
+its simulated time exceeds the baseline by more than --tolerance.
+"""
+
+import argparse
+import json
+import os
+import random
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from loader_host import Loader, verify_config  # noqa: E402
+from loader_host import VERIFY_POLICY_CRC, VERIFY_POLICY_FULL, VERIFY_POLICY_SAMPLED  # noqa: E402
+from w25q_model import Geometry  # noqa: E402
+
+BASELINE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "bench_baseline.json")
+
+KB = 1024
+IMAGE_SIZE = 512 * KB
+PROGRAM_SIZE = 256 * KB
+# The build options of the session matrix, besides the default build
+SESSION_OPTIONS = (("", ()), ("write_cache", ("LOADER_WRITE_CACHE=1",)), ("write_rmw", ("LOADER_WRITE_RMW=1",)),
+                   ("lazy_erase", ("LOADER_LAZY_ERASE=1",)), ("write_verify", ("LOADER_WRITE_VERIFY=1",)),
+                   ("manifest", ("LOADER_MANIFEST=1",)))
+HOST_CALL_US = 300.0    # halt / run / breakpoint per entry point call, as in stream_harness.py
+SWD_KBPS = 4000.0       # debug link RAM download rate, as in stream_harness.py
+
+
+def image(kind, size, seed=1):
+    rnd = random.Random(seed)
+    if kind == "blank":
+        return bytes([0xFF]) * size
+    if kind == "random":
+        return rnd.randbytes(size)
+    # sparse: a few random islands of data in an erased image
+    data = bytearray([0xFF]) * size
+    for _ in range(size // (64 * KB) * 2):
+        start = rnd.randrange(0, size - 3 * KB)
+        length = rnd.randrange(16, 3 * KB)
+        data[start:start + length] = rnd.randbytes(length)
+    return bytes(data)
+
+
+def write_chunks(loader, addr, data, chunk):
+    for pos in range(0, len(data), chunk):
+        loader.Write(addr + pos, data[pos:pos + chunk])
+
+
+def host_write(loader, addr, data, page):
+    """Write() calls as a host issues them for a given advertised page size."""
+    calls = 0
+    for pos in range(0, len(data), page):
+        loader.cpu(HOST_CALL_US)
+        loader.Write(addr + pos, data[pos:pos + page])
+        calls += 1
+    return calls
+
+
+def scenarios():
+    out = []
+    for chunk in (256, KB, 4 * KB, 16 * KB, 64 * KB):
+        for offset, align in ((0, "aligned"), (3, "unaligned")):
+            def run(loader, chunk=chunk, offset=offset):
+                write_chunks(loader, loader.geo.base + offset, image("random", PROGRAM_SIZE), chunk)
+                return PROGRAM_SIZE
+            out.append(("program_%dB_%s" % (chunk, align), run, ()))
+
+    def session(loader, kind, lazy):
+        """As STM32CubeProgrammer: transfer pages that are not all 0xFF,
+        erase only the sectors they touch, Init() again before Verify()."""
+        base = loader.geo.base
+        page = loader.geo.transfer
+        data = image(kind, IMAGE_SIZE)
+        chunks = [pos for pos in range(0, IMAGE_SIZE, page) if data[pos:pos + page].count(0xFF) != page]
+        if not lazy:
+            for pos in chunks:
+                loader.SectorErase(base + pos, base + pos + page - 1)
+        for pos in chunks:
+            loader.Write(base + pos, data[pos:pos + page])
+        loader.Init()
+        for pos in chunks:
+            if loader.Verify(base + pos, data[pos:pos + page]) is not None:
+                raise RuntimeError("verify failed")
+        return IMAGE_SIZE
+
+    for option, defines in SESSION_OPTIONS:
+        for kind in ("blank", "random", "sparse") if not defines else ("random", "sparse"):
+            out.append(("session_%s_512K%s" % (kind, option and "_" + option),
+                        lambda loader, kind=kind, lazy=option == "lazy_erase": session(loader, kind, lazy), defines))
+
+    geo = Geometry()
+    for page in sorted({geo.page, geo.transfer}):
+        def run(loader, page=page):
+            host_write(loader, loader.geo.base, image("random", IMAGE_SIZE), page)
+            return IMAGE_SIZE
+        out.append(("host_program_512K_%dB" % page, run, ()))
+
+    for cached in (False, True):
+        def run(loader):
+            base = loader.geo.base + 8
+            data = image("random", PROGRAM_SIZE)
+            write_chunks(loader, base, data, 16)
+            if loader.Verify(base, data) is not None:
+                raise RuntimeError("verify failed")
+            return PROGRAM_SIZE
+        out.append(("hex_16B_records_256K" + ("_cached" if cached else ""), run,
+                    ("LOADER_WRITE_CACHE=1",) if cached else ()))
+
+    def update(loader, rmw):
+        base = loader.geo.base
+        old = image("random", loader.geo.sector)
+        loader.Write(base, old)
+        loader.reset_stats()
+        record = image("random", 100, seed=2)
+        expect = old[:1000] + record + old[1100:]
+        if rmw:
+            loader.cpu(len(record) * 8 * 1000.0 / SWD_KBPS)
+            loader.Write(base + 1000, record)
+        else:
+            loader.SectorErase(base, base + loader.geo.sector - 1)
+            loader.cpu(len(expect) * 8 * 1000.0 / SWD_KBPS)
+            loader.Write(base, expect)
+        if loader.Verify(base, expect) is not None:
+            raise RuntimeError("verify failed")
+        return len(record)
+
+    out += [("update_100B_erase_4K", lambda loader: update(loader, False), ()),
+            ("update_100B_rmw", lambda loader: update(loader, True), ("LOADER_WRITE_RMW=1",))]
+
+    def sparse_over_old(loader, lazy):
+        base = loader.geo.base
+        loader.Write(base, image("random", IMAGE_SIZE // 2, seed=3))
+        # The older image is from an earlier session
+        loader.Init()
+        loader.reset_stats()
+        data = image("sparse", IMAGE_SIZE)
+        chunks = [pos for pos in range(0, IMAGE_SIZE, 4 * KB) if data[pos:pos + 4 * KB].count(0xFF) != 4 * KB]
+        if not lazy:
+            loader.SectorErase(base, base + IMAGE_SIZE - 1)
+        for pos in chunks:
+            loader.Write(base + pos, data[pos:pos + 4 * KB])
+        for pos in chunks:
+            if loader.Verify(base + pos, data[pos:pos + 4 * KB]) is not None:
+                raise RuntimeError("verify failed")
+        return IMAGE_SIZE
+
+    out += [("sparse_512K_erase_first", lambda loader: sparse_over_old(loader, False), ()),
+            ("sparse_512K_lazy_erase", lambda loader: sparse_over_old(loader, True), ("LOADER_LAZY_ERASE=1",))]
+
+    def verify_policy(loader, policy):
+        base = loader.geo.base
+        data = image("random", IMAGE_SIZE)
+        loader.Write(base, data)
+        loader.reset_stats()
+        if policy != VERIFY_POLICY_FULL:
+            loader.verify_config = verify_config(policy, base, data, chunk=IMAGE_SIZE // 64, every=16, seed=1)
+            loader.cpu((8 * 4 + 64 * 4) * 8 * 1000.0 / SWD_KBPS)
+        for pos in range(0, IMAGE_SIZE, loader.geo.transfer):
+            size = min(loader.geo.transfer, IMAGE_SIZE - pos)
+            if policy == VERIFY_POLICY_FULL:
+                download = size
+            elif policy == VERIFY_POLICY_SAMPLED:
+                download = len(loader.sampled_pages(base + pos, size)) * loader.geo.page
+            else:
+                download = 0
+            loader.cpu(HOST_CALL_US + download * 8 * 1000.0 / SWD_KBPS)
+            if loader.Verify(base + pos, data[pos:pos + size]) is not None:
+                raise RuntimeError("verify failed")
+        return IMAGE_SIZE
+
+    policies = ("LOADER_VERIFY_POLICIES=1",)
+    out += [("verify_512K_full", lambda loader: verify_policy(loader, VERIFY_POLICY_FULL), ()),
+            ("verify_512K_crc", lambda loader: verify_policy(loader, VERIFY_POLICY_CRC), policies),
+            ("verify_512K_sampled", lambda loader: verify_policy(loader, VERIFY_POLICY_SAMPLED), policies)]
+
+    def erase_chip(loader):
+        loader.MassErase()
+        return loader.geo.size
+
+    def erase_chip_used(loader, size):
+        loader.Write(loader.geo.base, image("random", size))
+        loader.reset_stats()
+        loader.MassErase()
+        if loader.flash.mem.count(0xFF) != loader.geo.size:
+            raise RuntimeError("not erased")
+        return loader.geo.size
+
+    def erase_partial(loader):
+        loader.SectorErase(loader.geo.base, loader.geo.base + PROGRAM_SIZE - 1)
+        return PROGRAM_SIZE
+
+    def verify(loader):
+        loader.Verify(loader.geo.base, bytes(loader.flash.mem))
+        return loader.geo.size
+
+    def checksum(loader):
+        loader.CheckSum(loader.geo.base, loader.geo.size)
+        return loader.geo.size
+
+    def crc(loader):
+        loader.SEGGER_FL_CalcCRC(0xFFFFFFFF, loader.geo.base, loader.geo.size, 0xEDB88320)
+        return loader.geo.size
+
+    def fill(loader):
+        loader.Fill(loader.geo.base, PROGRAM_SIZE, b"\x5A\xA5\x00\x01")
+        return PROGRAM_SIZE
+
+    def fill_blank(loader):
+        loader.Fill(loader.geo.base, PROGRAM_SIZE, b"\xFF")
+        return PROGRAM_SIZE
+
+    def sector_crc(loader):
+        loader.SectorCrc(loader.geo.base, loader.geo.size)
+        return loader.geo.size
+
+    out += [(name, fn, ()) for name, fn in (
+        ("erase_chip", erase_chip),
+        ("erase_chip_128K_used", lambda loader: erase_chip_used(loader, 128 * KB)),
+        ("erase_chip_2M_used", lambda loader: erase_chip_used(loader, loader.geo.size)),
+        ("erase_partial_256K", erase_partial),
+        ("verify_2M", verify), ("checksum_2M", checksum), ("crc_2M", crc),
+        ("sector_crc_2M", sector_crc), ("fill_256K", fill), ("fill_blank_256K", fill_blank))]
+    return out
+
+
+def run_all(pattern):
+    results = {}
+    for name, fn, defines in scenarios():
+        if pattern and pattern not in name:
+            continue
+        loader = Loader(defines)
+        if loader.Init() != 1:
+            raise RuntimeError("%s: Init failed" % name)
+        loader.reset_stats()
+        nbytes = fn(loader)
+        if loader.flash.errors:
+            raise RuntimeError("%s: %s" % (name, loader.flash.errors[0]))
+        t = loader.time_us
+        results[name] = {"bytes": nbytes, "time_us": round(t, 1), "mbps": round(nbytes / t, 4),
+                         "commands": loader.commands}
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-k", dest="pattern", help="only run scenarios containing this string")
+    parser.add_argument("--check", action="store_true", help="exit 1 if a scenario regressed")
+    parser.add_argument("--tolerance", type=float, default=0.05, help="allowed slowdown (default 0.05)")
+    parser.add_argument("--update-baseline", action="store_true", help="store results as the new baseline")
+    args = parser.parse_args()
+
+    results = run_all(args.pattern)
+    baseline = {}
+    if os.path.exists(BASELINE):
+        with open(BASELINE) as f:
+            baseline = json.load(f)
+
+    regressions = []
+    print("%-36s %9s %13s %9s %9s %9s" % ("scenario", "bytes", "sim ms", "MB/s", "cmds", "vs base"))
+    for name, r in results.items():
+        delta = ""
+        if name in baseline:
+            ratio = r["time_us"] / baseline[name]["time_us"] - 1.0
+            delta = "%+.1f%%" % (ratio * 100)
+            if ratio > args.tolerance:
+                regressions.append(name)
+                delta += " !"
+        print("%-36s %9d %13.1f %9.3f %9d %9s" % (name, r["bytes"], r["time_us"] / 1000, r["mbps"],
+                                                  r["commands"], delta))
+
+    if args.update_baseline:
+        baseline.update(results)
+        with open(BASELINE, "w") as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("baseline updated")
+
+    if regressions:
+        print("regressed beyond %.0f%%: %s" % (args.tolerance * 100, ", ".join(regressions)))
+        if args.check:
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
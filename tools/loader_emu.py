@@ -0,0 +1,292 @@
+#!/usr/bin/env python3
+"""Execute a built loader (.stldr, .SFL or .FLM) in a Cortex-M4 emulator.
+
+The exact Thumb-2 binary that ships runs in Unicorn. RAM is loaded from
+the ELF sections; the peripheral ranges and the memory-mapped window
+are MMIO regions forwarded to the register models of tools/loader_host.c
+(host_bus_access()). QUADSPI is one of these stubs. Its transactions
+reach the same W25Q16JV model (w25q_model.Flash) as the host build of
+the sources, which also checks the command sequences.
+
+Each entry point call reports:
+  * the instructions executed
+  * the simulated time, at one cycle per instruction plus memory-mapped
+    read stalls
+  * the QUADSPI commands issued and the time spent on the bus
+
+Instructions are counted per translation block on entry, so a register
+access sees the time of the end of its block. Busy waits run instruction
+by instruction. An erase therefore takes seconds of host time, and a
+chip erase is not part of the default run.
+
+    pip install unicorn
+    loader_emu.py build/cmake/stldr/W25Q16_STM32L4xx-QSPI.stldr
+    loader_emu.py build/cmake/segger/W25Q16_STM32L4xx.SFL
+    loader_emu.py build/cmake/flm/W25Q16_STM32L4xx_FLM.FLM
+
+ctest runs it on the three built loaders (loader_emu_*) and reports the
+tests as skipped when Unicorn is not installed.
+"""
+
+import argparse
+import ctypes
+import os
+import random
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from loader_host import Board, HostFault, HostHalt  # noqa: E402
+from loader_inspect import DIAG_START, Elf, thumb_scan  # noqa: E402
+
+try:
+    from unicorn import UC_ARCH_ARM, UC_HOOK_BLOCK, UC_HOOK_CODE, UC_MODE_MCLASS, UC_MODE_THUMB, Uc, UcError
+    from unicorn.arm_const import UC_ARM_REG_LR, UC_ARM_REG_PC, UC_ARM_REG_R0, UC_ARM_REG_R1, UC_ARM_REG_R2
+    from unicorn.arm_const import UC_ARM_REG_R3, UC_ARM_REG_SP, UC_CPU_ARM_CORTEX_M4
+except ImportError:
+    Uc = None
+
+RAM_BASE = 0x20000000
+RAM_SIZE = 0x20000
+STACK_SIZE = 0x800
+RETURN = RAM_BASE + RAM_SIZE - 0x10    # LR of every call, emulation stops there
+FLM_BASE = RAM_BASE + 0x20              # where pyOCD / Keil load a FLM, behind the breakpoint header
+
+# The ranges loader_host.c models, see host_setup()
+PERIPHERALS = [(0x40000000, 0x30000), (0x48000000, 0x2000), (0x90000000, 0x1000000), (0xA0001000, 0x1000),
+               (0xE0000000, 0x100000)]
+
+SKIPPED = 77            # exit status without Unicorn, the SKIP_RETURN_CODE of the loader_emu_* ctest tests
+INSN_LIMIT = 400000000  # per call, well above a 400 ms sector erase timeout at 80 MHz
+
+SHF_ALLOC = 2
+SHT_NOBITS = 8
+
+
+class Result:
+    def __init__(self, value, insns, time_us, commands, sck, bus_us):
+        self.value = value
+        self.insns = insns
+        self.time_us = time_us
+        self.commands = commands
+        self.sck = sck
+        self.bus_us = bus_us
+
+
+class Emulator:
+    """One download of a built loader into the emulated target. The board
+    (peripherals, flash, time) is loader_host.Board's and keeps its state
+    across downloads, as on the real target."""
+
+    def __init__(self, path, board=None):
+        if Uc is None:
+            raise RuntimeError("the unicorn module is not installed (pip install unicorn)")
+        self.elf = Elf(path)
+        self.board = board or Board.get()
+        self.board.lib.host_bus_access.argtypes = [ctypes.c_uint32, ctypes.c_uint32, ctypes.c_int,
+                                                   ctypes.POINTER(ctypes.c_uint32), ctypes.c_uint64]
+        self.board.lib.host_bus_access.restype = None
+        self.uc = Uc(UC_ARCH_ARM, UC_MODE_THUMB | UC_MODE_MCLASS)
+        self.uc.ctl_set_cpu_model(UC_CPU_ARM_CORTEX_M4)
+        self.uc.mem_map(RAM_BASE, RAM_SIZE)
+        # A FLM is position independent and linked at 0, the fixed DIAG
+        # blocks excepted
+        pic = any(s["name"] == "PrgCode" and s["addr"] == 0 for s in self.elf.sections)
+        self.base = FLM_BASE if pic else 0
+        image_end = RAM_BASE
+        for s in self.elf.sections:
+            if not (s["flags"] & SHF_ALLOC) or s["size"] == 0:
+                continue
+            addr = s["addr"] + self.base if s["addr"] < DIAG_START else s["addr"]
+            if not RAM_BASE <= addr <= addr + s["size"] <= RAM_BASE + RAM_SIZE:
+                raise ValueError("section %s at 0x%08X is outside the emulated RAM" % (s["name"], addr))
+            if s["type"] != SHT_NOBITS:
+                self.uc.mem_write(addr, self.elf.data[s["offset"]:s["offset"] + s["size"]])
+            if addr < DIAG_START:
+                image_end = max(image_end, addr + s["size"])
+        for base, size in PERIPHERALS:
+            self.uc.mmio_map(base, size, self._read, base, self._write, base)
+
+        self.stack_top = next((self.symbol(n) for n in ("__stack_top", "_estack") if n in self.elf.symbols),
+                              DIAG_START)
+        self.stack_top = min(self.stack_top, RETURN) & ~7
+        self.buffers = (image_end + 0xFF) & ~0xFF
+        self.buffers_end = DIAG_START if self.stack_top > DIAG_START else self.stack_top - STACK_SIZE
+        self.buffers_used = 0
+
+        self.insns = 0
+        self.charged = 0
+        self.limit = 0
+        self.halted = None
+        self._blocks = {}
+        self.uc.hook_add(UC_HOOK_BLOCK, self._block)
+        if "Error_Handler" in self.elf.symbols:
+            handler = self.symbol("Error_Handler") & ~1
+            self.uc.hook_add(UC_HOOK_CODE, self._error_handler, begin=handler, end=handler)
+
+    # -- bus -------------------------------------------------------------
+
+    def _access(self, addr, size, store, value=0):
+        v = ctypes.c_uint32(value)
+        self.board.lib.host_bus_access(addr, size, store, ctypes.byref(v), self.insns - self.charged)
+        self.charged = self.insns
+        return v.value
+
+    def _read(self, uc, offset, size, base):
+        return self._access(base + offset, size, 0)
+
+    def _write(self, uc, offset, size, value, base):
+        self._access(base + offset, size, 1, value)
+
+    def _block(self, uc, address, size, _):
+        count = self._blocks.get((address, size))
+        if count is None:
+            count = thumb_scan(bytes(uc.mem_read(address, size)), address)[0]
+            self._blocks[(address, size)] = count
+        self.insns += count
+        if self.insns > self.limit:
+            self.halted = "instruction limit reached"
+            uc.emu_stop()
+
+    def _error_handler(self, uc, address, size, _):
+        self.halted = "Error_Handler"
+        uc.emu_stop()
+
+    # -- host side -------------------------------------------------------
+
+    def symbol(self, name):
+        """Run time address of an image symbol."""
+        value = self.elf.symbols[name][0]
+        return value + self.base if value < DIAG_START else value
+
+    def put(self, data):
+        """Copy bytes to the RAM behind the loader image, return the
+        address. Valid until free_all()."""
+        addr = self.buffers + self.buffers_used
+        if addr + len(data) > self.buffers_end:
+            raise MemoryError("%d bytes do not fit the RAM left for buffers" % len(data))
+        self.uc.mem_write(addr, bytes(data))
+        self.buffers_used += (len(data) + 7) & ~7
+        return addr
+
+    def get(self, addr, size):
+        return bytes(self.uc.mem_read(addr, size))
+
+    def free_all(self):
+        self.buffers_used = 0
+
+    def call(self, name, *args, insn_limit=INSN_LIMIT):
+        """Run an entry point with up to four integer arguments. Returns a
+        Result whose value is R1:R0. Raises HostHalt when the call does
+        not return and HostFault on an access the hardware would not serve."""
+        if name not in self.elf.symbols:
+            raise KeyError("%s is not in this build" % name)
+        regs = (UC_ARM_REG_R0, UC_ARM_REG_R1, UC_ARM_REG_R2, UC_ARM_REG_R3)
+        for reg, value in zip(regs, list(args) + [0] * (4 - len(args))):
+            self.uc.reg_write(reg, value & 0xFFFFFFFF)
+        self.uc.reg_write(UC_ARM_REG_SP, self.stack_top)
+        self.uc.reg_write(UC_ARM_REG_LR, RETURN | 1)
+        stats = self.board.stats
+        t0, cmds, sck, bus = self.board.time_us, stats.commands, stats.sck_cycles, stats.bus_ps
+        first = self.insns
+        self.limit = self.insns + insn_limit
+        self.halted = None
+        try:
+            self.uc.emu_start(self.symbol(name) | 1, RETURN)
+        except UcError as e:
+            self.halted = "%s at PC 0x%08X" % (e, self.uc.reg_read(UC_ARM_REG_PC))
+        fault = self.board.fault()
+        if self.halted:
+            raise HostHalt("%s: %s" % (name, self.halted))
+        if fault:
+            raise HostFault("%s: %s" % (name, fault))
+        value = self.uc.reg_read(UC_ARM_REG_R0) | self.uc.reg_read(UC_ARM_REG_R1) << 32
+        return Result(value, self.insns - first, self.board.time_us - t0, stats.commands - cmds,
+                      stats.sck_cycles - sck, (stats.bus_ps - bus) / 1e6)
+
+
+# (label, entry point, arguments) with buffers placed when the call runs
+def stldr_calls(geo, data):
+    base = geo.base
+    return [("Init", "Init", lambda emu: ()),
+            ("Init (configured)", "Init", lambda emu: ()),
+            ("SectorErase", "SectorErase", lambda emu: (base, base + len(data) - 1)),
+            ("Write", "Write", lambda emu: (base, len(data), emu.put(data))),
+            ("Read", "Read", lambda emu: (base, len(data), emu.put(bytes(len(data))))),
+            ("CheckSum", "CheckSum", lambda emu: (base, len(data), 0)),
+            ("Verify", "Verify", lambda emu: (base, emu.put(data), len(data) // 4, 0)),
+            ("SectorCrc", "SectorCrc", lambda emu: (base, len(data), emu.put(bytes(4 * (len(data) // geo.sector + 1)))))]
+
+
+def segger_calls(geo, data):
+    base = geo.base
+    return [("SEGGER_FL_Prepare", "SEGGER_FL_Prepare", lambda emu: (0, 0, 0)),
+            ("SEGGER_FL_Prepare (configured)", "SEGGER_FL_Prepare", lambda emu: (0, 0, 0)),
+            ("SEGGER_FL_Erase", "SEGGER_FL_Erase", lambda emu: (base, 0, len(data) // geo.sector)),
+            ("SEGGER_FL_Program", "SEGGER_FL_Program", lambda emu: (base, len(data), emu.put(data))),
+            ("SEGGER_FL_Read", "SEGGER_FL_Read", lambda emu: (base, len(data), emu.put(bytes(len(data))))),
+            ("SEGGER_FL_Verify", "SEGGER_FL_Verify", lambda emu: (base, len(data), emu.put(data))),
+            ("SEGGER_FL_CalcCRC", "SEGGER_FL_CalcCRC", lambda emu: (0xFFFFFFFF, base, len(data), 0xEDB88320)),
+            ("SEGGER_FL_CheckBlank", "SEGGER_FL_CheckBlank", lambda emu: (base + len(data), geo.sector, 0xFF))]
+
+
+def flm_calls(geo, data):
+    base = geo.base
+    out = [("Init (erase)", "Init", lambda emu: (base, 0, 1))]
+    out += [("EraseSector", "EraseSector", lambda emu, pos=pos: (base + pos,))
+            for pos in range(0, len(data), geo.sector)]
+    return out + [("UnInit", "UnInit", lambda emu: (1,)),
+                  ("Init (program)", "Init", lambda emu: (base, 0, 2)),
+                  ("ProgramPage", "ProgramPage", lambda emu: (base, len(data), emu.put(data))),
+                  ("UnInit", "UnInit", lambda emu: (2,)),
+                  ("Init (verify)", "Init", lambda emu: (base, 0, 3)),
+                  ("Verify", "Verify", lambda emu: (base, len(data), emu.put(data))),
+                  ("UnInit", "UnInit", lambda emu: (3,))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="W25Q16_STM32L4xx-QSPI.stldr, W25Q16_STM32L4xx.SFL or W25Q16_STM32L4xx_FLM.FLM")
+    parser.add_argument("--size", type=lambda v: int(v, 0), default=0x2000, help="bytes programmed (default 8K)")
+    args = parser.parse_args()
+
+    if Uc is None:
+        print("the unicorn module is not installed (pip install unicorn), skipped")
+        return SKIPPED
+    try:
+        emu = Emulator(args.elf)
+    except (OSError, ValueError, RuntimeError, struct.error) as e:
+        sys.exit(str(e))
+    geo = emu.board.flash.geo
+    data = random.Random(1).randbytes(args.size)
+    if "ProgramPage" in emu.elf.symbols:
+        calls = flm_calls(geo, data)
+    elif "SEGGER_FL_Prepare" in emu.elf.symbols:
+        calls = segger_calls(geo, data)
+    else:
+        calls = stldr_calls(geo, data)
+
+    print("%-32s %10s %12s %6s %9s %10s %10s" % ("call", "insns", "sim us", "cmds", "SCK", "bus us", "R0"))
+    failed = False
+    for label, name, place in calls:
+        try:
+            r = emu.call(name, *place(emu))
+        except (HostHalt, HostFault, MemoryError) as e:
+            print("%-32s %s" % (label, e))
+            failed = True
+            break
+        finally:
+            emu.free_all()
+        print("%-32s %10d %12.1f %6d %9d %10.1f 0x%08X" % (label, r.insns, r.time_us, r.commands, r.sck, r.bus_us,
+                                                           r.value & 0xFFFFFFFF))
+    if bytes(emu.board.flash.mem[:len(data)]) != data:
+        print("flash contents differ from the programmed data")
+        failed = True
+    print("core clock %.1f MHz, one cycle per instruction" % (emu.board.lib.host_core_clock() / 1e6))
+    for e in emu.board.flash.errors:
+        print("flash: %s" % e)
+    return 1 if failed or emu.board.flash.errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
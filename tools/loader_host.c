@@ -0,0 +1,1033 @@
+/* Host runtime for the loader sources, used by tools/loader_host.py.
+ *
+ * The loader is compiled for the host unchanged, with
+ * -fsanitize=kernel-address and outline instrumentation, so every load and
+ * store goes through the __asan_* hooks below before it happens. The
+ * peripheral address ranges the loader touches are mapped at their real
+ * addresses, which lets the HAL and driver code access registers as usual;
+ * the hooks give the registers their behaviour:
+ *
+ *   RCC        oscillator and PLL ready flags follow their enable bits,
+ *              SWS follows SW, and the core clock follows the tree
+ *   DWT        CYCCNT counts the simulated core cycles
+ *   CRC        the calculation unit, with input and output bit reversal
+ *   QUADSPI    indirect, automatic polling and memory-mapped modes; every
+ *              transaction reaches the flash model through a callback
+ *   0x90000000 the memory-mapped window, a mirror of the flash contents
+ *              kept up to date by the flash model
+ *
+ * A store is applied to the model at the next hook call (or when the call
+ * returns), once the value is in memory. Each instrumented access costs one core
+ * cycle, a rough stand-in for the CPU time at -O0; QUADSPI transfers cost
+ * their SCK cycles at the configured prescaler.
+ *
+ * tools/loader_emu.py reuses the same models for the built ARM binaries:
+ * its emulator forwards each peripheral access through host_bus_access().
+ *
+ *     cc -O2 -shared -fPIC loader_host.c -o libloader_host.so
+ */
+
+#define _GNU_SOURCE
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define HOST_PERIPH_BASE 0x40000000UL
+#define HOST_PERIPH_SIZE 0x30000UL
+#define HOST_GPIO_BASE 0x48000000UL
+#define HOST_GPIO_SIZE 0x2000UL
+#define HOST_QSPI_BASE 0xA0001000UL
+#define HOST_QSPI_SIZE 0x1000UL
+#define HOST_PPB_BASE 0xE0000000UL
+#define HOST_PPB_SIZE 0x100000UL
+#define HOST_WINDOW_BASE 0x90000000UL
+#define HOST_WINDOW_SIZE 0x1000000UL
+
+#define RCC_BASE_ADDR 0x40021000UL
+#define RCC_CR 0x00
+#define RCC_CFGR 0x08
+#define RCC_PLLCFGR 0x0C
+#define RCC_CSR 0x94
+#define CRC_BASE_ADDR 0x40023000UL
+#define CRC_DR 0x00
+#define CRC_CR 0x08
+#define CRC_INIT 0x10
+#define CRC_POL 0x14
+#define DWT_CTRL_ADDR 0xE0001000UL
+#define DWT_CYCCNT_ADDR 0xE0001004UL
+
+#define QSPI_CR 0x00
+#define QSPI_DCR 0x04
+#define QSPI_SR 0x08
+#define QSPI_FCR 0x0C
+#define QSPI_DLR 0x10
+#define QSPI_CCR 0x14
+#define QSPI_AR 0x18
+#define QSPI_ABR 0x1C
+#define QSPI_DR 0x20
+#define QSPI_PSMKR 0x24
+#define QSPI_PSMAR 0x28
+#define QSPI_PIR 0x2C
+
+#define QSPI_SR_TEF 0x01U
+#define QSPI_SR_TCF 0x02U
+#define QSPI_SR_FTF 0x04U
+#define QSPI_SR_SMF 0x08U
+#define QSPI_SR_BUSY 0x20U
+#define QSPI_CR_ABORT 0x02U
+#define QSPI_CR_APMS (1U << 22)
+#define QSPI_CR_PMM (1U << 23)
+
+#define FMODE_WRITE 0U
+#define FMODE_READ 1U
+#define FMODE_POLL 2U
+#define FMODE_MAPPED 3U
+
+#define REG(addr) (*(volatile uint32_t *)(uintptr_t)(addr))
+#define QREG(off) REG(HOST_QSPI_BASE + (off))
+
+/* One transaction as seen on the QUADSPI pins. Line counts are 0 (phase
+ * absent), 1, 2 or 4. */
+typedef struct
+{
+    double now_us;        /*!< Time the transaction completes */
+    uint32_t instruction;
+    uint32_t imode;
+    uint32_t address;
+    uint32_t admode;
+    uint32_t adsize;      /*!< Address bits */
+    uint32_t alt;
+    uint32_t abmode;
+    uint32_t absize;      /*!< Alternate bits */
+    uint32_t dummy;       /*!< Dummy SCK cycles */
+    uint32_t dmode;
+    uint32_t ddr;
+    uint32_t fmode;
+    uint32_t nbytes;      /*!< Data bytes, 0 for the memory-mapped setup */
+    uint8_t *data;        /*!< Written bytes, or filled in for reads */
+} host_xfer_t;
+
+typedef int (*host_transact_t)(host_xfer_t *xfer);
+
+typedef struct
+{
+    uint64_t accesses;    /*!< Instrumented loads and stores */
+    uint64_t commands;    /*!< QUADSPI transactions, one per memory-mapped run */
+    uint64_t sck_cycles;  /*!< QUADSPI bus time */
+    uint64_t polls;       /*!< Status reads issued by automatic polling */
+    uint64_t mapped_runs; /*!< Memory-mapped read bursts (0xEB commands) */
+    uint64_t mapped_bytes;
+    uint64_t bus_ps;      /*!< QUADSPI bus time in picoseconds */
+} host_stats_t;
+
+enum
+{
+    QSPI_IDLE,
+    QSPI_COLLECT, /* indirect write, waiting for DR bytes */
+    QSPI_READ,    /* indirect read, bytes left in the FIFO */
+    QSPI_POLL,
+    QSPI_MAPPED
+};
+
+host_stats_t host_stats;
+
+static struct
+{
+    int ready;
+    uint64_t cycles;      /* core cycles since host_setup() */
+    uint64_t ps;          /* the same in picoseconds */
+    uint64_t ps_per_cycle;
+    uint64_t cyccnt_base;
+    uint64_t limit_ps;    /* watchdog for the running call */
+    uintptr_t pending;    /* store waiting to be applied */
+    size_t pending_size;
+    jmp_buf *halt;
+    char fault[256];
+    host_transact_t transact;
+    uint32_t flash_size;
+    uint32_t crc;
+
+    struct
+    {
+        int state;
+        int tc_pending;   /* TCF to be set once done_at has passed */
+        uint32_t ccr;
+        uint32_t flags;   /* sticky TCF, SMF, TEF */
+        uint64_t done_at; /* core cycle the running transfer ends */
+        uint64_t next_poll;
+        uint8_t *buf;
+        uint32_t buf_size;
+        uint32_t count;   /* bytes in the transfer */
+        uint32_t pos;     /* bytes written or popped */
+        uint64_t start_at;
+        uint32_t mm_next; /* memory-mapped: next sequential offset */
+        uint32_t mm_fetched;
+        int mm_checked;
+    } qspi;
+} host;
+
+static void host_fault(const char *fmt, uint32_t a, uint32_t b)
+{
+    if (host.fault[0] == 0)
+    {
+        snprintf(host.fault, sizeof(host.fault), fmt, a, b);
+    }
+}
+
+void host_halt(const char *reason)
+{
+    if (host.fault[0] == 0)
+    {
+        snprintf(host.fault, sizeof(host.fault), "%s", reason);
+    }
+    if (host.halt != NULL)
+    {
+        longjmp(*host.halt, 1);
+    }
+    abort();
+}
+
+/* ---------------------------------------------------------------- clock */
+
+static const uint32_t msi_hz[12] = {100000, 200000, 400000, 800000, 1000000, 2000000,
+                                    4000000, 8000000, 16000000, 24000000, 32000000, 48000000};
+
+static uint32_t host_core_hz(void)
+{
+    uint32_t cr = REG(RCC_BASE_ADDR + RCC_CR);
+    uint32_t cfgr = REG(RCC_BASE_ADDR + RCC_CFGR);
+    uint32_t pll = REG(RCC_BASE_ADDR + RCC_PLLCFGR);
+    uint32_t range = (cr & 0x08U) ? (cr >> 4) & 0xFU : (REG(RCC_BASE_ADDR + RCC_CSR) >> 8) & 0xFU;
+    uint32_t msi = msi_hz[(range < 12) ? range : 6];
+    uint64_t hz;
+
+    switch (cfgr & 0x3U)
+    {
+    case 0:
+        hz = msi;
+        break;
+    case 3:
+        hz = ((pll & 0x3U) == 1U) ? msi : 16000000U;
+        hz = hz * ((pll >> 8) & 0x7FU) / (((pll >> 4) & 0x7U) + 1U) / ((((pll >> 25) & 0x3U) + 1U) * 2U);
+        break;
+    default:
+        hz = 16000000U;
+        break;
+    }
+    if (((cfgr >> 4) & 0x8U) != 0U)
+    {
+        static const uint8_t shift[8] = {1, 2, 3, 4, 6, 7, 8, 9};
+
+        hz >>= shift[(cfgr >> 4) & 0x7U];
+    }
+
+    return (hz != 0) ? (uint32_t)hz : 1U;
+}
+
+static void host_clock_update(void)
+{
+    host.ps_per_cycle = 1000000000000ULL / host_core_hz();
+}
+
+static void host_advance(uint64_t cycles)
+{
+    host.cycles += cycles;
+    host.ps += cycles * host.ps_per_cycle;
+    if (host.limit_ps != 0 && host.ps > host.limit_ps)
+    {
+        host.limit_ps = 0;
+        host_halt("watchdog: call ran past its time limit");
+    }
+}
+
+static double host_us_at(uint64_t cycle)
+{
+    /* Times in the past are close enough at the current rate */
+    uint64_t back = (host.cycles > cycle) ? (host.cycles - cycle) * host.ps_per_cycle : 0;
+    uint64_t ahead = (cycle > host.cycles) ? (cycle - host.cycles) * host.ps_per_cycle : 0;
+
+    return (double)(host.ps - back + ahead) / 1e6;
+}
+
+/* -------------------------------------------------------------- QUADSPI */
+
+static uint32_t qspi_lines(uint32_t mode)
+{
+    static const uint32_t lines[4] = {0, 1, 2, 4};
+
+    return lines[mode & 0x3U];
+}
+
+static void qspi_describe(host_xfer_t *x, uint32_t ccr)
+{
+    memset(x, 0, sizeof(*x));
+    x->instruction = ccr & 0xFFU;
+    x->imode = qspi_lines(ccr >> 8);
+    x->admode = qspi_lines(ccr >> 10);
+    x->adsize = (((ccr >> 12) & 0x3U) + 1U) * 8U;
+    x->abmode = qspi_lines(ccr >> 14);
+    x->absize = (((ccr >> 16) & 0x3U) + 1U) * 8U;
+    x->dummy = (ccr >> 18) & 0x1FU;
+    x->dmode = qspi_lines(ccr >> 24);
+    x->fmode = (ccr >> 26) & 0x3U;
+    x->ddr = (ccr >> 31) & 0x1U;
+    x->address = QREG(QSPI_AR);
+    x->alt = QREG(QSPI_ABR);
+}
+
+/* SCK cycles of the command phases, without data */
+static uint32_t qspi_header_sck(const host_xfer_t *x)
+{
+    uint32_t div = x->ddr ? 2U : 1U;
+    uint32_t sck = 0;
+
+    if (x->imode)
+    {
+        sck += 8U / x->imode;
+    }
+    if (x->admode)
+    {
+        sck += x->adsize / x->admode / div;
+    }
+    if (x->abmode)
+    {
+        sck += x->absize / x->abmode / div;
+    }
+
+    return sck + x->dummy;
+}
+
+static uint32_t qspi_data_sck(const host_xfer_t *x, uint32_t nbytes)
+{
+    return x->dmode ? nbytes * 8U / x->dmode / (x->ddr ? 2U : 1U) : 0U;
+}
+
+static uint32_t qspi_csht(void)
+{
+    return ((QREG(QSPI_DCR) >> 8) & 0x7U) + 1U;
+}
+
+/* Core cycles for a number of SCK cycles */
+static uint64_t qspi_core_cycles(uint64_t sck)
+{
+    return sck * (((QREG(QSPI_CR) >> 24) & 0xFFU) + 1U);
+}
+
+static void qspi_bus(uint64_t sck)
+{
+    host_stats.sck_cycles += sck;
+    host_stats.bus_ps += qspi_core_cycles(sck) * host.ps_per_cycle;
+}
+
+static void qspi_call(host_xfer_t *x, uint64_t at)
+{
+    x->now_us = host_us_at(at);
+    if (host.transact != NULL)
+    {
+        host.transact(x);
+    }
+}
+
+static uint8_t *qspi_buffer(uint32_t size)
+{
+    if (size > host.qspi.buf_size)
+    {
+        free(host.qspi.buf);
+        host.qspi.buf = calloc(size, 1);
+        host.qspi.buf_size = size;
+    }
+
+    return host.qspi.buf;
+}
+
+/* Indirect command without data, or a write once all its bytes are in */
+static void qspi_execute_write(void)
+{
+    host_xfer_t x;
+    uint64_t sck;
+
+    qspi_describe(&x, host.qspi.ccr);
+    x.nbytes = host.qspi.count;
+    x.data = host.qspi.buf;
+    sck = qspi_header_sck(&x) + qspi_data_sck(&x, x.nbytes) + qspi_csht();
+    if (x.nbytes == 0)
+    {
+        host.qspi.start_at = host.cycles;
+    }
+    /* Data goes out while the FIFO is filled, so only the last byte is left */
+    host.qspi.done_at = host.qspi.start_at + qspi_core_cycles(sck);
+    if (host.qspi.done_at < host.cycles + qspi_core_cycles(qspi_data_sck(&x, 1) + qspi_csht()))
+    {
+        host.qspi.done_at = host.cycles + qspi_core_cycles(qspi_data_sck(&x, 1) + qspi_csht());
+    }
+    host_stats.commands++;
+    qspi_bus(sck);
+    qspi_call(&x, host.qspi.done_at);
+    host.qspi.state = QSPI_IDLE;
+    host.qspi.tc_pending = 1;
+}
+
+static void qspi_execute_read(void)
+{
+    host_xfer_t x;
+    uint64_t sck;
+
+    qspi_describe(&x, host.qspi.ccr);
+    x.nbytes = QREG(QSPI_DLR) + 1U;
+    x.data = qspi_buffer(x.nbytes);
+    memset(x.data, 0xFF, x.nbytes);
+    sck = qspi_header_sck(&x) + qspi_data_sck(&x, x.nbytes) + qspi_csht();
+    host.qspi.done_at = host.cycles + qspi_core_cycles(sck);
+    host_stats.commands++;
+    qspi_bus(sck);
+    qspi_call(&x, host.cycles);
+    host.qspi.count = x.nbytes;
+    host.qspi.pos = 0;
+    host.qspi.state = QSPI_READ;
+}
+
+static void qspi_start_poll(void)
+{
+    host.qspi.state = QSPI_POLL;
+    host.qspi.next_poll = host.cycles;
+    host_stats.commands++;
+}
+
+/* Run the status reads automatic polling has issued by now */
+static void qspi_poll_update(void)
+{
+    while (host.qspi.state == QSPI_POLL && host.qspi.next_poll <= host.cycles)
+    {
+        host_xfer_t x;
+        uint32_t status = 0;
+        uint32_t mask = QREG(QSPI_PSMKR);
+        uint32_t match = QREG(QSPI_PSMAR);
+        uint32_t hit;
+        uint64_t sck;
+
+        qspi_describe(&x, host.qspi.ccr);
+        x.nbytes = (QREG(QSPI_DLR) & 0x3U) + 1U;
+        x.data = qspi_buffer(4);
+        memset(x.data, 0xFF, 4);
+        sck = qspi_header_sck(&x) + qspi_data_sck(&x, x.nbytes) + qspi_csht();
+        qspi_bus(sck);
+        host_stats.polls++;
+        host.qspi.next_poll += qspi_core_cycles(sck);
+        qspi_call(&x, host.qspi.next_poll);
+        for (uint32_t i = 0; i < x.nbytes; i++)
+        {
+            status |= (uint32_t)x.data[i] << (8U * i);
+        }
+        if (QREG(QSPI_CR) & QSPI_CR_PMM)
+        {
+            hit = (~(status ^ match) & mask) != 0;
+        }
+        else
+        {
+            hit = ((status & mask) == match);
+        }
+        if (hit)
+        {
+            host.qspi.flags |= QSPI_SR_SMF;
+            if (QREG(QSPI_CR) & QSPI_CR_APMS)
+            {
+                host.qspi.flags |= QSPI_SR_TCF;
+                host.qspi.done_at = host.qspi.next_poll;
+                host.qspi.state = QSPI_IDLE;
+            }
+        }
+        host.qspi.next_poll += qspi_core_cycles(QREG(QSPI_PIR) & 0xFFFFU);
+    }
+}
+
+static void qspi_launch(void)
+{
+    switch ((host.qspi.ccr >> 26) & 0x3U)
+    {
+    case FMODE_WRITE:
+        qspi_execute_write();
+        break;
+    case FMODE_READ:
+        qspi_execute_read();
+        break;
+    case FMODE_POLL:
+        qspi_start_poll();
+        break;
+    default:
+        break;
+    }
+}
+
+static void qspi_write_ccr(uint32_t ccr)
+{
+    uint32_t fmode = (ccr >> 26) & 0x3U;
+    uint32_t admode = (ccr >> 10) & 0x3U;
+    uint32_t dmode = (ccr >> 24) & 0x3U;
+
+    if (host.qspi.state == QSPI_READ || host.qspi.state == QSPI_POLL || host.qspi.state == QSPI_MAPPED)
+    {
+        host_fault("QUADSPI CCR written while busy (CCR 0x%08X)", ccr, 0);
+    }
+    host.qspi.ccr = ccr;
+    host.qspi.count = 0;
+    host.qspi.pos = 0;
+    host.qspi.state = QSPI_IDLE;
+    if (fmode == FMODE_MAPPED)
+    {
+        host.qspi.state = QSPI_MAPPED;
+        host.qspi.mm_checked = 0;
+        host.qspi.mm_next = UINT32_MAX;
+        host.qspi.mm_fetched = UINT32_MAX;
+        return;
+    }
+    if (fmode == FMODE_WRITE && dmode != 0)
+    {
+        /* Starts with the first DR write */
+        host.qspi.state = QSPI_COLLECT;
+        host.qspi.count = QREG(QSPI_DLR) + 1U;
+        qspi_buffer(host.qspi.count);
+        return;
+    }
+    if (admode == 0)
+    {
+        qspi_launch();
+    }
+}
+
+static void qspi_write_ar(void)
+{
+    uint32_t fmode = (host.qspi.ccr >> 26) & 0x3U;
+    uint32_t admode = (host.qspi.ccr >> 10) & 0x3U;
+
+    if (admode != 0 && host.qspi.state == QSPI_IDLE && fmode != FMODE_MAPPED &&
+        (fmode != FMODE_WRITE || ((host.qspi.ccr >> 24) & 0x3U) == 0))
+    {
+        qspi_launch();
+    }
+}
+
+static void qspi_write_dr(uintptr_t addr, size_t size)
+{
+    if (host.qspi.state != QSPI_COLLECT)
+    {
+        host_fault("QUADSPI DR written outside an indirect write", 0, 0);
+        return;
+    }
+    if (host.qspi.pos == 0)
+    {
+        host.qspi.start_at = host.cycles;
+    }
+    for (size_t i = 0; i < size && host.qspi.pos < host.qspi.count; i++)
+    {
+        host.qspi.buf[host.qspi.pos++] = ((volatile uint8_t *)addr)[i];
+    }
+    if (host.qspi.pos == host.qspi.count)
+    {
+        qspi_execute_write();
+    }
+}
+
+static void qspi_abort(void)
+{
+    host.qspi.state = QSPI_IDLE;
+    host.qspi.tc_pending = 0;
+    host.qspi.flags |= QSPI_SR_TCF;
+    host.qspi.done_at = host.cycles;
+    QREG(QSPI_CR) &= ~QSPI_CR_ABORT;
+}
+
+static void qspi_store(uintptr_t addr, size_t size)
+{
+    uint32_t off = (uint32_t)(addr - HOST_QSPI_BASE);
+
+    switch (off & ~3U)
+    {
+    case QSPI_CR:
+        if (QREG(QSPI_CR) & QSPI_CR_ABORT)
+        {
+            qspi_abort();
+        }
+        break;
+    case QSPI_FCR:
+        host.qspi.flags &= ~(QREG(QSPI_FCR) & (QSPI_SR_TEF | QSPI_SR_TCF | QSPI_SR_SMF | 0x10U));
+        QREG(QSPI_FCR) = 0;
+        break;
+    case QSPI_CCR:
+        qspi_write_ccr(QREG(QSPI_CCR));
+        break;
+    case QSPI_AR:
+        qspi_write_ar();
+        break;
+    case QSPI_DR:
+        qspi_write_dr(addr, size);
+        break;
+    default:
+        break;
+    }
+}
+
+static void qspi_load(uintptr_t addr, size_t size)
+{
+    uint32_t off = (uint32_t)(addr - HOST_QSPI_BASE);
+    uint32_t sr = 0;
+
+    if ((off & ~3U) == QSPI_SR)
+    {
+        qspi_poll_update();
+        if (host.qspi.state == QSPI_READ && host.qspi.pos == host.qspi.count)
+        {
+            host.qspi.state = QSPI_IDLE;
+            host.qspi.tc_pending = 1;
+        }
+        if (host.qspi.tc_pending && host.cycles >= host.qspi.done_at)
+        {
+            host.qspi.tc_pending = 0;
+            host.qspi.flags |= QSPI_SR_TCF;
+        }
+        /* An indirect write only starts with its first data byte */
+        if ((host.qspi.state != QSPI_IDLE && !(host.qspi.state == QSPI_COLLECT && host.qspi.pos == 0)) ||
+            host.qspi.tc_pending)
+        {
+            sr |= QSPI_SR_BUSY;
+        }
+        if ((host.qspi.state == QSPI_READ && host.qspi.pos < host.qspi.count) || host.qspi.state == QSPI_COLLECT)
+        {
+            sr |= QSPI_SR_FTF;
+        }
+        QREG(QSPI_SR) = sr | host.qspi.flags;
+    }
+    else if ((off & ~3U) == QSPI_DR)
+    {
+        uint32_t value = 0;
+
+        for (size_t i = 0; i < size; i++)
+        {
+            if (host.qspi.state == QSPI_READ && host.qspi.pos < host.qspi.count)
+            {
+                value |= (uint32_t)host.qspi.buf[host.qspi.pos++] << (8U * i);
+            }
+        }
+        QREG(QSPI_DR) = value;
+    }
+}
+
+/* CPU read through the memory-mapped window */
+static void window_load(uintptr_t addr, size_t size)
+{
+    uint32_t off = (uint32_t)(addr - HOST_WINDOW_BASE);
+    host_xfer_t x;
+    uint64_t sck = 0;
+
+    if (host.qspi.state != QSPI_MAPPED)
+    {
+        host_fault("read of 0x%08X outside memory-mapped mode", (uint32_t)addr, 0);
+        return;
+    }
+    if (off + size > host.flash_size)
+    {
+        host_fault("read of 0x%08X past the end of the flash", (uint32_t)addr, 0);
+        return;
+    }
+    qspi_describe(&x, host.qspi.ccr);
+    if (!host.qspi.mm_checked)
+    {
+        /* The flash model checks the read command once per mapping */
+        x.address = off;
+        qspi_call(&x, host.cycles);
+        host.qspi.mm_checked = 1;
+    }
+    if (off >= host.qspi.mm_fetched && off + size <= host.qspi.mm_next)
+    {
+        return;
+    }
+    if (off != host.qspi.mm_next)
+    {
+        /* Not sequential: the prefetch is dropped and a new command sent */
+        sck = qspi_header_sck(&x) + ((host.qspi.mm_next != UINT32_MAX) ? qspi_csht() : 0U);
+        host_stats.commands++;
+        host_stats.mapped_runs++;
+        host.qspi.mm_fetched = off;
+    }
+    sck += qspi_data_sck(&x, (uint32_t)size);
+    host.qspi.mm_next = off + (uint32_t)size;
+    host_stats.mapped_bytes += size;
+    qspi_bus(sck);
+    host_advance(qspi_core_cycles(sck));
+}
+
+/* ------------------------------------------------------------------ CRC */
+
+static uint32_t crc_reverse(uint32_t value, uint32_t bits)
+{
+    uint32_t out = 0;
+
+    for (uint32_t i = 0; i < bits; i++)
+    {
+        out |= ((value >> i) & 1U) << (bits - 1U - i);
+    }
+
+    return out;
+}
+
+/* A DR write of size bytes: input reversal within bytes, half-words or
+ * the word (never wider than the write), then MSB first through POL */
+static void crc_store(uintptr_t addr, size_t size)
+{
+    uint32_t cr = REG(CRC_BASE_ADDR + CRC_CR);
+    uint32_t pol = REG(CRC_BASE_ADDR + CRC_POL);
+    uint32_t width = (uint32_t)size * 8U;
+    uint32_t data = 0;
+
+    memcpy(&data, (const void *)addr, size);
+    if ((cr >> 5) & 0x3U)
+    {
+        uint32_t unit = 8U << (((cr >> 5) & 0x3U) - 1U);
+        uint32_t in = data;
+
+        unit = (unit < width) ? unit : width;
+        data = 0;
+        for (uint32_t i = 0; i < width; i += unit)
+        {
+            data |= crc_reverse(in >> i, unit) << i;
+        }
+    }
+    host.crc ^= (width == 32U) ? data : data << (32U - width);
+    for (uint32_t i = 0; i < width; i++)
+    {
+        host.crc = (host.crc & 0x80000000U) ? (host.crc << 1) ^ pol : host.crc << 1;
+    }
+}
+
+static void crc_commit(uintptr_t addr, size_t size)
+{
+    switch (addr - CRC_BASE_ADDR)
+    {
+    case CRC_DR:
+        crc_store(addr, size);
+        break;
+    case CRC_CR:
+        if (REG(CRC_BASE_ADDR + CRC_CR) & 1U)
+        {
+            host.crc = REG(CRC_BASE_ADDR + CRC_INIT);
+            REG(CRC_BASE_ADDR + CRC_CR) &= ~1U;
+        }
+        break;
+    case CRC_INIT:
+        host.crc = REG(CRC_BASE_ADDR + CRC_INIT);
+        break;
+    default:
+        break;
+    }
+}
+
+/* ------------------------------------------------------------ dispatch */
+
+static void host_commit(void)
+{
+    uintptr_t addr = host.pending;
+    size_t size = host.pending_size;
+
+    host.pending = 0;
+    if (addr >= HOST_QSPI_BASE && addr < HOST_QSPI_BASE + HOST_QSPI_SIZE)
+    {
+        qspi_store(addr, size);
+    }
+    else if (addr >= RCC_BASE_ADDR && addr < RCC_BASE_ADDR + 0x400)
+    {
+        host_clock_update();
+    }
+    else if (addr >= CRC_BASE_ADDR && addr < CRC_BASE_ADDR + 0x400)
+    {
+        crc_commit(addr, size);
+    }
+    else if (addr == DWT_CYCCNT_ADDR)
+    {
+        host.cyccnt_base = host.cycles - REG(DWT_CYCCNT_ADDR);
+    }
+    else if (addr >= HOST_WINDOW_BASE && addr < HOST_WINDOW_BASE + HOST_WINDOW_SIZE)
+    {
+        host_fault("write to the memory-mapped window at 0x%08X", (uint32_t)addr, 0);
+    }
+}
+
+static void host_patch(uintptr_t addr, size_t size)
+{
+    if (addr >= HOST_QSPI_BASE && addr < HOST_QSPI_BASE + HOST_QSPI_SIZE)
+    {
+        qspi_load(addr, size);
+    }
+    else if (addr >= HOST_WINDOW_BASE && addr < HOST_WINDOW_BASE + HOST_WINDOW_SIZE)
+    {
+        window_load(addr, size);
+    }
+    else if (addr == CRC_BASE_ADDR + CRC_DR)
+    {
+        uint32_t cr = REG(CRC_BASE_ADDR + CRC_CR);
+
+        REG(CRC_BASE_ADDR + CRC_DR) = (cr & 0x80U) ? crc_reverse(host.crc, 32) : host.crc;
+    }
+    else if (addr == DWT_CYCCNT_ADDR)
+    {
+        if (REG(DWT_CTRL_ADDR) & 1U)
+        {
+            REG(DWT_CYCCNT_ADDR) = (uint32_t)(host.cycles - host.cyccnt_base);
+        }
+    }
+    else if (addr >= RCC_BASE_ADDR && addr < RCC_BASE_ADDR + 0x400)
+    {
+        uint32_t cr = REG(RCC_BASE_ADDR + RCC_CR);
+        uint32_t cfgr = REG(RCC_BASE_ADDR + RCC_CFGR);
+
+        /* Ready flags follow the enables: MSI bit 1/0, HSI 10/8, HSE 17/16,
+         * PLL 25/24, PLLSAI1 27/26 */
+        cr &= ~((1U << 1) | (1U << 10) | (1U << 17) | (1U << 25) | (1U << 27));
+        cr |= ((cr & (1U << 0)) << 1) | ((cr & (1U << 8)) << 2) | ((cr & (1U << 16)) << 1) |
+              ((cr & (1U << 24)) << 1) | ((cr & (1U << 26)) << 1);
+        REG(RCC_BASE_ADDR + RCC_CR) = cr;
+        REG(RCC_BASE_ADDR + RCC_CFGR) = (cfgr & ~0xCU) | ((cfgr & 0x3U) << 2);
+    }
+}
+
+static inline int host_mapped(uintptr_t addr)
+{
+    uintptr_t top = addr >> 24;
+
+    return addr < 0x100000000ULL && (top == 0x40 || top == 0x48 || top == 0xA0 || top == 0xE0 || (top >> 4) == 0x9);
+}
+
+static inline void host_access(uintptr_t addr, size_t size, int store)
+{
+    host_stats.accesses++;
+    host_advance(1);
+    if (host.pending != 0)
+    {
+        host_commit();
+    }
+    if (!host_mapped(addr))
+    {
+        return;
+    }
+    if (store)
+    {
+        host.pending = addr;
+        host.pending_size = size;
+    }
+    else
+    {
+        host_patch(addr, size);
+    }
+}
+
+#define HOST_HOOKS(n)                                     \
+    void __asan_load##n##_noabort(uintptr_t addr)         \
+    {                                                     \
+        host_access(addr, n, 0);                          \
+    }                                                     \
+    void __asan_store##n##_noabort(uintptr_t addr)        \
+    {                                                     \
+        host_access(addr, n, 1);                          \
+    }
+
+HOST_HOOKS(1)
+HOST_HOOKS(2)
+HOST_HOOKS(4)
+HOST_HOOKS(8)
+HOST_HOOKS(16)
+
+void __asan_loadN_noabort(uintptr_t addr, size_t size)
+{
+    host_access(addr, size, 0);
+}
+
+void __asan_storeN_noabort(uintptr_t addr, size_t size)
+{
+    host_access(addr, size, 1);
+}
+
+void __asan_handle_no_return(void)
+{
+}
+
+/* ------------------------------------------------------------------ API */
+
+static int host_map(uintptr_t base, size_t size)
+{
+    void *p = mmap((void *)base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    return (p == (void *)base) ? 0 : -1;
+}
+
+/**
+ * @brief  Map the peripheral ranges and the memory-mapped window, then
+ *         reset the target. Call once per process.
+ * @param  flash_size: flash size in bytes, reads beyond it fault
+ * @retval 0 on success, -1 if an address range is not available
+ */
+int host_setup(uint32_t flash_size)
+{
+    if (!host.ready)
+    {
+        if (host_map(HOST_PERIPH_BASE, HOST_PERIPH_SIZE) || host_map(HOST_GPIO_BASE, HOST_GPIO_SIZE) ||
+            host_map(HOST_QSPI_BASE, HOST_QSPI_SIZE) || host_map(HOST_PPB_BASE, HOST_PPB_SIZE) ||
+            host_map(HOST_WINDOW_BASE, HOST_WINDOW_SIZE))
+        {
+            return -1;
+        }
+        host.ready = 1;
+    }
+    host.flash_size = flash_size;
+    memset((void *)HOST_WINDOW_BASE, 0xFF, HOST_WINDOW_SIZE);
+
+    return 0;
+}
+
+/**
+ * @brief  Power-on reset of the peripherals: registers at their reset
+ *         values, QUADSPI idle, core clock back on MSI 4 MHz. RAM, the
+ *         flash contents and the simulated time are kept.
+ */
+void host_reset(void)
+{
+    memset((void *)HOST_PERIPH_BASE, 0, HOST_PERIPH_SIZE);
+    memset((void *)HOST_GPIO_BASE, 0, HOST_GPIO_SIZE);
+    memset((void *)HOST_QSPI_BASE, 0, HOST_QSPI_SIZE);
+    memset((void *)HOST_PPB_BASE, 0, HOST_PPB_SIZE);
+    REG(RCC_BASE_ADDR + RCC_CR) = 0x00000063U;
+    REG(RCC_BASE_ADDR + RCC_PLLCFGR) = 0x00001000U;
+    REG(RCC_BASE_ADDR + RCC_CSR) = 0x00000600U;
+    REG(CRC_BASE_ADDR + CRC_DR) = 0xFFFFFFFFU;
+    REG(CRC_BASE_ADDR + CRC_INIT) = 0xFFFFFFFFU;
+    REG(CRC_BASE_ADDR + CRC_POL) = 0x04C11DB7U;
+    host.crc = 0xFFFFFFFFU;
+    host.qspi.state = QSPI_IDLE;
+    host.qspi.tc_pending = 0;
+    host.qspi.ccr = 0;
+    host.qspi.flags = 0;
+    host.qspi.count = 0;
+    host.qspi.pos = 0;
+    host.pending = 0;
+    host_clock_update();
+}
+
+void host_set_transact(host_transact_t transact)
+{
+    host.transact = transact;
+}
+
+/**
+ * @brief  Call a loader function with up to four integer or pointer
+ *         arguments (x86-64 SysV passes them all in registers, so a
+ *         shorter parameter list ignores the rest).
+ * @param  limit_us: watchdog in simulated microseconds, 0 for none
+ * @retval 0 when the function returned, -1 when it halted (see host_fault_text)
+ */
+int host_call(void *fn, const uint64_t *args, uint64_t *ret, double limit_us)
+{
+    jmp_buf halt;
+    uint64_t (*call)(uint64_t, uint64_t, uint64_t, uint64_t) = (uint64_t(*)(uint64_t, uint64_t, uint64_t, uint64_t))fn;
+
+    host.halt = &halt;
+    host.limit_ps = (limit_us > 0) ? host.ps + (uint64_t)(limit_us * 1e6) : 0;
+    if (setjmp(halt) != 0)
+    {
+        host.halt = NULL;
+        host.pending = 0;
+        return -1;
+    }
+    *ret = call(args[0], args[1], args[2], args[3]);
+    if (host.pending != 0)
+    {
+        host_commit();
+    }
+    host.halt = NULL;
+    host.limit_ps = 0;
+
+    return 0;
+}
+
+/**
+ * @brief  Load or store on behalf of an instruction set emulator
+ *         (tools/loader_emu.py). The emulator keeps the target RAM and
+ *         forwards the peripheral and memory-mapped window accesses here,
+ *         where they go through the same models as an instrumented access.
+ * @param  addr: target address in one of the ranges host_setup() maps
+ * @param  size: access width in bytes, 1, 2 or 4
+ * @param  store: nonzero for a store of *value
+ * @param  value: stored value, or the loaded value on return
+ * @param  cycles: core cycles the emulated code ran since the previous
+ *         access, this one included
+ */
+void host_bus_access(uint32_t addr, uint32_t size, int store, uint32_t *value, uint64_t cycles)
+{
+    if (!host_mapped(addr) || size > 4)
+    {
+        host_fault("%u byte access to unmapped 0x%08X", size, addr);
+        *value = 0;
+        return;
+    }
+    if (cycles > 1)
+    {
+        host_advance(cycles - 1);
+    }
+    host_access(addr, size, store);
+    if (store)
+    {
+        memcpy((void *)(uintptr_t)addr, value, size);
+        host_commit();
+    }
+    else
+    {
+        *value = 0;
+        memcpy(value, (void *)(uintptr_t)addr, size);
+    }
+}
+
+/**
+ * @brief  First fault recorded since the last call, cleared on return.
+ *         Copied into the caller's buffer.
+ */
+int host_fault_text(char *out, size_t size)
+{
+    int any = host.fault[0] != 0;
+
+    snprintf(out, size, "%s", host.fault);
+    host.fault[0] = 0;
+
+    return any;
+}
+
+/**
+ * @brief  Let time pass outside the loader (debugger round trips, host
+ *         downloads).
+ */
+void host_advance_us(double us)
+{
+    uint64_t ps = (uint64_t)(us * 1e6);
+
+    host.ps += ps;
+    host.cycles += ps / host.ps_per_cycle;
+}
+
+double host_time_us(void)
+{
+    return (double)host.ps / 1e6;
+}
+
+uint32_t host_core_clock(void)
+{
+    return host_core_hz();
+}
+
+/**
+ * @brief  Memory below 4 GB for buffers whose address the loader takes as
+ *         a uint32_t (Verify()'s RAMBufferAddr and the like).
+ */
+void *host_low_alloc(size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+
+    return (p == MAP_FAILED) ? NULL : p;
+}
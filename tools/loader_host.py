@@ -0,0 +1,458 @@
+#!/usr/bin/env python3
+"""Host build of the loader sources against a register-level target model.
+
+Compiles the driver and loader sources (Core/Src and the HAL modules they
+use, as for the SEGGER build) for the host and links them against
+tools/loader_host.c, which maps the peripheral address ranges at their
+STM32L433 addresses and gives RCC, DWT, CRC and QUADSPI their behaviour. The
+sources are built unchanged: tools/cmsis_host.h stands in for the
+Cortex-M intrinsics, and -fsanitize=kernel-address routes every load and
+store through the runtime's hooks, which is how register accesses reach
+the models and how CPU time is approximated.
+
+Every QUADSPI transaction reaches a w25q_model.Flash through
+Flash.transact(), so the command sequences of w25qxx.c and
+stm32l4xx_hal_qspi.c are checked against the W25Q16JV protocol
+(flash.errors) and the memory-mapped window at 0x90000000 mirrors the
+flash array. Loader wraps the entry points in Python signatures for the
+module tests, loader_bench.py and call_replay.py; the constants below
+mirror the loader headers for those and for flash_plan.py.
+
+    loader_host.py            build, Init() and print the driver call costs
+    loader_host.py -D LOADER_WRITE_CACHE=1
+"""
+
+import argparse
+import atexit
+import ctypes
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import zlib
+from concurrent.futures import ThreadPoolExecutor
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from w25q_model import ROOT, Flash  # noqa: E402
+
+TOOLS = os.path.join(ROOT, "tools")
+HAL = "Drivers/STM32L4xx_HAL_Driver/Src/stm32l4xx_hal%s.c"
+
+# The SEGGER source set (cmake/segger, cmake/common.cmake) minus the
+# startup, interrupt, libc and internal flash parts the host does not need
+SOURCES = ["Core/Src/%s.c" % name for name in (
+    "main", "gpio", "quadspi", "stm32l4xx_hal_msp", "system_stm32l4xx", "w25qxx", "timebase", "telemetry",
+    "qspi_trace", "call_trace", "crc32_hw", "manifest", "lz_decode", "write_cache", "rmw", "sector_map",
+    "mass_erase", "write_verify", "verify_policy", "stldr_loader", "segger_loader", "stream")] + [
+    HAL % suffix for suffix in ("", "_qspi", "_rcc", "_rcc_ex", "_gpio", "_pwr", "_pwr_ex", "_cortex", "_dma")]
+
+INCLUDES = ["Core/Inc", "Drivers/STM32L4xx_HAL_Driver/Inc", "Drivers/CMSIS/Device/ST/STM32L4xx/Include",
+            "Drivers/CMSIS/Include"]
+
+# -O0 keeps every register access; at higher levels the sanitizer drops
+# checks it considers redundant, among them the store of a read-modify-write
+CFLAGS = ["-O0", "-g", "-std=gnu11", "-fPIC", "-fno-common", "-fsanitize=kernel-address",
+          "--param", "asan-instrumentation-with-call-threshold=0", "--param", "asan-stack=0",
+          "--param", "asan-globals=0", "-DSTM32L433xx", "-DUSE_HAL_DRIVER", "-Dmain=loader_main",
+          "-include", os.path.join(TOOLS, "cmsis_host.h"), "-Wno-int-to-pointer-cast", "-Wno-pointer-to-int-cast"]
+
+LOADER_OK = 1
+LOADER_FAIL = 0
+
+# Batch() operation codes and status values (stldr_loader.h)
+BATCH_ERASE, BATCH_PROGRAM, BATCH_PROGRAM_COMPRESSED, BATCH_VERIFY, BATCH_CRC, BATCH_FILL, BATCH_MASS_ERASE = range(7)
+BATCH_STATUS_OK, BATCH_STATUS_FAIL, BATCH_STATUS_SKIPPED, BATCH_STATUS_BAD_OP = range(4)
+
+# verify_policy.h
+VERIFY_POLICY_DEFAULT, VERIFY_POLICY_FULL, VERIFY_POLICY_CRC, VERIFY_POLICY_SAMPLED = range(4)
+VERIFY_CONFIG_MAGIC = 0x50465256
+VERIFY_CRC_CHUNKS = 64
+
+CALL_LIMIT_US = 60e6    # watchdog per call, above the 25 s chip erase timeout
+
+_workdir = None
+_builds = {}
+_downloads = 0
+
+
+def verify_config(policy, base, image, chunk=0, every=0, seed=0):
+    """verify_config block contents for an image, as a host would fill it."""
+    crc = [zlib.crc32(image[pos:pos + chunk]) for pos in range(0, len(image), chunk)][:VERIFY_CRC_CHUNKS] if chunk else []
+    return {"policy": policy, "base": base, "size": len(image), "chunk": chunk, "every": every, "seed": seed,
+            "image_crc": zlib.crc32(image), "crc": crc}
+
+
+def verify_policy_mix(x):
+    """verify_policy_mix() of verify_policy.c"""
+    x ^= x >> 16
+    x = (x * 0x7FEB352D) & 0xFFFFFFFF
+    x ^= x >> 15
+    x = (x * 0x846CA68B) & 0xFFFFFFFF
+    x ^= x >> 16
+    return x
+
+
+def compiler():
+    cc = os.environ.get("CC") or shutil.which("cc") or shutil.which("gcc")
+    if not cc:
+        raise RuntimeError("no host C compiler found (set CC)")
+    return cc
+
+
+def workdir():
+    global _workdir
+    if _workdir is None:
+        _workdir = tempfile.mkdtemp(prefix="loader_host_")
+        atexit.register(shutil.rmtree, _workdir, True)
+    return _workdir
+
+
+def build_runtime():
+    path = os.path.join(workdir(), "libloader_host.so")
+    if not os.path.exists(path):
+        subprocess.run([compiler(), "-O2", "-std=gnu11", "-Wall", "-Wextra", "-shared", "-fPIC",
+                        "-Wl,-soname,libloader_host.so", os.path.join(TOOLS, "loader_host.c"), "-o", path],
+                       check=True)
+    return path
+
+
+def build(defines=()):
+    """Compile the loader with a set of -D options, once per process.
+    Returns the path of the shared object."""
+    key = tuple(sorted(defines))
+    if key in _builds:
+        return _builds[key]
+    runtime = build_runtime()
+    out = os.path.join(workdir(), "loader%d" % len(_builds))
+    os.makedirs(out)
+    cc = compiler()
+    flags = CFLAGS + ["-I" + os.path.join(ROOT, inc) for inc in INCLUDES] + ["-D" + d for d in key]
+
+    def compile_one(src):
+        obj = os.path.join(out, os.path.basename(src)[:-2] + ".o")
+        subprocess.run([cc] + flags + ["-c", os.path.join(ROOT, src), "-o", obj], check=True)
+        return obj
+
+    with ThreadPoolExecutor(max_workers=os.cpu_count() or 4) as pool:
+        objects = list(pool.map(compile_one, SOURCES))
+    lib = os.path.join(out, "libloader.so")
+    subprocess.run([cc, "-shared", "-o", lib] + objects + [runtime, "-Wl,--no-undefined",
+                                                          "-Wl,-rpath," + os.path.dirname(runtime)], check=True)
+    _builds[key] = lib
+    return lib
+
+
+class Xfer(ctypes.Structure):
+    """host_xfer_t"""
+    _fields_ = [("now_us", ctypes.c_double)] + [(name, ctypes.c_uint32) for name in (
+        "instruction", "imode", "address", "admode", "adsize", "alt", "abmode", "absize", "dummy", "dmode",
+        "ddr", "fmode", "nbytes")] + [("data", ctypes.POINTER(ctypes.c_uint8))]
+
+
+class Stats(ctypes.Structure):
+    """host_stats_t"""
+    _fields_ = [(name, ctypes.c_uint64) for name in (
+        "accesses", "commands", "sck_cycles", "polls", "mapped_runs", "mapped_bytes", "bus_ps")]
+
+
+TRANSACT = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.POINTER(Xfer))
+
+
+class HostHalt(RuntimeError):
+    """The loader stopped: Error_Handler() or the watchdog."""
+
+
+class HostFault(RuntimeError):
+    """An access the hardware would not have served as the code expects."""
+
+
+class Board:
+    """The simulated target: peripherals, time and the flash behind the
+    QUADSPI. The address ranges are process-wide, so there is one board."""
+
+    _board = None
+
+    @classmethod
+    def get(cls):
+        if cls._board is None:
+            cls._board = Board()
+        return cls._board
+
+    def __init__(self):
+        self.lib = ctypes.CDLL(build_runtime(), mode=ctypes.RTLD_GLOBAL)
+        self.lib.host_setup.argtypes = [ctypes.c_uint32]
+        self.lib.host_call.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint64),
+                                       ctypes.POINTER(ctypes.c_uint64), ctypes.c_double]
+        self.lib.host_advance_us.argtypes = [ctypes.c_double]
+        self.lib.host_time_us.restype = ctypes.c_double
+        self.lib.host_low_alloc.restype = ctypes.c_void_p
+        self.lib.host_low_alloc.argtypes = [ctypes.c_size_t]
+        self.lib.host_fault_text.argtypes = [ctypes.c_char_p, ctypes.c_size_t]
+        self.stats = Stats.in_dll(self.lib, "host_stats")
+        self._callback = TRANSACT(self._transact)
+        self.lib.host_set_transact(self._callback)
+        self.arena_size = 8 << 20
+        self.arena = self.lib.host_low_alloc(self.arena_size)
+        self.arena_used = 0
+        self.flash = None
+        self.attach(Flash())
+
+    def attach(self, flash):
+        """Put a flash model behind the QUADSPI and power-cycle the board."""
+        if self.lib.host_setup(flash.geo.size) != 0:
+            raise RuntimeError("cannot map the STM32 address ranges on this host")
+        self.flash = flash
+        flash.on_change = self._mirror
+        self.sync()
+        self.reset()
+
+    def reset(self):
+        """Power-on reset of the MCU peripherals and the flash."""
+        self.lib.host_reset()
+        self.flash.power_on()
+
+    def sync(self):
+        """Copy the whole array to the window after editing flash.mem."""
+        self._mirror(0, self.flash.geo.size)
+
+    def _mirror(self, start, end):
+        ctypes.memmove(self.flash.geo.base + start, bytes(self.flash.mem[start:end]), end - start)
+
+    def _transact(self, ptr):
+        x = ptr.contents
+        written = ctypes.string_at(x.data, x.nbytes) if x.fmode == 0 and x.nbytes else b""
+        try:
+            out = self.flash.transact(x.now_us, x.instruction, x.imode, x.address, x.admode, x.adsize, x.alt,
+                                      x.abmode, x.absize, x.dummy, x.dmode, x.ddr, written,
+                                      x.nbytes if x.fmode in (1, 2) else 0, mapped=x.fmode == 3)
+        except Exception as e:  # an exception cannot cross the C callback
+            self.flash.errors.append("model: %r" % e)
+            return -1
+        if out and x.fmode in (1, 2):
+            ctypes.memmove(x.data, out, min(len(out), x.nbytes))
+        return 0
+
+    @property
+    def time_us(self):
+        return self.lib.host_time_us()
+
+    def advance_us(self, us):
+        self.lib.host_advance_us(us)
+
+    def fault(self):
+        buf = ctypes.create_string_buffer(256)
+        return buf.value.decode() if self.lib.host_fault_text(buf, len(buf)) else None
+
+    def put(self, data):
+        """Copy bytes to memory below 4 GB, return the address. Valid until
+        free_all()."""
+        size = (len(data) + 7) & ~7
+        if self.arena_used + size > self.arena_size:
+            raise MemoryError("host buffer arena exhausted")
+        addr = self.arena + self.arena_used
+        self.arena_used += size
+        ctypes.memmove(addr, bytes(data), len(data))
+        return addr
+
+    def free_all(self):
+        self.arena_used = 0
+
+
+class Target:
+    """One download of the loader: a fresh copy of the shared object, so
+    .data and .bss start from their initial values as after the debugger
+    loads the loader into RAM, while the board keeps its state."""
+
+    def __init__(self, defines=(), board=None):
+        global _downloads
+        self.board = board or Board.get()
+        path = build(defines)
+        _downloads += 1
+        copy = "%s.%d" % (path, _downloads)
+        shutil.copyfile(path, copy)
+        self.lib = ctypes.CDLL(copy)
+        self.defines = tuple(defines)
+
+    def call(self, name, *args, restype=ctypes.c_int, limit_us=CALL_LIMIT_US):
+        """Run a loader function. Arguments are integers (addresses from
+        Board.put() for pointers). Raises HostHalt when it does not return
+        and HostFault on an access the hardware would not serve."""
+        fn = ctypes.cast(getattr(self.lib, name), ctypes.c_void_p).value
+        argv = (ctypes.c_uint64 * 4)(*[a & 0xFFFFFFFFFFFFFFFF for a in args] + [0] * (4 - len(args)))
+        ret = ctypes.c_uint64()
+        rc = self.board.lib.host_call(fn, argv, ctypes.byref(ret), limit_us)
+        fault = self.board.fault()
+        if rc != 0:
+            raise HostHalt("%s: %s" % (name, fault))
+        if fault:
+            raise HostFault("%s: %s" % (name, fault))
+        if restype is None:
+            return None
+        return restype(ret.value & ((1 << (8 * ctypes.sizeof(restype))) - 1)).value
+
+    def var(self, ctype, name):
+        return ctype.in_dll(self.lib, name)
+
+
+class Loader:
+    """The STM32CubeProgrammer and SEGGER entry points with Python buffers,
+    run on a Target built with the given options on a freshly powered board.
+    Buffers are placed with Board.put() for the duration of one call; time
+    and command counts are the board's since reset_stats()."""
+
+    def __init__(self, defines=(), flash=None):
+        self.board = Board.get()
+        self.board.attach(flash or Flash())
+        self.target = Target(defines, self.board)
+        self.flash = self.board.flash
+        self.geo = self.flash.geo
+        self._verify_config = None
+        self.reset_stats()
+
+    def reset_stats(self):
+        self.flash.reset_stats()
+        self._t0 = self.board.time_us
+        self._c0 = self.board.stats.commands
+
+    @property
+    def time_us(self):
+        return self.board.time_us - self._t0
+
+    @property
+    def commands(self):
+        return self.board.stats.commands - self._c0
+
+    def cpu(self, us):
+        """Time spent outside the loader, e.g. on the debug link."""
+        self.board.advance_us(us)
+
+    def _call(self, name, *args, restype=ctypes.c_int):
+        try:
+            return self.target.call(name, *args, restype=restype)
+        finally:
+            self.board.free_all()
+
+    @property
+    def verify_config(self):
+        return self._verify_config
+
+    @verify_config.setter
+    def verify_config(self, cfg):
+        """Fill the verify_config block (LOADER_VERIFY_POLICIES builds) as the
+        host does, the magic last."""
+        block = (ctypes.c_uint32 * (8 + VERIFY_CRC_CHUNKS)).in_dll(self.target.lib, "verify_config")
+        block[0] = 0
+        block[1:8] = [cfg["policy"], cfg["base"], cfg["size"], cfg["chunk"], cfg["every"], cfg["seed"],
+                      cfg["image_crc"]]
+        block[8:8 + len(cfg["crc"])] = cfg["crc"]
+        block[0] = VERIFY_CONFIG_MAGIC
+        self._verify_config = cfg
+
+    def sampled_pages(self, addr, size):
+        """Pages of [addr, addr + size) the sampled policy compares."""
+        cfg = self._verify_config
+        every = cfg["every"] or 1
+        first = (addr - self.geo.base) // self.geo.page
+        last = (addr + size - 1 - self.geo.base) // self.geo.page
+        return [self.geo.base + p * self.geo.page for p in range(first, last + 1)
+                if verify_policy_mix(p ^ cfg["seed"]) % every == 0]
+
+    def Init(self):
+        return self._call("Init")
+
+    def Write(self, addr, data):
+        return self._call("Write", addr, len(data), self.board.put(data))
+
+    def Read(self, addr, size):
+        buf = self.board.put(bytes(size))
+        try:
+            if self.target.call("Read", addr, size, buf) != 1:
+                return None
+            return ctypes.string_at(buf, size)
+        finally:
+            self.board.free_all()
+
+    def SectorErase(self, start, end):
+        return self._call("SectorErase", start, end)
+
+    def MassErase(self):
+        return self._call("MassErase")
+
+    def CheckSum(self, addr, size, init=0):
+        return self._call("CheckSum", addr, size, init, restype=ctypes.c_uint32)
+
+    def Verify(self, addr, buf):
+        """Returns the failing address reported by Verify() or None. The
+        length is passed in words, as STM32CubeProgrammer does."""
+        if len(buf) % 4:
+            raise ValueError("Verify() takes whole words")
+        result = self._call("Verify", addr, self.board.put(buf), len(buf) // 4, 0, restype=ctypes.c_uint64)
+        return (result & 0xFFFFFFFF) or None
+
+    def WriteCompressed(self, addr, blob):
+        return self._call("WriteCompressed", addr, len(blob), self.board.put(blob))
+
+    def Fill(self, addr, size, pattern):
+        return self._call("Fill", addr, size, self.board.put(pattern), len(pattern))
+
+    def SectorCrc(self, addr, size):
+        first = (addr - self.geo.base) // self.geo.sector
+        last = (addr + size - 1 - self.geo.base) // self.geo.sector
+        table = self.board.put(bytes(4 * (last - first + 1)))
+        try:
+            count = self.target.call("SectorCrc", addr, size, table)
+            return list((ctypes.c_uint32 * count).from_address(table))
+        finally:
+            self.board.free_all()
+
+    def SEGGER_FL_Erase(self, addr, index, count):
+        return self._call("SEGGER_FL_Erase", addr, index, count)
+
+    def SEGGER_FL_Verify(self, addr, buf):
+        """Returns the failing address or None, SEGGER_FL_Verify() returns
+        the end of the range when it passes."""
+        result = self._call("SEGGER_FL_Verify", addr, len(buf), self.board.put(buf), restype=ctypes.c_uint32)
+        return None if result == addr + len(buf) else result
+
+    def SEGGER_FL_CheckBlank(self, addr, size, blank=0xFF):
+        return self._call("SEGGER_FL_CheckBlank", addr, size, blank)
+
+    def SEGGER_FL_CalcCRC(self, crc, addr, size, poly):
+        return self._call("SEGGER_FL_CalcCRC", crc, addr, size, poly, restype=ctypes.c_uint32)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-D", dest="defines", action="append", default=[], help="build option, as for the compiler")
+    args = parser.parse_args()
+
+    board = Board.get()
+    target = Target(args.defines, board)
+    flash = board.flash
+    page = bytes(range(256))
+    rows = []
+
+    def measure(name, fn):
+        t, cmds = board.time_us, board.stats.commands
+        fn()
+        rows.append((name, board.time_us - t, board.stats.commands - cmds))
+
+    measure("Init (from reset)", lambda: target.call("Init"))
+    measure("Init (configured)", lambda: target.call("Init"))
+    measure("sector erase", lambda: target.call("w25qxx_erase_sector", 0))
+    measure("page program (256 B)", lambda: target.call("w25qxx_write", board.put(page), 0, len(page)))
+    measure("read 256 B (0xEB)", lambda: target.call("w25qxx_read", board.put(bytes(256)), 0, 256))
+    measure("enter memory-mapped", lambda: target.call("w25qxx_enter_memory_mapped_mode"))
+
+    print("core clock %.1f MHz" % (board.lib.host_core_clock() / 1e6))
+    print("%-24s %13s %6s" % ("driver call", "sim us", "cmds"))
+    for name, us, cmds in rows:
+        print("%-24s %13.1f %6d" % (name, us, cmds))
+    for e in flash.errors:
+        print("flash: %s" % e)
+    return 1 if flash.errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+"""Inspect a built loader artifact (.stldr, .SFL, .FLM or Loader .elf).
+
+Reports, for the exact binary that ships:
+  * the entry points STM32CubeProgrammer / J-Link look up, with their
+    address, code size and static Thumb-2 instruction and call counts
+    (whole reachable call tree included, so inlining and -O changes show up)
+  * the StorageInfo / FlashDevice descriptors, cross-checked against the
+    geometry in w25qxx.h
+  * the RAM footprint of each section against the DIAG region
+
+Pass --compare OLD to print per-entry-point deltas against an earlier
+build, e.g. to judge a compiler flag or driver change.
+
+The counts here are static; loader_emu.py runs the same binary and
+reports the instructions each call executes and its QUADSPI bus time.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from w25q_model import Geometry  # noqa: E402
+
+STLDR_ENTRIES = ["Init", "Write", "Read", "SectorErase", "MassErase", "CheckSum", "Verify", "SectorCrc",
+                 "WriteCompressed", "Fill", "Batch"]
+SEGGER_ENTRIES = ["SEGGER_FL_Prepare", "SEGGER_FL_Restore", "SEGGER_FL_Program", "SEGGER_FL_Erase",
+                  "SEGGER_FL_EraseChip", "SEGGER_FL_Read", "SEGGER_FL_Verify", "SEGGER_FL_CheckBlank",
+                  "SEGGER_FL_CalcCRC", "SEGGER_FL_Fill", "SEGGER_OPEN_Program", "StreamStart"]
+FLM_ENTRIES = ["Init", "UnInit", "EraseChip", "EraseSector", "ProgramPage", "BlankCheck", "Verify"]
+
+DIAG_START = 0x2000E000
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1 or self.data[5] != 1:
+            raise ValueError("not a little-endian ELF32 file")
+        (self.shoff,) = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<3H", self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            name, stype, flags, addr, offset, size, link, info, _, entsize = struct.unpack_from(
+                "<10I", self.data, self.shoff + i * shentsize)
+            self.sections.append({"name": name, "type": stype, "flags": flags, "addr": addr,
+                                  "offset": offset, "size": size, "link": link, "info": info,
+                                  "entsize": entsize})
+        strtab = self.sections[shstrndx]
+        for s in self.sections:
+            s["name"] = self._str(strtab, s["name"])
+        self.symbols = {}
+        for s in self.sections:
+            if s["type"] != 2:  # SHT_SYMTAB
+                continue
+            names = self.sections[s["link"]]
+            for off in range(s["offset"], s["offset"] + s["size"], 16):
+                name, value, size, info, _, shndx = struct.unpack_from("<IIIBBH", self.data, off)
+                if name and shndx:
+                    self.symbols[self._str(names, name)] = (value, size, info & 0xF)
+
+    def _str(self, sec, off):
+        start = sec["offset"] + off
+        return self.data[start:self.data.index(b"\0", start)].decode()
+
+    def read(self, addr, size):
+        for s in self.sections:
+            if s["type"] != 8 and s["addr"] <= addr and addr + size <= s["addr"] + s["size"]:  # not NOBITS
+                off = s["offset"] + addr - s["addr"]
+                return self.data[off:off + size]
+        return None
+
+    def function_at(self, addr):
+        for name, (value, size, kind) in self.symbols.items():
+            if kind == 2 and (value & ~1) == addr:
+                return name
+        return None
+
+
+def thumb_scan(code, base):
+    """Count Thumb-2 instructions and collect BL targets."""
+    count = 0
+    targets = set()
+    pc = 0
+    while pc + 2 <= len(code):
+        hw1 = struct.unpack_from("<H", code, pc)[0]
+        if (hw1 >> 11) in (0x1D, 0x1E, 0x1F) and pc + 4 <= len(code):
+            hw2 = struct.unpack_from("<H", code, pc + 2)[0]
+            if (hw1 >> 11) == 0x1E and (hw2 & 0xD000) == 0xD000:  # BL imm
+                s = (hw1 >> 10) & 1
+                j1 = (hw2 >> 13) & 1
+                j2 = (hw2 >> 11) & 1
+                i1 = 1 - (j1 ^ s)
+                i2 = 1 - (j2 ^ s)
+                imm = (s << 24) | (i1 << 23) | (i2 << 22) | ((hw1 & 0x3FF) << 12) | ((hw2 & 0x7FF) << 1)
+                if s:
+                    imm -= 1 << 25
+                targets.add(base + pc + 4 + imm)
+            pc += 4
+        else:
+            pc += 2
+        count += 1
+    return count, targets
+
+
+def analyse(elf, name):
+    if name not in elf.symbols:
+        return None
+    value, size, _ = elf.symbols[name]
+    seen = set()
+    todo = [value & ~1]
+    total_size = total_insns = 0
+    own = None
+    while todo:
+        addr = todo.pop()
+        if addr in seen:
+            continue
+        seen.add(addr)
+        fn = elf.function_at(addr)
+        if fn is None:
+            continue
+        fsize = elf.symbols[fn][1]
+        code = elf.read(addr, fsize)
+        if code is None:
+            continue
+        insns, targets = thumb_scan(code, addr)
+        if own is None:
+            own = (addr, fsize, insns, len(targets))
+        total_size += fsize
+        total_insns += insns
+        todo.extend(targets)
+    addr, fsize, insns, calls = own
+    return {"address": addr, "size": fsize, "insns": insns, "calls": calls,
+            "tree_size": total_size, "tree_insns": total_insns, "tree_functions": len(seen)}
+
+
+def check_descriptor(elf, geo):
+    lines = []
+    usable = geo.size
+    if "manifest_commit" in elf.symbols:
+        # LOADER_MANIFEST: the last sector holds the fingerprint manifest
+        usable -= geo.sector
+        lines.append("manifest at 0x%08X, usable size 0x%X" % (geo.base + usable, usable))
+    if "StorageInfo" in elf.symbols:
+        raw = elf.read(elf.symbols["StorageInfo"][0], 120 + 8 * 10)
+        name = raw[:100].split(b"\0")[0].decode()
+        dev_type, start, size, page, erase = struct.unpack_from("<H2xIIIB", raw, 100)
+        sectors = struct.unpack_from("<2I", raw, 120)
+        lines.append("StorageInfo '%s' type %d @0x%08X size 0x%X page %d erase 0x%02X sectors %d x 0x%X" % (
+            name, dev_type, start, size, page, erase, sectors[0], sectors[1]))
+        expect = [(start, geo.base, "start"), (size, usable, "size"), (sectors[0] * sectors[1], usable, "sector span")]
+        lines += ["  MISMATCH %s: 0x%X != 0x%X" % (what, got, want) for got, want, what in expect if got != want]
+    if "FlashDevice" in elf.symbols:
+        raw = elf.read(elf.symbols["FlashDevice"][0], 168)
+        vers = struct.unpack_from("<H", raw, 0)[0]
+        name = raw[2:130].split(b"\0")[0].decode()
+        dev_type, adr, size, page, _, empty, to_prog, to_erase, ssize, saddr = struct.unpack_from(
+            "<HIIIIB3xIIII", raw, 130)
+        lines.append("FlashDevice '%s' v0x%04X type %d @0x%08X size 0x%X page %d erase 0x%02X "
+                     "timeouts %d/%d ms sector 0x%X@0x%X" % (name, vers, dev_type, adr, size, page, empty,
+                                                               to_prog, to_erase, ssize, saddr))
+        expect = [(adr, geo.base, "start"), (size, usable, "size")]
+        lines += ["  MISMATCH %s: 0x%X != 0x%X" % (what, got, want) for got, want, what in expect if got != want]
+    return lines
+
+
+def footprint(elf):
+    lines = []
+    for s in elf.sections:
+        if not (s["flags"] & 2) or s["size"] == 0:  # SHF_ALLOC
+            continue
+        end = s["addr"] + s["size"]
+        note = ""
+        if s["name"] not in (".telemetry", ".trace", ".calltrace") and s["addr"] < DIAG_START < end:
+            note = "  <-- overlaps DIAG"
+        lines.append("  %-14s 0x%08X %7d%s" % (s["name"], s["addr"], s["size"], note))
+    return lines
+
+
+def report(path):
+    elf = Elf(path)
+    names = FLM_ENTRIES if "ProgramPage" in elf.symbols else STLDR_ENTRIES + SEGGER_ENTRIES
+    entries = [e for e in names if e in elf.symbols]
+    return elf, {e: analyse(elf, e) for e in entries}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="W25Q16_STM32L4xx-QSPI.stldr, W25Q16_STM32L4xx.SFL, W25Q16_STM32L4xx_FLM.FLM or Loader.elf")
+    parser.add_argument("--compare", metavar="OLD", help="earlier build of the same artifact")
+    args = parser.parse_args()
+
+    try:
+        elf, new = report(args.elf)
+        old = report(args.compare)[1] if args.compare else {}
+    except (OSError, ValueError, struct.error) as e:
+        sys.exit(str(e))
+
+    if "ProgramPage" in elf.symbols:
+        expected = FLM_ENTRIES
+    else:
+        expected = ((STLDR_ENTRIES if "StorageInfo" in elf.symbols else [])
+                    + (SEGGER_ENTRIES if "FlashDevice" in elf.symbols else []))
+    missing = [e for e in expected if e not in new]
+    for line in check_descriptor(elf, Geometry()):
+        print(line)
+    if missing:
+        print("missing entry points: " + ", ".join(missing))
+
+    print("%-22s %10s %6s %6s %5s %9s %9s" % ("entry point", "address", "bytes", "insns", "calls",
+                                                "tree B", "tree ins"))
+    for name, r in new.items():
+        line = "%-22s 0x%08X %6d %6d %5d %9d %9d" % (name, r["address"], r["size"], r["insns"], r["calls"],
+                                                     r["tree_size"], r["tree_insns"])
+        if name in old and old[name]:
+            line += "   (%+d B, %+d insns)" % (r["tree_size"] - old[name]["tree_size"],
+                                              r["tree_insns"] - old[name]["tree_insns"])
+        print(line)
+
+    print("sections:")
+    for line in footprint(elf):
+        print(line)
+
+    sys.exit(1 if missing else 0)
+
+
+if __name__ == "__main__":
+    main()
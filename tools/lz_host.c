@@ -0,0 +1,58 @@
+/* Host build of the loader's WLZ1 decoder (Core/Src/lz_decode.c), used by
+ * lz_pack.py --verify. Reads a stream from stdin, writes the decoded data
+ * to stdout. An optional argument sets the destination address so the
+ * page-aligned flushing is exercised the same way as on target.
+ *
+ *     cc -I../Core/Inc lz_host.c ../Core/Src/lz_decode.c -o lz_host
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "lz_decode.h"
+
+static int sink(void *ctx, uint32_t offset, const uint8_t *data, uint32_t size)
+{
+    uint32_t *expected = ctx;
+
+    /* Chunks must arrive in order and never cross a flush boundary */
+    if (offset != *expected || size == 0 || size > LZ_FLUSH)
+    {
+        return -1;
+    }
+    *expected += size;
+
+    return (fwrite(data, 1, size, stdout) == size) ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t base = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x90000000U;
+    uint32_t expected = 0;
+    size_t cap = 1 << 16;
+    size_t len = 0;
+    uint8_t *buf = malloc(cap);
+    int32_t ret;
+
+    for (size_t n; buf && (n = fread(buf + len, 1, cap - len, stdin)) > 0;)
+    {
+        len += n;
+        if (len == cap)
+        {
+            buf = realloc(buf, cap *= 2);
+        }
+    }
+    if (!buf)
+    {
+        return 2;
+    }
+
+    ret = lz_decode(buf, (uint32_t)len, base, sink, &expected);
+    free(buf);
+    if (ret < 0)
+    {
+        fprintf(stderr, "lz_decode failed: %d\n", (int)ret);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+"""Compress an image for the loader's WriteCompressed entry point.
+
+The WLZ1 format (Core/Inc/lz_decode.h) is a byte-oriented LZ77 with a 4K
+window, sized for the loader's RAM and decoded one flash page at a time.
+
+    lz_pack.py firmware.bin firmware.wlz     compress
+    lz_pack.py -d firmware.wlz firmware.bin  decompress (reference decoder)
+    lz_pack.py --verify firmware.bin         round trip through the C decoder
+                                             built for the host with cc
+
+Streams larger than the loader's RAM buffer should be cut with --chunk,
+one stream per WriteCompressed call; each chunk decodes independently.
+"""
+
+import argparse
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+MAGIC = 0x315A4C57
+WINDOW = 4096
+MIN_MATCH = 3
+MAX_MATCH = 0x7F + MIN_MATCH
+MAX_LITERALS = 0x80
+MAX_CHAIN = 32
+
+ROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+
+
+def compress(data):
+    """Greedy matcher with one-step lazy evaluation over hash chains."""
+    data = bytes(data)
+    out = bytearray(struct.pack("<2I", MAGIC, len(data)))
+    heads = {}
+    prev = [0] * len(data)
+    literals = bytearray()
+
+    def flush_literals():
+        for pos in range(0, len(literals), MAX_LITERALS):
+            chunk = literals[pos:pos + MAX_LITERALS]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+        literals.clear()
+
+    def insert(i):
+        if i + MIN_MATCH <= len(data):
+            key = data[i:i + MIN_MATCH]
+            prev[i] = heads.get(key, -1)
+            heads[key] = i
+
+    def longest(i):
+        best_len, best_dist = 0, 0
+        if i + MIN_MATCH > len(data):
+            return best_len, best_dist
+        cand = heads.get(data[i:i + MIN_MATCH], -1)
+        limit = min(MAX_MATCH, len(data) - i)
+        for _ in range(MAX_CHAIN):
+            if cand < 0 or i - cand > WINDOW:
+                break
+            n = MIN_MATCH
+            while n < limit and data[cand + n] == data[i + n]:
+                n += 1
+            if n > best_len:
+                best_len, best_dist = n, i - cand
+                if n == limit:
+                    break
+            cand = prev[cand]
+        return best_len, best_dist
+
+    i = 0
+    while i < len(data):
+        length, dist = longest(i)
+        if length >= MIN_MATCH:
+            insert(i)
+            # Lazy step: prefer a longer match starting at the next byte
+            nlen, _ = longest(i + 1)
+            if nlen > length + 1:
+                literals.append(data[i])
+                i += 1
+                continue
+            flush_literals()
+            out.append(0x80 | (length - MIN_MATCH))
+            out.extend(struct.pack("<H", dist - 1))
+            for j in range(i + 1, i + length):
+                insert(j)
+            i += length
+        else:
+            insert(i)
+            literals.append(data[i])
+            i += 1
+    flush_literals()
+    return bytes(out)
+
+
+def decompress(blob):
+    magic, size = struct.unpack_from("<2I", blob)
+    if magic != MAGIC:
+        raise ValueError("not a WLZ1 stream")
+    out = bytearray()
+    pos = 8
+    while len(out) < size:
+        token = blob[pos]
+        pos += 1
+        if token < MAX_LITERALS:
+            out += blob[pos:pos + token + 1]
+            pos += token + 1
+        else:
+            dist = struct.unpack_from("<H", blob, pos)[0] + 1
+            pos += 2
+            if dist > len(out):
+                raise ValueError("match before start of stream")
+            for _ in range((token & 0x7F) + MIN_MATCH):
+                out.append(out[-dist])
+    if len(out) != size:
+        raise ValueError("stream decodes to %d bytes, header says %d" % (len(out), size))
+    return bytes(out)
+
+
+def chunks(data, size):
+    if not size:
+        return [data]
+    return [data[i:i + size] for i in range(0, len(data), size)]
+
+
+def build_host_decoder(workdir):
+    cc = os.environ.get("CC") or shutil.which("cc") or shutil.which("gcc")
+    if not cc:
+        raise RuntimeError("no host C compiler found (set CC)")
+    exe = os.path.join(workdir, "lz_host")
+    subprocess.run([cc, "-O2", "-std=c11", "-Wall", "-Wextra", "-I", os.path.join(ROOT, "Core", "Inc"),
+                    os.path.join(ROOT, "tools", "lz_host.c"), os.path.join(ROOT, "Core", "Src", "lz_decode.c"),
+                    "-o", exe], check=True)
+    return exe
+
+
+def verify(data, chunk, base):
+    with tempfile.TemporaryDirectory() as tmp:
+        exe = build_host_decoder(tmp)
+        total = 0
+        for n, part in enumerate(chunks(data, chunk)):
+            blob = compress(part)
+            addr = base + n * (chunk or 0)
+            for name, got in (("python", decompress(blob)),
+                              ("C", subprocess.run([exe, hex(addr)], input=blob, capture_output=True,
+                                                   check=True).stdout)):
+                if got != part:
+                    raise ValueError("%s decoder mismatch in chunk %d" % (name, n))
+            total += len(blob)
+    return total
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input")
+    parser.add_argument("output", nargs="?")
+    parser.add_argument("-d", "--decompress", action="store_true", help="decompress instead")
+    parser.add_argument("--chunk", type=lambda s: int(s, 0), default=0,
+                        help="split into independent streams of this many input bytes")
+    parser.add_argument("--base", type=lambda s: int(s, 0), default=0x90000000,
+                        help="destination address, for --verify (default 0x90000000)")
+    parser.add_argument("--verify", action="store_true",
+                        help="round-trip through the Python and host-built C decoders")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    try:
+        if args.verify:
+            packed = verify(data, args.chunk, args.base)
+            print("ok: %d -> %d bytes (%.2fx)" % (len(data), packed, len(data) / max(packed, 1)))
+            return 0
+        if args.decompress:
+            result = decompress(data)
+        else:
+            result = b"".join(compress(part) for part in chunks(data, args.chunk))
+    except (ValueError, RuntimeError, subprocess.CalledProcessError, struct.error) as e:
+        sys.exit(str(e))
+
+    if not args.output:
+        parser.error("output file required")
+    with open(args.output, "wb") as f:
+        f.write(result)
+    if not args.decompress:
+        print("%d -> %d bytes (%.2fx)" % (len(data), len(result), len(data) / max(len(result), 1)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
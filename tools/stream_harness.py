@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Host harness for the streaming mailbox (StreamStart, stream.h).
+
+Builds Core/Src/stream.c for the host together with tools/stream_host.c,
+which plays the J-Link side of the mailbox against a RAM flash model, and
+checks that an image arrives intact for a range of block sizes and
+alignments, and that a session the host never stops ends with
+STREAM_ERR_TIMEOUT (built with a short STREAM_TIMEOUT_MS). It then estimates, with the w25q_model timing, what streaming
+saves over one SEGGER_FL_Program call per block:
+
+    stream_harness.py firmware.bin
+    stream_harness.py firmware.bin --swd-kbps 4000 --rtt-us 300
+
+Per-call:  download + round trip + program, for every block
+Streaming: download of the first block, then max(download, program)
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from w25q_model import ROOT, Flash, parse_defines  # noqa: E402
+
+TIMEOUT_MS = 200    # STREAM_TIMEOUT_MS of the host build
+
+
+def build(workdir):
+    cc = os.environ.get("CC") or shutil.which("cc") or shutil.which("gcc")
+    if not cc:
+        raise RuntimeError("no host C compiler found (set CC)")
+    exe = os.path.join(workdir, "stream_host")
+    subprocess.run([cc, "-O2", "-std=gnu11", "-pthread", "-Wall", "-Wextra", "-DSTREAM_TIMEOUT_MS=%d" % TIMEOUT_MS,
+                    "-I", os.path.join(ROOT, "Core", "Inc"),
+                    os.path.join(ROOT, "tools", "stream_host.c"), os.path.join(ROOT, "Core", "Src", "stream.c"),
+                    "-o", exe], check=True)
+    return exe
+
+
+def estimate(data, block, swd_kbps, rtt_us):
+    flash = Flash()
+    download_us = block * 8 * 1000.0 / swd_kbps
+    per_call = streaming = 0.0
+    for pos in range(0, len(data), block):
+        before = flash.time_us
+        flash.write(pos, data[pos:pos + block])
+        program_us = flash.time_us - before
+        per_call += download_us + rtt_us + program_us
+        streaming += max(download_us, program_us) if pos else download_us + program_us
+    return per_call, streaming
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="binary image to stream")
+    parser.add_argument("--swd-kbps", type=float, default=4000.0, help="debug link RAM download rate (default 4000)")
+    parser.add_argument("--rtt-us", type=float, default=300.0,
+                        help="halt / run / breakpoint cost per loader call (default 300)")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        data = f.read()
+    slot = parse_defines("Core/Inc/stream.h")["STREAM_SLOT_SIZE"]
+
+    with tempfile.TemporaryDirectory() as tmp:
+        try:
+            exe = build(tmp)
+        except (RuntimeError, subprocess.CalledProcessError) as e:
+            sys.exit(str(e))
+        for base, block in ((0x90000000, slot), (0x90000000, 256), (0x90000003, slot // 4 + 1)):
+            run = subprocess.run([exe, args.image, hex(base), str(block)], capture_output=True, text=True)
+            print("block %5d @0x%08X: %s" % (block, base, (run.stdout + run.stderr).strip()))
+            if run.returncode:
+                sys.exit("stream round trip failed")
+        run = subprocess.run([exe, args.image, "0x90000000", str(slot), "0", "0", "0"], capture_output=True, text=True)
+        print("no stop, %d ms timeout: %s" % (TIMEOUT_MS, (run.stdout + run.stderr).strip()))
+        if run.returncode:
+            sys.exit("stream timeout failed")
+
+    per_call, streaming = estimate(data, slot, args.swd_kbps, args.rtt_us)
+    print("estimate for %d bytes in %d byte blocks: per-call %.1f ms, streaming %.1f ms (%.2fx)" % (
+        len(data), slot, per_call / 1000, streaming / 1000, per_call / streaming))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
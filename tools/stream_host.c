@@ -0,0 +1,151 @@
+/* Host build of the streaming mailbox loop (Core/Src/stream.c), used by
+ * stream_harness.py. One thread runs stream_run() against a RAM model of
+ * the flash (NOR semantics: programming only clears bits), the main thread
+ * plays J-Link: it waits for the loader, downloads the image block by
+ * block into the mailbox slots and stops the session. The flash contents
+ * are then compared with the image. With stop 0 the session is never
+ * stopped and the loader has to end it with STREAM_ERR_TIMEOUT.
+ *
+ *     cc -pthread -I../Core/Inc stream_host.c ../Core/Src/stream.c -o stream_host
+ *     stream_host image.bin [base] [block] [program_us] [download_us] [stop]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stream.h"
+
+#define FLASH_BASE 0x90000000U
+#define FLASH_SIZE 0x200000U
+
+static stream_mailbox_t mailbox;
+static uint8_t flash[FLASH_SIZE];
+static unsigned program_us;
+static uint32_t result;
+
+static void spin_us(unsigned us)
+{
+    struct timespec ts = {us / 1000000, (long)(us % 1000000) * 1000};
+
+    if (us)
+    {
+        nanosleep(&ts, NULL);
+    }
+}
+
+static int program(uint32_t address, const uint8_t *data, uint32_t size)
+{
+    if (address < FLASH_BASE || address - FLASH_BASE + size > FLASH_SIZE)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < size; i++)
+    {
+        flash[address - FLASH_BASE + i] &= data[i];
+    }
+    spin_us(program_us);
+
+    return 0;
+}
+
+static uint32_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void *loader(void *arg)
+{
+    (void)arg;
+    result = stream_run(&mailbox, program, now_ms);
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t base = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : FLASH_BASE;
+    uint32_t block = (argc > 3) ? (uint32_t)strtoul(argv[3], NULL, 0) : STREAM_SLOT_SIZE;
+    unsigned download_us = (argc > 5) ? (unsigned)strtoul(argv[5], NULL, 0) : 0;
+    int stop = (argc > 6) ? atoi(argv[6]) : 1;
+    unsigned long stalls = 0;
+    uint32_t head = 0;
+    size_t size;
+    uint8_t *image;
+    FILE *f;
+    pthread_t thread;
+    struct timespec t0, t1;
+
+    program_us = (argc > 4) ? (unsigned)strtoul(argv[4], NULL, 0) : 0;
+    if (argc < 2 || block == 0 || block > STREAM_SLOT_SIZE || !(f = fopen(argv[1], "rb")))
+    {
+        fprintf(stderr, "usage: %s image.bin [base] [block <= %u] [program_us] [download_us] [stop]\n", argv[0],
+                STREAM_SLOT_SIZE);
+        return 2;
+    }
+    fseek(f, 0, SEEK_END);
+    size = (size_t)ftell(f);
+    rewind(f);
+    image = malloc(size ? size : 1);
+    if (!image || fread(image, 1, size, f) != size || base - FLASH_BASE + size > FLASH_SIZE)
+    {
+        fprintf(stderr, "cannot load %s at 0x%08X\n", argv[1], (unsigned)base);
+        return 2;
+    }
+    fclose(f);
+    memset(flash, 0xFF, sizeof(flash));
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_create(&thread, NULL, loader, NULL);
+    while (mailbox.magic != STREAM_MAGIC)
+    {
+        sched_yield();
+    }
+
+    for (size_t pos = 0; pos < size && mailbox.magic == STREAM_MAGIC; pos += block, head++)
+    {
+        stream_slot_t *slot;
+        uint32_t n = (size - pos < block) ? (uint32_t)(size - pos) : block;
+
+        /* Wait for a free slot, as J-Link does before each download */
+        if (head - mailbox.tail >= STREAM_SLOTS)
+        {
+            stalls++;
+            while (head - mailbox.tail >= STREAM_SLOTS && mailbox.magic == STREAM_MAGIC)
+            {
+                sched_yield();
+            }
+        }
+        slot = &mailbox.slots[head % STREAM_SLOTS];
+        slot->address = base + (uint32_t)pos;
+        slot->size = n;
+        memcpy(slot->data, image + pos, n);
+        spin_us(download_us);
+        STREAM_BARRIER();
+        mailbox.head = head + 1;
+    }
+    STREAM_BARRIER();
+    if (stop)
+    {
+        mailbox.command = STREAM_CMD_STOP;
+    }
+    pthread_join(thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("blocks %u bytes %u status %u stalls %lu time %.3f ms\n", (unsigned)head, (unsigned)mailbox.bytes,
+           (unsigned)result, stalls, (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+    if (result != (stop ? STREAM_OK : STREAM_ERR_TIMEOUT) || mailbox.bytes != size || memcmp(flash + (base - FLASH_BASE), image, size) != 0)
+    {
+        fprintf(stderr, "flash contents do not match the image\n");
+        return 1;
+    }
+    free(image);
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Pretty-print a dump of the loader telemetry block (Core/Inc/telemetry.h).
+
+The block lives at 0x2000E000 in both the .stldr and .SFL builds. Dump it
+after a programming session with e.g.
+
+    STM32_Programmer_CLI -c port=SWD mode=HOTPLUG -u 0x2000E000 0x400 telemetry.bin
+    J-Link> savebin telemetry.bin 0x2000E000 0x400
+
+and run `telemetry_decode.py telemetry.bin`.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = 0x4D4C4554
+VERSION = 2
+
+# Order of telemetry_op_t
+OPS = [
+    "Init",
+    "Write",
+    "Read",
+    "SectorErase",
+    "MassErase",
+    "CheckSum",
+    "Verify",
+    "SEGGER_FL_Erase",
+    "SEGGER_FL_Verify",
+    "SEGGER_FL_CheckBlank",
+    "SEGGER_FL_CalcCRC",
+    "SectorCrc",
+    "WriteCompressed",
+    "Fill",
+    "Batch",
+    "StreamStart",
+]
+
+ERRORS = {
+    0: "",
+    1: "HAL_ERROR",
+    2: "HAL_BUSY",
+    3: "HAL_TIMEOUT",
+    0x10: "VERIFY",
+    0x11: "BLANK",
+}
+
+HEADER = struct.Struct("<8I")
+OP_STATS = struct.Struct("<Q10I")
+OP_FIELDS = ("cycles_total", "calls", "bytes", "commands", "polls", "skipped_pages",
+             "skipped_sectors", "errors", "last_error", "cycles_min", "cycles_max")
+
+
+def decode(data):
+    magic, version, clock, op_num, attached = HEADER.unpack_from(data, 0)[:5]
+    if magic != MAGIC:
+        raise ValueError("bad magic 0x%08X, telemetry not initialised" % magic)
+    if version != VERSION:
+        raise ValueError("unsupported telemetry version %d" % version)
+    if op_num != len(OPS):
+        raise ValueError("telemetry has %d operations, expected %d" % (op_num, len(OPS)))
+    if len(data) < HEADER.size + op_num * OP_STATS.size:
+        raise ValueError("dump is %d bytes, telemetry needs %d" % (len(data), HEADER.size + op_num * OP_STATS.size))
+
+    ops = []
+    for i in range(op_num):
+        fields = dict(zip(OP_FIELDS, OP_STATS.unpack_from(data, HEADER.size + i * OP_STATS.size)))
+        fields["name"] = OPS[i]
+        ops.append(fields)
+
+    return {"core_clock_hz": clock, "init_attached": attached, "ops": ops}
+
+
+def us(cycles, clock):
+    return cycles * 1e6 / clock if clock else 0.0
+
+
+def print_table(t):
+    clock = t["core_clock_hz"]
+    print("core clock %.1f MHz, Init() fast attach %d" % (clock / 1e6, t["init_attached"]))
+    print("%-20s %7s %10s %9s %11s %11s %11s %12s %7s %6s %6s %6s %5s %-11s" % (
+        "operation", "calls", "bytes", "MB/s", "min us", "avg us", "max us", "total ms",
+        "cmds", "polls", "skipP", "skipS", "err", "last err"))
+    total = 0
+    for op in t["ops"]:
+        if op["calls"] == 0:
+            continue
+        total_us = us(op["cycles_total"], clock)
+        total += total_us
+        rate = op["bytes"] / total_us if total_us else 0.0
+        print("%-20s %7d %10d %9.2f %11.1f %11.1f %11.1f %12.1f %7d %6d %6d %6d %5d %-11s" % (
+            op["name"], op["calls"], op["bytes"], rate,
+            us(op["cycles_min"], clock), total_us / op["calls"], us(op["cycles_max"], clock),
+            total_us / 1000, op["commands"], op["polls"], op["skipped_pages"],
+            op["skipped_sectors"], op["errors"], ERRORS.get(op["last_error"], hex(op["last_error"]))))
+    print("total %.1f ms" % (total / 1000))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dump", help="raw binary dump starting at the telemetry block")
+    parser.add_argument("--json", action="store_true", help="print JSON instead of a table")
+    args = parser.parse_args()
+
+    with open(args.dump, "rb") as f:
+        data = f.read()
+
+    try:
+        t = decode(data)
+    except (ValueError, struct.error) as e:
+        sys.exit("%s: %s" % (args.dump, e))
+
+    if args.json:
+        json.dump(t, sys.stdout, indent=2)
+        print()
+    else:
+        print_table(t)
+
+
+if __name__ == "__main__":
+    main()
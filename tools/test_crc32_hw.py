@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""crc32_hw.c on the host CRC unit model (loader_host.py) against zlib
+crc32(), directly and through the entry points built on it."""
+
+import ctypes
+import os
+import random
+import sys
+import unittest
+import zlib
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from loader_host import Board, Target  # noqa: E402
+from w25q_model import Flash  # noqa: E402
+
+
+class Crc32HwTest(unittest.TestCase):
+    def setUp(self):
+        self.board = Board.get()
+        self.flash = Flash()
+        self.board.attach(self.flash)
+        self.target = Target()
+        self.rnd = random.Random(1)
+
+    def tearDown(self):
+        self.board.free_all()
+        self.assertEqual(self.flash.errors, [])
+
+    def crc(self, data, align=0):
+        addr = self.board.put(bytes(align) + data) + align
+        self.target.call("crc32_hw_init", restype=None)
+        return self.target.call("crc32_hw_compute", addr, len(data), restype=ctypes.c_uint32)
+
+    def test_known_value(self):
+        self.assertEqual(self.crc(b"123456789"), 0xCBF43926)
+
+    def test_alignments_and_lengths(self):
+        for size in (0, 1, 3, 4, 5, 8, 255, 4096):
+            for align in range(4):
+                data = self.rnd.randbytes(size)
+                self.assertEqual(self.crc(data, align), zlib.crc32(data), "size %d align %d" % (size, align))
+
+    def test_sector_crc(self):
+        self.flash.mem[:0x3000] = self.rnd.randbytes(0x3000)
+        self.board.sync()
+        self.assertEqual(self.target.call("Init"), 1)
+        table = self.board.put(bytes(4 * 3))
+        self.assertEqual(self.target.call("SectorCrc", 0x90000000, 0x3000, table), 3)
+        crcs = (ctypes.c_uint32 * 3).from_address(table)
+        self.assertEqual(list(crcs), [zlib.crc32(self.flash.mem[i:i + 0x1000]) for i in range(0, 0x3000, 0x1000)])
+
+    def test_sector_crc_rejects_bad_ranges(self):
+        self.assertEqual(self.target.call("Init"), 1)
+        table = self.board.put(bytes(4 * 4))
+        end = 0x90000000 + self.flash.geo.size
+        for start, size, out in ((end - 0x1000, 0x2000, table), (0x90001000, 0xFFFFF000, table),
+                                 (end, 0x1000, table), (0x90000000, 0x1000, 0), (0x90000000, 0x1000, table + 2)):
+            self.assertEqual(self.target.call("SectorCrc", start, size, out), 0, hex(start))
+        # telemetry_t: 8 header words, then 48 byte telemetry_op_stats_t, errors
+        # at byte 32 of TELEMETRY_SECTOR_CRC (11)
+        telemetry = self.target.var(ctypes.c_uint32 * 160, "loader_telemetry")
+        self.assertEqual((telemetry[(32 + 11 * 48 + 32) // 4], telemetry[(32 + 11 * 48 + 36) // 4]), (5, 1))
+
+
+if __name__ == "__main__":
+    unittest.main()
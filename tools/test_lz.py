@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""WriteCompressed() on the host build (loader_host.py): images packed by
+lz_pack.compress() are decoded by lz_decode.c on the target side and the
+resulting W25Q16JV model contents are compared with the input."""
+
+import os
+import random
+import sys
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from loader_host import Loader  # noqa: E402
+from lz_pack import WINDOW, compress  # noqa: E402
+
+KB = 1024
+
+
+def mixed(size, seed=1):
+    """Firmware-like: random runs, repeats from within the window and fill."""
+    rnd = random.Random(seed)
+    out = bytearray()
+    while len(out) < size:
+        kind = rnd.randrange(3)
+        if kind == 0 or len(out) < 16:
+            out += rnd.randbytes(rnd.randrange(1, 200))
+        elif kind == 1:
+            back = rnd.randrange(1, min(len(out), WINDOW) + 1)
+            start = len(out) - back
+            out += bytes(out[start + i % back] for i in range(rnd.randrange(3, 300)))
+        else:
+            out += bytes([rnd.choice((0x00, 0xFF))]) * rnd.randrange(1, 500)
+    return bytes(out[:size])
+
+
+class WriteCompressedTest(unittest.TestCase):
+    def setUp(self):
+        self.loader = Loader()
+        self.flash = self.loader.flash
+        self.base = self.loader.geo.base
+        self.assertEqual(self.loader.Init(), 1)
+
+    def tearDown(self):
+        self.assertEqual(self.flash.errors, [])
+
+    def check(self, image, offset=0):
+        blob = compress(image)
+        self.assertEqual(self.loader.WriteCompressed(self.base + offset, blob), 1)
+        self.assertEqual(bytes(self.flash.mem[offset:offset + len(image)]), image)
+        self.assertEqual(self.loader.Read(self.base + offset, len(image)), image)
+        return blob
+
+    def test_random_mixed(self):
+        blob = self.check(mixed(64 * KB))
+        self.assertLess(len(blob), 48 * KB)
+
+    def test_zeros(self):
+        blob = self.check(bytes(64 * KB))
+        self.assertLess(len(blob), 2 * KB)
+
+    def test_incompressible(self):
+        image = random.Random(2).randbytes(32 * KB)
+        blob = self.check(image)
+        self.assertGreater(len(blob), len(image))
+
+    def test_unaligned_and_short(self):
+        for n, (offset, size) in enumerate(((3, 1), (255, 2), (4 * KB - 7, 300), (9 * KB + 1, 5 * KB))):
+            self.check(mixed(size, seed=n), offset)
+
+    def test_truncated_stream(self):
+        blob = compress(mixed(8 * KB))
+        self.assertEqual(self.loader.WriteCompressed(self.base, blob[:len(blob) // 2]), 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,358 @@
+#!/usr/bin/env python3
+"""The optional Write() / Verify() modules (rmw.c, write_cache.c,
+sector_map.c, write_verify.c, verify_policy.c, manifest.c) built on the
+host by loader_host.py with their LOADER_* option set, driven through the
+STM32CubeProgrammer entry points against the W25Q16JV model."""
+
+import ctypes
+import os
+import random
+import struct
+import sys
+import unittest
+import zlib
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from loader_host import VERIFY_POLICY_CRC, VERIFY_POLICY_SAMPLED, Loader, verify_config  # noqa: E402
+from lz_pack import compress  # noqa: E402
+
+KB = 1024
+
+
+def data(size, seed=1):
+    return random.Random(seed).randbytes(size)
+
+
+class ModuleTest(unittest.TestCase):
+    DEFINES = ()
+
+    def setUp(self):
+        self.loader = Loader(self.DEFINES)
+        self.flash = self.loader.flash
+        self.base = self.loader.geo.base
+        self.assertEqual(self.loader.Init(), 1)
+
+    def tearDown(self):
+        self.assertEqual(self.flash.errors, [])
+
+    def programmed(self, offset, image):
+        """Put an image in the array directly, as left by an earlier session."""
+        self.flash.mem[offset:offset + len(image)] = image
+        self.loader.board.sync()
+
+    def contents(self, offset, size):
+        return bytes(self.flash.mem[offset:offset + size])
+
+
+class RmwTest(ModuleTest):
+    DEFINES = ("LOADER_WRITE_RMW=1",)
+
+    def test_merges_into_programmed_sector(self):
+        old = data(4 * KB)
+        self.programmed(0, old)
+        record = data(100, seed=2)
+        self.flash.reset_stats()
+        self.assertEqual(self.loader.Write(self.base + 1000, record), 1)
+        self.assertEqual(self.contents(0, 4 * KB), old[:1000] + record + old[1100:])
+        self.assertEqual(self.flash.sector_erases, 1)
+        self.assertEqual(self.flash.page_programs, 16)
+
+    def test_clearing_bits_programs_in_place(self):
+        self.programmed(0, b"\xFF" * 512)
+        self.flash.reset_stats()
+        self.assertEqual(self.loader.Write(self.base + 256, b"\x0F" * 16), 1)
+        self.assertEqual(self.flash.sector_erases, 0)
+        self.assertEqual(self.flash.page_programs, 1)
+
+    def test_spans_sectors(self):
+        self.programmed(0, data(8 * KB))
+        image = data(2 * KB, seed=3)
+        self.assertEqual(self.loader.Write(self.base + 3 * KB, image), 1)
+        self.assertEqual(self.contents(3 * KB, 2 * KB), image)
+        self.assertEqual(self.flash.sector_erases, 2)
+
+    def test_fill_over_programmed_data(self):
+        old = data(8 * KB)
+        self.programmed(0, old)
+        self.flash.reset_stats()
+        self.assertEqual(self.loader.Fill(self.base + 1000, 5000, b"\x5A\xA5\x00"), 1)
+        self.assertEqual(self.contents(0, 8 * KB), old[:1000] + (b"\x5A\xA5\x00" * 1667)[:5000] + old[6000:])
+        self.assertEqual(self.flash.sector_erases, 2)
+
+
+class WriteCacheTest(ModuleTest):
+    DEFINES = ("LOADER_WRITE_CACHE=1",)
+
+    def test_records_combine_into_pages(self):
+        image = data(1 * KB)
+        self.flash.reset_stats()
+        for pos in range(0, len(image), 16):
+            self.assertEqual(self.loader.Write(self.base + pos, image[pos:pos + 16]), 1)
+        self.assertEqual(self.flash.page_programs, 4)
+        self.assertEqual(self.contents(0, len(image)), image)
+
+    def test_verify_flushes_partial_page(self):
+        record = data(16)
+        self.assertEqual(self.loader.Write(self.base + 8, record), 1)
+        self.assertEqual(self.flash.page_programs, 0)
+        self.assertIsNone(self.loader.Verify(self.base + 8, record))
+        self.assertEqual(self.contents(8, 16), record)
+
+    def test_gap_flushes(self):
+        self.loader.Write(self.base, b"\x00" * 16)
+        self.loader.Write(self.base + 32, b"\x11" * 16)
+        self.assertEqual(self.flash.page_programs, 1)
+        self.assertEqual(self.contents(0, 16), b"\x00" * 16)
+
+    def test_full_init_drops_pending_page(self):
+        self.loader.Write(self.base, b"\x00" * 16)
+        self.loader.board.reset()
+        self.assertEqual(self.loader.Init(), 1)
+        self.assertEqual(self.loader.Read(self.base, 16), b"\xFF" * 16)
+        self.assertEqual(self.flash.page_programs, 0)
+
+
+class SectorMapTest(ModuleTest):
+    DEFINES = ("LOADER_LAZY_ERASE=1",)
+
+    def test_erases_on_first_touch(self):
+        self.programmed(0, data(8 * KB))
+        image = data(8 * KB, seed=2)
+        self.flash.reset_stats()
+        for pos in range(0, len(image), 4 * KB):
+            self.assertEqual(self.loader.Write(self.base + pos, image[pos:pos + 4 * KB]), 1)
+        self.assertEqual(self.flash.sector_erases, 2)
+        self.assertEqual(self.contents(0, len(image)), image)
+
+    def test_init_between_halves(self):
+        first, second = data(2 * KB), data(2 * KB, seed=2)
+        self.assertEqual(self.loader.Write(self.base, first), 1)
+        self.assertEqual(self.loader.Init(), 1)
+        self.assertEqual(self.loader.Write(self.base + 2 * KB, second), 1)
+        self.assertEqual(self.contents(0, 4 * KB), first + second)
+        self.assertEqual(self.flash.sector_erases, 0)
+
+    def test_partial_write_keeps_old_data(self):
+        old = data(4 * KB)
+        self.programmed(0, old)
+        record = data(1 * KB, seed=2)
+        self.flash.reset_stats()
+        self.assertEqual(self.loader.Write(self.base + 1 * KB, record), 1)
+        self.assertEqual(self.contents(0, 4 * KB), old[:KB] + record + old[2 * KB:])
+        self.assertEqual(self.flash.sector_erases, 1)
+
+    def test_fill_over_programmed_data(self):
+        old = data(12 * KB)
+        self.programmed(0, old)
+        self.flash.reset_stats()
+        self.assertEqual(self.loader.Fill(self.base + 1000, 8000, b"\x00\x01"), 1)
+        self.assertEqual(self.contents(0, 12 * KB), old[:1000] + b"\x00\x01" * 4000 + old[9000:])
+        self.assertEqual(self.flash.sector_erases, 3)
+
+    def test_write_compressed_over_old_data(self):
+        old, image = data(8 * KB), data(6 * KB, seed=2)
+        self.programmed(0, old)
+        self.flash.reset_stats()
+        self.assertEqual(self.loader.WriteCompressed(self.base, compress(image)), 1)
+        self.assertEqual(self.contents(0, 8 * KB), image + old[6 * KB:])
+        self.assertEqual(self.flash.sector_erases, 2)
+
+    def test_write_compressed_past_the_end(self):
+        self.flash.reset_stats()
+        end = self.base + self.loader.geo.size
+        self.assertEqual(self.loader.WriteCompressed(end - 4 * KB, compress(data(8 * KB))), 0)
+        self.assertEqual(self.loader.WriteCompressed(end, compress(data(16))), 0)
+        self.assertEqual((self.flash.page_programs, self.flash.sector_erases), (0, 0))
+
+    def test_blank_sector_not_erased(self):
+        self.flash.reset_stats()
+        self.assertEqual(self.loader.Write(self.base + 4 * KB, data(256)), 1)
+        self.assertEqual(self.flash.sector_erases, 0)
+
+    def test_sector_erase_skips_known_blank(self):
+        self.assertEqual(self.loader.SectorErase(self.base, self.base + 4 * KB - 1), 1)
+        self.flash.reset_stats()
+        self.assertEqual(self.loader.SectorErase(self.base, self.base + 4 * KB - 1), 1)
+        self.assertEqual(self.flash.sector_erases, 0)
+
+    def test_init_forgets_states(self):
+        self.assertEqual(self.loader.SectorErase(self.base, self.base + 4 * KB - 1), 1)
+        self.programmed(0, b"\x00" * 16)    # changed outside the session
+        self.assertEqual(self.loader.Init(), 1)
+        self.flash.reset_stats()
+        self.assertEqual(self.loader.SectorErase(self.base, self.base + 4 * KB - 1), 1)
+        self.assertEqual(self.flash.sector_erases, 1)
+
+
+class WriteVerifyTest(ModuleTest):
+    DEFINES = ("LOADER_WRITE_VERIFY=1",)
+
+    def test_verify_skips_compare(self):
+        image = data(4 * KB)
+        self.assertEqual(self.loader.Write(self.base, image), 1)
+        self.assertIsNone(self.loader.Verify(self.base, image))
+        # Covered by the readback: a wrong buffer is not compared again
+        self.assertIsNone(self.loader.Verify(self.base, bytes(4 * KB)))
+
+    def test_readback_mismatch(self):
+        self.programmed(256, b"\x00" * 256)
+        self.assertEqual(self.loader.Write(self.base, b"\xA5" * 512), 0)
+        block = self.loader.target.var(ctypes.c_uint32 * 2, "write_verify")
+        self.assertEqual(block[1], self.base + 256)
+
+    def test_erase_forgets_range(self):
+        image = data(4 * KB)
+        self.loader.Write(self.base, image)
+        self.assertEqual(self.loader.SectorErase(self.base, self.base + 4 * KB - 1), 1)
+        self.assertIsNotNone(self.loader.Verify(self.base, image))
+
+    def test_full_init_forgets_ranges(self):
+        image = data(4 * KB)
+        self.loader.Write(self.base, image)
+        self.loader.board.reset()
+        self.programmed(0, b"\x00" * 16)    # by the application after the reset
+        self.assertEqual(self.loader.Init(), 1)
+        self.assertIsNotNone(self.loader.Verify(self.base, image))
+
+    def test_init_before_verify_keeps_ranges(self):
+        image = data(4 * KB)
+        self.assertEqual(self.loader.Init(), 1)
+        self.assertEqual(self.loader.Write(self.base, image), 1)
+        self.assertEqual(self.loader.Init(), 1)    # as STM32CubeProgrammer does before Verify()
+        self.assertIsNone(self.loader.Verify(self.base, bytes(4 * KB)))
+
+    def test_damaged_block_dropped(self):
+        image = data(4 * KB)
+        self.loader.Write(self.base, image)
+        block = self.loader.target.var(ctypes.c_uint32 * 5, "write_verify")
+        block[4] += 4 * KB    # range[0].end
+        self.assertEqual(self.loader.Init(), 1)
+        self.assertIsNotNone(self.loader.Verify(self.base, bytes(4 * KB)))
+
+
+class VerifyPolicyTest(ModuleTest):
+    DEFINES = ("LOADER_VERIFY_POLICIES=1",)
+    SIZE = 64 * KB
+
+    def setUp(self):
+        super().setUp()
+        self.image = data(self.SIZE)
+        self.programmed(0, self.image)
+
+    def configure(self, policy):
+        self.loader.verify_config = verify_config(policy, self.base, self.image, chunk=self.SIZE // 64, every=4,
+                                                  seed=1)
+
+    def verify(self):
+        for pos in range(0, self.SIZE, 8 * KB):
+            failed = self.loader.Verify(self.base + pos, self.image[pos:pos + 8 * KB])
+            if failed is not None:
+                return failed
+        return None
+
+    def test_crc_passes(self):
+        self.configure(VERIFY_POLICY_CRC)
+        self.assertIsNone(self.verify())
+
+    def test_crc_finds_chunk(self):
+        self.configure(VERIFY_POLICY_CRC)
+        self.programmed(5000, b"\x00")
+        self.assertEqual(self.verify(), self.base + 4 * KB)
+
+    def test_sampled_passes(self):
+        self.configure(VERIFY_POLICY_SAMPLED)
+        self.assertIsNone(self.verify())
+
+    def test_sampled_image_crc(self):
+        self.configure(VERIFY_POLICY_SAMPLED)
+        skipped = next(p for p in range(self.base, self.base + self.SIZE, 256)
+                       if p not in self.loader.sampled_pages(p, 256))
+        self.programmed(skipped - self.base, b"\x00")
+        self.assertEqual(self.verify(), self.base)
+
+    def test_used_up_at_image_end(self):
+        self.configure(VERIFY_POLICY_CRC)
+        self.assertIsNone(self.verify())
+        self.assertIsNotNone(self.loader.Verify(self.base, bytes(8 * KB)))
+
+    def test_init_keeps_config(self):
+        self.configure(VERIFY_POLICY_CRC)
+        self.assertEqual(self.loader.Init(), 1)
+        self.programmed(5000, b"\x00")
+        self.assertEqual(self.verify(), self.base + 4 * KB)
+
+    def test_full_init_drops_config(self):
+        self.configure(VERIFY_POLICY_CRC)
+        self.loader.board.reset()
+        self.assertEqual(self.loader.Init(), 1)
+        self.programmed(5000, b"\x00")
+        self.assertNotIn(self.verify(), (None, self.base + 4 * KB))    # compared in full
+
+    def test_out_of_range_config_ignored(self):
+        cfg = verify_config(VERIFY_POLICY_CRC, self.base, self.image, chunk=self.SIZE // 64, every=4, seed=1)
+        cfg["base"] = self.base + self.loader.geo.size - 4 * KB
+        self.loader.verify_config = cfg
+        self.assertEqual(self.loader.Init(), 1)
+        self.programmed(5000, b"\x00")
+        self.assertNotIn(self.verify(), (None, self.base + 4 * KB))    # compared in full
+
+
+class ManifestTest(ModuleTest):
+    DEFINES = ("LOADER_MANIFEST=1",)
+
+    def header(self):
+        offset = self.loader.geo.size - self.loader.geo.sector
+        return struct.unpack("<8I", self.contents(offset, 32)), offset + 32
+
+    def test_written_after_verify(self):
+        image = data(8 * KB)
+        self.assertEqual(self.loader.Write(self.base, image), 1)
+        self.assertIsNone(self.loader.Verify(self.base, image))
+        (magic, version, generation, sector_size, count, table_crc, stale, _), table = self.header()
+        self.assertEqual((magic, version, generation, sector_size, stale), (0x544E464D, 1, 1, 4 * KB, 0xFFFFFFFF))
+        crcs = struct.unpack("<%dI" % count, self.contents(table, 4 * count))
+        self.assertEqual(crcs[:2], (zlib.crc32(image[:4 * KB]), zlib.crc32(image[4 * KB:])))
+        self.assertEqual(crcs[2], zlib.crc32(b"\xFF" * 4 * KB))
+        self.assertEqual(table_crc, zlib.crc32(self.contents(table, 4 * count)))
+
+    def test_stale_until_verified(self):
+        image = data(4 * KB)
+        self.loader.Write(self.base, image)
+        self.loader.Verify(self.base, image)
+        self.assertEqual(self.loader.Init(), 1)
+        self.loader.Write(self.base + 4 * KB, image)
+        (_, _, generation, _, _, _, stale, _), _ = self.header()
+        self.assertEqual((generation, stale), (1, 0))
+        self.loader.Verify(self.base + 4 * KB, image)
+        (_, _, generation, _, _, _, stale, _), _ = self.header()
+        self.assertEqual((generation, stale), (2, 0xFFFFFFFF))
+
+    def table(self):
+        (_, _, generation, _, count, _, stale, _), table = self.header()
+        return generation, stale, struct.unpack("<%dI" % count, self.contents(table, 4 * count))
+
+    def test_init_drops_session_state(self):
+        image = data(4 * KB)
+        self.loader.Write(self.base, image)
+        self.loader.Verify(self.base, image)
+        self.loader.Write(self.base + 4 * KB, image)    # session ends without Verify()
+        self.programmed(5 * 4 * KB, data(4 * KB, seed=2))    # then the application changes a sector
+        self.assertEqual(self.loader.Init(), 1)
+        self.loader.Write(self.base, image)
+        self.loader.Verify(self.base, image)
+        generation, stale, crcs = self.table()
+        self.assertEqual((generation, stale), (2, 0xFFFFFFFF))
+        self.assertEqual(crcs[:6], tuple(zlib.crc32(self.contents(i * 4 * KB, 4 * KB)) for i in range(6)))
+
+    def test_verify_after_init(self):
+        image = data(8 * KB)
+        self.loader.Write(self.base, image)
+        self.assertEqual(self.loader.Init(), 1)    # as STM32CubeProgrammer does before Verify()
+        self.assertIsNone(self.loader.Verify(self.base, image))
+        generation, stale, crcs = self.table()
+        self.assertEqual((generation, stale), (1, 0xFFFFFFFF))
+        self.assertEqual(crcs[:3], (zlib.crc32(image[:4 * KB]), zlib.crc32(image[4 * KB:]), zlib.crc32(b"\xFF" * 4 * KB)))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""w25qxx.c and stm32l4xx_hal_qspi.c on the host (loader_host.py) against
+the W25Q16JV model: command sequences, resulting array contents and the
+time the driver takes for them."""
+
+import ctypes
+import os
+import random
+import sys
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from loader_host import Board, HostFault, Target  # noqa: E402
+from w25q_model import Flash  # noqa: E402
+
+
+class DriverTest(unittest.TestCase):
+    def setUp(self):
+        self.board = Board.get()
+        self.flash = Flash()
+        self.board.attach(self.flash)
+        self.target = Target()
+        self.assertEqual(self.target.call("Init"), 1)
+
+    def tearDown(self):
+        self.board.free_all()
+        self.assertEqual(self.flash.errors, [])
+
+    def write(self, offset, data):
+        return self.target.call("w25qxx_write", self.board.put(data), offset, len(data))
+
+    def test_init_from_reset(self):
+        self.assertEqual(self.board.lib.host_core_clock(), 80000000)
+        self.assertEqual(self.target.var(ctypes.c_uint32, "SystemCoreClock").value, 80000000)
+        self.assertTrue(self.flash.qe)
+
+    def test_init_attaches(self):
+        commands = self.board.stats.commands
+        self.assertEqual(self.target.call("Init"), 1)
+        # JEDEC ID and two status reads, nothing reprogrammed
+        self.assertEqual(self.board.stats.commands - commands, 3)
+
+    def test_download_keeps_clock(self):
+        # A new download reloads .data with the reset SystemCoreClock
+        target = Target()
+        self.assertEqual(target.call("Init"), 1)
+        self.assertEqual(target.var(ctypes.c_uint32, "SystemCoreClock").value, 80000000)
+
+    def test_read(self):
+        data = random.Random(3).randbytes(300)
+        self.write(0x2000, data)
+        buf = self.board.put(bytes(300))
+        self.assertEqual(self.target.call("w25qxx_read", buf, 0x2000, 300), 0)
+        self.assertEqual(ctypes.string_at(buf, 300), data)
+        # Mode byte 0xFF: the next command is not taken as an address
+        self.assertEqual(self.write(0x3000, b"\x00"), 0)
+        self.assertEqual(self.flash.mem[0x3000], 0x00)
+
+    def test_program_pages(self):
+        data = random.Random(1).randbytes(1000)
+        self.assertEqual(self.write(0x1F3, data), 0)
+        self.assertEqual(bytes(self.flash.mem[0x1F3:0x1F3 + len(data)]), data)
+        # 0x1F3..0x5DB touches five pages
+        self.assertEqual(self.flash.page_programs, 5)
+
+    def test_program_only_clears_bits(self):
+        self.write(0, b"\x0F")
+        self.write(0, b"\xF0")
+        self.assertEqual(self.flash.mem[0], 0x00)
+
+    def test_sector_erase(self):
+        self.write(0x1000, bytes(64))
+        start = self.board.time_us
+        self.assertEqual(self.target.call("w25qxx_erase_sector", 0x1000), 0)
+        elapsed = self.board.time_us - start
+        self.assertEqual(bytes(self.flash.mem[0x1000:0x2000]), b"\xFF" * 0x1000)
+        # Waited out, then polled at a sixteenth of the expected time
+        self.assertGreaterEqual(elapsed, self.flash.timing.tSE)
+        self.assertLess(elapsed, self.flash.timing.tSE * 1.1)
+
+    def test_segger_erase_sectors(self):
+        self.flash.mem[:0x6000] = bytes(0x6000)
+        self.board.sync()
+        # Sectors 2 and 3: SectorAddr is the first of them, SectorIndex its index
+        self.assertEqual(self.target.call("SEGGER_FL_Erase", 0x90002000, 2, 2), 0)
+        self.assertEqual(bytes(self.flash.mem[:0x6000]), bytes(0x2000) + b"\xFF" * 0x2000 + bytes(0x2000))
+
+    def test_memory_mapped(self):
+        data = random.Random(2).randbytes(256)
+        self.write(0x300, data)
+        buf = self.board.put(bytes(256))
+        runs = self.board.stats.mapped_runs
+        self.assertEqual(self.target.call("Read", 0x90000300, 256, buf), 1)
+        self.assertEqual(ctypes.string_at(buf, 256), data)
+        # One sequential burst behind the byte loop
+        self.assertEqual(self.board.stats.mapped_runs - runs, 1)
+        self.assertEqual(self.target.call("w25qxx_exit_memory_mapped_mode"), 0)
+        self.assertEqual(self.write(0x400, b"\x00"), 0)
+
+    def test_memory_mapped_twice(self):
+        self.assertEqual(self.target.call("w25qxx_enter_memory_mapped_mode"), 0)
+        commands = self.board.stats.commands
+        self.assertEqual(self.target.call("w25qxx_enter_memory_mapped_mode"), 0)
+        self.assertEqual(self.board.stats.commands, commands)
+        # SectorCrc() checks the result, after Verify() left the window mapped
+        table = self.board.put(bytes(4))
+        self.assertEqual(self.target.call("SectorCrc", 0x90000000, 4096, table), 1)
+
+    def test_checksum_on_its_own(self):
+        self.write(0, b"\x01\x02\x03\x04")
+        self.assertEqual(self.target.call("CheckSum", 0x90000000, 4, 0, restype=ctypes.c_uint32), 10)
+
+    def test_window_needs_memory_mapped_mode(self):
+        self.write(0, b"\x00")
+        with self.assertRaises(HostFault):
+            self.target.call("crc32_hw_compute", 0x90000000, 4, restype=ctypes.c_uint32)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""Convert a dump of the QSPI transaction trace (Core/Inc/qspi_trace.h) into
+Chrome trace / Perfetto JSON.
+
+Build the loader with LOADER_TRACE=1, run a session, then dump the DIAG
+region and convert it:
+
+    STM32_Programmer_CLI -c port=SWD mode=HOTPLUG -u 0x2000E000 0x2000 diag.bin
+    trace_export.py diag.bin -o trace.json
+
+Open trace.json in chrome://tracing or https://ui.perfetto.dev. The trace
+block is located by its magic, so any dump that contains it will do.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = 0x43525451
+VERSION = 1
+
+HEADER = struct.Struct("<8I")
+RECORD = struct.Struct("<4I4B")
+
+KINDS = ["command", "poll", "memory-mapped", "abort"]
+LINES = ["-", "1", "2", "4"]
+
+OPCODES = {
+    0x01: "WRSR1", 0x02: "PP", 0x03: "READ", 0x04: "WRDI", 0x05: "RDSR1",
+    0x06: "WREN", 0x0B: "FAST_READ", 0x11: "WRSR3", 0x15: "RDSR3", 0x20: "SE",
+    0x31: "WRSR2", 0x32: "QPP", 0x35: "RDSR2", 0x38: "QPI", 0x3B: "DREAD",
+    0x50: "WREN_VSR", 0x66: "RSTEN", 0x94: "QUAD_ID", 0x99: "RST", 0x9F: "JEDEC_ID",
+    0xAB: "RDP", 0xB9: "PD", 0xC0: "SET_READ_PARAM", 0xC7: "CE", 0xD8: "BE",
+    0xEB: "QUAD_IO_READ", 0xFF: "QPI_EXIT",
+}
+
+
+def find_trace(data):
+    for off in range(0, len(data) - HEADER.size + 1, 4):
+        magic, version = struct.unpack_from("<2I", data, off)
+        if magic == MAGIC and version == VERSION:
+            return off
+    raise ValueError("no QSPI trace block found")
+
+
+def decode(data):
+    off = find_trace(data)
+    _, _, clock, depth, head = HEADER.unpack_from(data, off)[:5]
+    first = max(0, head - depth)
+    records = []
+    for n in range(first, head):
+        start, end, address, length, opcode, kind, lines, dummy = RECORD.unpack_from(
+            data, off + HEADER.size + (n % depth) * RECORD.size)
+        records.append({
+            "seq": n, "start": start, "end": end, "address": address, "length": length,
+            "opcode": opcode, "kind": KINDS[kind] if kind < len(KINDS) else str(kind),
+            "lines": "%s-%s-%s%s" % (LINES[lines & 3], LINES[(lines >> 2) & 3],
+                                     LINES[(lines >> 4) & 3], " DDR" if lines & 0x40 else ""),
+            "dummy": dummy,
+        })
+    return clock, head, records
+
+
+def to_chrome(clock, records):
+    events = []
+    base = None
+    offset = 0
+    prev = None
+    mhz = clock / 1e6 if clock else 1.0
+    for r in records:
+        # Unwrap the 32-bit DWT counter, records are in issue order
+        if prev is not None and r["start"] < prev:
+            offset += 1 << 32
+        prev = r["start"]
+        start = r["start"] + offset
+        if base is None:
+            base = start
+        duration = (r["end"] - r["start"]) & 0xFFFFFFFF
+        name = r["kind"] if r["kind"] == "abort" else OPCODES.get(r["opcode"], "0x%02X" % r["opcode"])
+        events.append({
+            "name": name,
+            "cat": r["kind"],
+            "ph": "X",
+            "ts": (start - base) / mhz,
+            "dur": duration / mhz,
+            "pid": 1,
+            "tid": 1,
+            "args": {
+                "seq": r["seq"],
+                "opcode": "0x%02X" % r["opcode"],
+                "lines": r["lines"],
+                "address": "0x%06X" % r["address"],
+                "length": r["length"],
+                "dummy": r["dummy"],
+            },
+        })
+    events.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": 1, "args": {"name": "QUADSPI"}})
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dump", help="raw binary dump containing the trace block")
+    parser.add_argument("-o", "--output", help="output file (default: stdout)")
+    args = parser.parse_args()
+
+    with open(args.dump, "rb") as f:
+        data = f.read()
+
+    try:
+        clock, head, records = decode(data)
+    except (ValueError, struct.error) as e:
+        sys.exit("%s: %s" % (args.dump, e))
+
+    if head > len(records):
+        print("%d oldest records were overwritten" % (head - len(records)), file=sys.stderr)
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    json.dump(to_chrome(clock, records), out, indent=1)
+    out.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,445 @@
+#!/usr/bin/env python3
+"""Host-side timing model of the STM32L4 QUADSPI + W25Q16 pair.
+
+The QUADSPI kernel clock and the flash geometry are taken from the sources
+(SystemClock_Config() in main.c, MX_QUADSPI_Init() in quadspi.c, w25qxx.h)
+so estimates follow driver changes. Each transaction is costed in SCK
+cycles per phase (instruction, address, alternate bytes, dummy, data),
+plus chip-select high time and a fixed CPU/HAL overhead per command.
+Program/erase busy times come from the W25Q16JV datasheet.
+
+The Flash class mirrors what w25qxx.c issues for every driver call on a
+NOR-semantics memory array (programming can only clear bits, erase sets
+them), which the other tools use as their simulated target. Its
+transact() method is the bus-level view used by loader_host.py: one
+QUADSPI transaction at a time, checked against the W25Q16JV command set.
+
+Run without arguments for a per-operation cost table, or pass a trace
+dump (LOADER_TRACE=1) to compare modelled and measured transaction times.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+ROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+
+HSI_HZ = 16000000
+
+
+def read_source(rel):
+    with open(os.path.join(ROOT, rel), encoding="utf-8", errors="replace") as f:
+        return f.read()
+
+
+def parse_defines(rel):
+    defines = {}
+    for name, value in re.findall(r"^\s*#define\s+(\w+)\s+(0x[0-9A-Fa-f]+|\d+)U?\b", read_source(rel), re.M):
+        defines[name] = int(value, 0)
+    return defines
+
+
+class Geometry:
+    """Flash geometry as seen by the loader (w25qxx.h)."""
+
+    def __init__(self):
+        d = parse_defines("Core/Inc/w25qxx.h")
+        self.base = d["MEMORY_BASE_ADDR"]
+        self.size = d["MEMORY_FLASH_SIZE"]
+        self.page = d["MEMORY_PAGE_SIZE"]
+        self.sector = d["MEMORY_SECTOR_SIZE"]
+        self.block = d.get("MEMORY_BLOCK_SIZE", 0x10000)
+        self.transfer = d.get("MEMORY_TRANSFER_PAGE_SIZE", self.page)
+        self.erase_value = 0xFF
+
+
+class Clock:
+    """HCLK and QUADSPI SCK derived from the CubeMX init code."""
+
+    def __init__(self, hclk=None, prescaler=None):
+        main_c = read_source("Core/Src/main.c")
+        qspi_c = read_source("Core/Src/quadspi.c")
+        if hclk is None:
+            m = int(re.search(r"PLL\.PLLM\s*=\s*(\d+)", main_c).group(1))
+            n = int(re.search(r"PLL\.PLLN\s*=\s*(\d+)", main_c).group(1))
+            r = int(re.search(r"PLL\.PLLR\s*=\s*RCC_PLLR_DIV(\d+)", main_c).group(1))
+            hclk = HSI_HZ * n // m // r
+        if prescaler is None:
+            prescaler = int(re.search(r"Init\.ClockPrescaler\s*=\s*(\d+)", qspi_c).group(1))
+        self.hclk = hclk
+        self.prescaler = prescaler
+        self.sck = hclk / (prescaler + 1)
+        self.csht = int(re.search(r"QSPI_CS_HIGH_TIME_(\d+)_CYCLE", qspi_c).group(1))
+
+    def us(self, sck_cycles):
+        return sck_cycles * 1e6 / self.sck
+
+
+class Timing:
+    """W25Q16JV AC characteristics, microseconds. The times the loader
+    itself uses come from w25qxx.h."""
+
+    def __init__(self, worst=False):
+        d = parse_defines("Core/Inc/w25qxx.h")
+
+        def busy(name):
+            return float(d["W25X_t%s_MAX_MS" % name] * 1000 if worst else d["W25X_t%s_TYP_US" % name])
+
+        self.tPP_first = 30.0 if not worst else 50.0
+        self.tPP = busy("PP")
+        self.tSE = busy("SE")
+        self.tBE32 = 120000.0 if not worst else 1600000.0
+        self.tBE64 = busy("BE")
+        self.tCE = busy("CE")
+        self.tW = 10000.0 if not worst else 15000.0
+        self.tRST = float(d["W25X_tRST_US"])
+
+    def program(self, nbytes):
+        # First byte plus a linear share of the full-page time
+        return self.tPP_first + (self.tPP - self.tPP_first) * (nbytes - 1) / 255.0
+
+
+def transaction_cycles(instr=1, addr=0, addr_bits=24, alt=0, alt_bits=8, dummy=0, data=0, nbytes=0, ddr=False):
+    """SCK cycles of one QUADSPI transaction. Line counts are 0 (phase
+    absent), 1, 2 or 4. DDR transfers address, alternate and data on both
+    edges."""
+    cycles = 8 // instr if instr else 0
+    div = 2 if ddr else 1
+    if addr:
+        cycles += addr_bits // addr // div
+    if alt:
+        cycles += alt_bits // alt // div
+    cycles += dummy
+    if data:
+        cycles += (nbytes * 8) // data // div
+    return cycles
+
+
+JEDEC_ID = (0xEF, 0x40, 0x15)
+DEVICE_ID = (0xEF, 0x14)
+SR2_QE = 0x02
+
+
+class Flash:
+    """NOR flash array driven the way w25qxx.c drives the real part."""
+
+    def __init__(self, geometry=None, clock=None, timing=None, cmd_overhead_us=1.5, fill=0xFF, qe=False):
+        self.geo = geometry or Geometry()
+        self.clock = clock or Clock()
+        self.timing = timing or Timing()
+        self.cmd_overhead_us = cmd_overhead_us
+        self.mem = bytearray([fill]) * self.geo.size
+        self.qe = qe              # non-volatile QE bit, clear as shipped
+        self.errors = []          # protocol violations seen by transact()
+        self.on_change = None     # called with (start, end) when mem changes
+        self.reset_stats()
+        self.power_on()
+
+    def power_on(self):
+        """Volatile state after power-up or a 66h/99h reset."""
+        self.wel = False
+        self.sr2 = SR2_QE if self.qe else 0
+        self.busy_until = 0.0
+        self.reset_enabled = False
+        self.volatile_sr = False
+
+    def reset_stats(self):
+        self.bus_us = 0.0
+        self.busy_us = 0.0
+        self.cpu_us = 0.0
+        self.commands = 0
+        self.page_programs = 0
+        self.sector_erases = 0
+        self.block_erases = 0
+        self.chip_erases = 0
+        self.bytes_programmed = 0
+        self.bytes_read = 0
+        self.ignored = 0
+
+    @property
+    def time_us(self):
+        return self.bus_us + self.busy_us + self.cpu_us
+
+    def _cmd(self, **phases):
+        self.commands += 1
+        self.bus_us += self.clock.us(transaction_cycles(**phases) + self.clock.csht)
+        self.cpu_us += self.cmd_overhead_us
+
+    def _wait(self, busy_us):
+        # Busy time is waited out, then one status read completes the poll
+        self.busy_us += busy_us
+        self._cmd(data=1, nbytes=1)
+
+    def _write_enable(self):
+        self._cmd()
+        self._cmd(data=1, nbytes=1)
+
+    def cpu(self, us):
+        """Account CPU time spent outside QUADSPI transactions."""
+        self.cpu_us += us
+
+    def program_page(self, addr, data):
+        page = addr - addr % self.geo.page
+        if addr + len(data) > page + self.geo.page:
+            raise ValueError("page program crosses a page boundary at 0x%X" % addr)
+        self._write_enable()
+        self._cmd(addr=1, data=4, nbytes=len(data))
+        self._wait(self.timing.program(len(data)))
+        old = int.from_bytes(self.mem[addr:addr + len(data)], "little")
+        self.mem[addr:addr + len(data)] = (old & int.from_bytes(data, "little")).to_bytes(len(data), "little")
+        self.page_programs += 1
+        self.bytes_programmed += len(data)
+
+    def write(self, addr, data):
+        """w25qxx_write(): split into page programs."""
+        data = bytes(data)
+        pos = 0
+        while pos < len(data):
+            n = min(self.geo.page - (addr + pos) % self.geo.page, len(data) - pos)
+            self.program_page(addr + pos, data[pos:pos + n])
+            pos += n
+
+    def _erase(self, addr, size, busy_us):
+        self._write_enable()
+        self._cmd(addr=1)
+        self._wait(busy_us)
+        start = addr - addr % size
+        self.mem[start:start + size] = bytes([self.geo.erase_value]) * size
+
+    def erase_sector(self, addr):
+        self._erase(addr, self.geo.sector, self.timing.tSE)
+        self.sector_erases += 1
+
+    def erase_block(self, addr):
+        self._erase(addr, self.geo.block, self.timing.tBE64)
+        self.block_erases += 1
+
+    def erase_block32(self, addr):
+        self._erase(addr, self.geo.block // 2, self.timing.tBE32)
+        self.block_erases += 1
+
+    def erase_chip(self):
+        self._write_enable()
+        self._cmd()
+        self._wait(self.timing.tCE)
+        self.mem[:] = bytes([self.geo.erase_value]) * self.geo.size
+        self.chip_erases += 1
+
+    def read(self, addr, size):
+        """w25qxx_read(): quad I/O fast read (0xEB), mode byte 0xFF and 4
+        dummy cycles."""
+        self._cmd(addr=4, alt=4, dummy=4, data=4, nbytes=size)
+        self.bytes_read += size
+        return bytes(self.mem[addr:addr + size])
+
+    def mapped_read(self, addr, size):
+        """CPU reads through the memory-mapped window: one 0xEB command
+        with alternate byte and 4 dummy cycles, then 2 SCK cycles per byte."""
+        self._cmd(addr=4, alt=4, dummy=4, data=4, nbytes=size)
+        self.bytes_read += size
+        return bytes(self.mem[addr:addr + size])
+
+    # -- bus level: one QUADSPI transaction as the pins see it ---------------
+
+    def _error(self, now_us, text):
+        self.errors.append("%.1f us: %s" % (now_us, text))
+        return b""
+
+    def _changed(self, start, end):
+        if self.on_change:
+            self.on_change(start, end)
+
+    def _program(self, now_us, addr, data):
+        # Bytes past the end of the page wrap around to its start
+        page = addr - addr % self.geo.page
+        for i, b in enumerate(data[-self.geo.page:]):
+            a = page + (addr - page + i) % self.geo.page
+            self.mem[a] &= b
+        self.busy_until = now_us + self.timing.program(max(1, min(len(data), self.geo.page)))
+        self.page_programs += 1
+        self.bytes_programmed += len(data)
+        self._changed(page, page + self.geo.page)
+
+    def _erase_at(self, now_us, addr, size, busy_us):
+        start = addr - addr % size
+        self.mem[start:start + size] = bytes([self.geo.erase_value]) * size
+        self.busy_until = now_us + busy_us
+        self._changed(start, start + size)
+
+    def transact(self, now_us, instruction, imode=1, address=0, admode=0, adsize=24, alt=0, abmode=0,
+                 absize=8, dummy=0, dmode=0, ddr=0, data=b"", nbytes=0, mapped=False):
+        """Apply one transaction ending at now_us and return the bytes the
+        flash drives for a read. mapped is the memory-mapped setup, which
+        is only checked. The W25Q16JV has no QPI mode, so 4-line
+        instructions are not decoded; violations of the command protocol
+        are recorded in self.errors."""
+        self.commands += 1
+        if imode != 1:
+            self.ignored += 1
+            return b""
+        op = instruction
+        busy = now_us < self.busy_until
+        reset_enabled, self.reset_enabled = self.reset_enabled, False
+        volatile_sr, self.volatile_sr = self.volatile_sr, False
+        addr = address % self.geo.size
+        quad = self.sr2 & SR2_QE
+
+        if op == 0x66:
+            self.reset_enabled = True
+            return b""
+        if op == 0x99:
+            if reset_enabled:
+                self.power_on()
+                self.busy_until = now_us + self.timing.tRST
+            return b""
+        if op in (0x05, 0x35, 0x15):
+            value = {0x05: (1 if busy else 0) | (2 if self.wel else 0), 0x35: self.sr2, 0x15: 0}[op]
+            return bytes([value]) * nbytes
+        if busy:
+            return self._error(now_us, "0x%02X while busy" % op)
+
+        if op == 0x06:
+            self.wel = True
+        elif op == 0x04:
+            self.wel = False
+        elif op == 0x50:
+            self.volatile_sr = True
+        elif op in (0x01, 0x31, 0x11):
+            if not data:
+                return self._error(now_us, "0x%02X without data" % op)
+            if not (volatile_sr or self.wel):
+                return self._error(now_us, "0x%02X without write enable" % op)
+            if op == 0x31:
+                self.sr2 = data[0]
+                if not volatile_sr:
+                    self.qe = bool(data[0] & SR2_QE)
+            if not volatile_sr:
+                self.wel = False
+                self.busy_until = now_us + self.timing.tW
+        elif op in (0x02, 0x32):
+            if not self.wel:
+                return self._error(now_us, "page program without write enable")
+            if op == 0x32 and (not quad or dmode != 4):
+                return self._error(now_us, "quad page program with QE=%d on %d lines" % (bool(quad), dmode))
+            self.wel = False
+            self._program(now_us, addr, bytes(data))
+        elif op in (0x20, 0x52, 0xD8, 0xC7, 0x60):
+            if not self.wel:
+                return self._error(now_us, "erase 0x%02X without write enable" % op)
+            self.wel = False
+            if op == 0x20:
+                self._erase_at(now_us, addr, self.geo.sector, self.timing.tSE)
+                self.sector_erases += 1
+            elif op == 0x52:
+                self._erase_at(now_us, addr, self.geo.block // 2, self.timing.tBE32)
+                self.block_erases += 1
+            elif op == 0xD8:
+                self._erase_at(now_us, addr, self.geo.block, self.timing.tBE64)
+                self.block_erases += 1
+            else:
+                self._erase_at(now_us, 0, self.geo.size, self.timing.tCE)
+                self.chip_erases += 1
+        elif op in (0x03, 0x0B, 0x6B, 0xEB):
+            if op == 0xEB:
+                if not quad:
+                    return self._error(now_us, "0xEB with QE=0")
+                if admode != 4 or abmode != 4 or absize != 8:
+                    # M7-0 follow the address; undriven they may enter continuous read mode
+                    return self._error(now_us, "0xEB without the mode byte on 4 lines")
+                if (alt & 0x30) == 0x20:
+                    return self._error(now_us, "0xEB mode byte 0x%02X enters continuous read mode" % alt)
+                if dummy != 4:
+                    return self._error(now_us, "0xEB with %d dummy cycles instead of 4" % dummy)
+            elif op == 0x6B and not quad:
+                return self._error(now_us, "0x6B with QE=0")
+            self.bytes_read += nbytes
+            end = addr + nbytes
+            out = self.mem[addr:end]
+            while len(out) < nbytes:
+                out += self.mem[:nbytes - len(out)]
+            return bytes(out)
+        elif op == 0x9F:
+            return bytes(JEDEC_ID[i % 3] for i in range(nbytes))
+        elif op in (0x90, 0x94):
+            if op == 0x94 and not quad:
+                # IO2/IO3 are still /WP and /HOLD, nothing valid comes back
+                return b"\xFF" * nbytes
+            return bytes(DEVICE_ID[i % 2] for i in range(nbytes))
+        else:
+            # 38h (QPI) and other instructions this part does not decode
+            self.ignored += 1
+        return b""
+
+
+def cost_table(flash):
+    geo = flash.geo
+    rows = []
+
+    def measure(name, nbytes, fn):
+        flash.reset_stats()
+        fn()
+        t = flash.time_us
+        rows.append((name, nbytes, t, flash.bus_us, flash.busy_us, nbytes / t if t and nbytes else 0.0))
+
+    page = bytes(geo.page)
+    measure("page program (%d B)" % geo.page, geo.page, lambda: flash.program_page(0, page))
+    measure("program 16 B", 16, lambda: flash.program_page(0, page[:16]))
+    measure("sector erase", geo.sector, lambda: flash.erase_sector(0))
+    measure("64K block erase", geo.block, lambda: flash.erase_block(0))
+    measure("chip erase", geo.size, flash.erase_chip)
+    measure("read 4K (0xEB)", geo.sector, lambda: flash.read(0, geo.sector))
+    measure("mapped read 4K", geo.sector, lambda: flash.mapped_read(0, geo.sector))
+    measure("program full chip", geo.size, lambda: flash.write(0, bytes(geo.size)))
+
+    print("HCLK %.1f MHz, QUADSPI prescaler %d -> SCK %.1f MHz, CSHT %d cycles, %.1f us CPU/command" % (
+        flash.clock.hclk / 1e6, flash.clock.prescaler, flash.clock.sck / 1e6, flash.clock.csht,
+        flash.cmd_overhead_us))
+    print("%-22s %9s %13s %11s %13s %9s" % ("operation", "bytes", "total us", "bus us", "busy us", "MB/s"))
+    for name, nbytes, t, bus, busy, rate in rows:
+        print("%-22s %9d %13.1f %11.1f %13.1f %9.3f" % (name, nbytes, t, bus, busy, rate))
+
+
+def cost_trace(clock, path):
+    sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+    import trace_export
+
+    with open(path, "rb") as f:
+        core_hz, _, records = trace_export.decode(f.read())
+    lines = {"-": 0, "1": 1, "2": 2, "4": 4}
+    total_model = total_measured = 0.0
+    print("%6s %-14s %-6s %8s %9s %11s %11s" % ("seq", "op", "lines", "address", "length", "model us", "meas. us"))
+    for r in records:
+        if r["kind"] not in ("command", "memory-mapped"):
+            continue
+        i, a, d = (lines[x] for x in r["lines"].split()[0].split("-"))
+        model = clock.us(transaction_cycles(instr=i, addr=a, dummy=r["dummy"], data=d,
+                                            nbytes=r["length"], ddr="DDR" in r["lines"]) + clock.csht)
+        measured = ((r["end"] - r["start"]) & 0xFFFFFFFF) * 1e6 / core_hz if core_hz else 0.0
+        total_model += model
+        total_measured += measured
+        print("%6d %-14s %-6s %08X %9d %11.2f %11.2f" % (
+            r["seq"], trace_export.OPCODES.get(r["opcode"], "0x%02X" % r["opcode"]), r["lines"].split()[0],
+            r["address"], r["length"], model, measured))
+    print("bus time modelled %.1f us, measured %.1f us" % (
+        total_model, total_measured))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--hclk", type=float, help="override HCLK in Hz")
+    parser.add_argument("--prescaler", type=int, help="override QUADSPI ClockPrescaler")
+    parser.add_argument("--overhead", type=float, default=1.5, help="CPU/HAL time per command in us")
+    parser.add_argument("--worst", action="store_true", help="use datasheet maximum busy times")
+    parser.add_argument("--trace", help="cost the transactions of a trace dump instead")
+    args = parser.parse_args()
+
+    clock = Clock(args.hclk, args.prescaler)
+    if args.trace:
+        cost_trace(clock, args.trace)
+    else:
+        cost_table(Flash(clock=clock, timing=Timing(args.worst), cmd_overhead_us=args.overhead))
+
+
+if __name__ == "__main__":
+    main()